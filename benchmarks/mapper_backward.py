@@ -0,0 +1,30 @@
+import torch
+import nestedtensor
+import utils
+
+import random
+
+# The total number of elements is held constant while the number of
+# constituents grows. The backward of autograd mapped ops such as transpose
+# and cumsum should not scale with the number of constituents.
+TOTAL_ROWS = 2 ** 16
+EMBED_DIM = 64
+
+
+def gen_nt_backward(num_constituents, fn):
+    rows = TOTAL_ROWS // num_constituents
+    nested_tensor = nestedtensor.nested_tensor(
+        [torch.rand(random.randint(rows // 2, rows), EMBED_DIM)
+         for _ in range(num_constituents)], requires_grad=True)
+
+    def nt():
+        fn(nested_tensor).sum().backward()
+    return nt
+
+
+if __name__ == "__main__":
+    for name, fn in [("transpose", lambda x: x.transpose(1, 2)),
+                     ("cumsum", lambda x: torch.cumsum(x, 2))]:
+        for num_constituents in [16, 256, 4096]:
+            print(name, num_constituents)
+            print(utils.benchmark_fn(gen_nt_backward(num_constituents, fn)))
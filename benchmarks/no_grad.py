@@ -0,0 +1,31 @@
+import torch
+import nestedtensor
+import utils
+
+import random
+
+# Many small constituents make the per-op overhead of the autograd mappers
+# visible. Under torch.no_grad() the mappers call the op directly.
+RAND_INTS = [random.randint(10, 30) for _ in range(2000)]
+
+
+def gen_nt(fn, requires_grad, no_grad):
+    nested_tensor = nestedtensor.nested_tensor(
+        [torch.rand(i, 64) for i in RAND_INTS], requires_grad=requires_grad)
+
+    def nt():
+        if no_grad:
+            with torch.no_grad():
+                fn(nested_tensor)
+        else:
+            fn(nested_tensor)
+    return nt
+
+
+if __name__ == "__main__":
+    for name, fn in [("transpose", lambda x: x.transpose(1, 2)),
+                     ("cumsum", lambda x: torch.cumsum(x, 2)),
+                     ("cos", lambda x: x.cos())]:
+        for requires_grad, no_grad in [(True, False), (True, True), (False, False)]:
+            print(name, "requires_grad", requires_grad, "no_grad", no_grad)
+            print(utils.benchmark_fn(gen_nt(fn, requires_grad, no_grad)))
@@ -0,0 +1,39 @@
+import torch
+import nestedtensor
+import utils
+
+import random
+random.seed(1010)
+
+# Compares the blocked ragged attention kernel, used by the default packed
+# mode, with attention computed for each constituent with torch.matmul,
+# which ragged_attention falls back to under packed_mode("never").
+EMBED_DIM = 256
+NUM_HEADS = 8
+RAND_INTS = [random.randint(50, 500) for _ in range(64)]
+
+
+def gen_nt_ragged_attention(mode, requires_grad, is_causal):
+    def gen():
+        return nestedtensor.nested_tensor(
+            [torch.randn(i, EMBED_DIM) for i in RAND_INTS],
+            requires_grad=requires_grad)
+    q, k, v = gen(), gen(), gen()
+
+    def nt():
+        with nestedtensor.packed_mode(mode):
+            result = nestedtensor.nn.functional.ragged_attention(
+                q, k, v, NUM_HEADS, is_causal=is_causal)
+            if requires_grad:
+                result.sum().backward()
+    return nt
+
+
+if __name__ == "__main__":
+    for requires_grad in [False, True]:
+        for is_causal in [False, True]:
+            for mode in ["auto", "never"]:
+                print("mode", mode, "requires_grad", requires_grad,
+                      "is_causal", is_causal)
+                print(utils.benchmark_fn(gen_nt_ragged_attention(
+                    mode, requires_grad, is_causal)))
@@ -12,6 +12,10 @@ from . import nested
 
 from . import _C
 
+from .nested.packed import set_packed_mode
+from .nested.packed import get_packed_mode
+from .nested.packed import packed_mode
+
 from . import nn
 
 # TODO: https://github.com/pytorch/pytorch/issues/34294
@@ -6,6 +6,12 @@ using namespace torch::nested_tensor;
 
 Tensor& NestedTensor_sub_(Tensor& self, const Tensor& other, Scalar alpha) {
   check_binary_shape(self, other);
+  if (_apply_binary_to_buffer_(
+          [&alpha](Tensor& s, const Tensor& o) { at::native::sub_(s, o, alpha); },
+          self,
+          other)) {
+    return self;
+  }
   if (is_nested_tensor_impl(self, other)) {
     torch_check_tensor_shape_matches(self, other);
     apply_nested_tensor(
@@ -42,6 +48,18 @@ Tensor& NestedTensor_sub_out(
       "NT binary out variant requires NT as result argument.");
   check_binary_shape(self, other);
   is_nested_tensor_impl(result, self, other);
+  if (can_apply_to_buffers(result, self, other)) {
+    at::Tensor result_buffer = get_buffer(result);
+    // Dense operands hold a single element and are expanded, since the out
+    // variant would otherwise resize result_buffer to their shape if result
+    // is the only NestedTensor.
+    at::sub_out(
+        result_buffer,
+        _buffer_or_tensor(self).expand_as(result_buffer),
+        _buffer_or_tensor(other).expand_as(result_buffer),
+        alpha);
+    return result;
+  }
   apply_nested_tensor(
       [&alpha](Tensor& result, Tensor& tensor, Tensor& other) {
         return at::sub_out(result, tensor, other, alpha);
@@ -60,6 +78,15 @@ Tensor& NestedTensor_pow_out_1(
       is_nested_tensor_impl(result),
       "NT binary out variant requires NT as result argument.");
   check_binary_shape(base, exp);
+  if (can_apply_to_buffers(result, base, exp)) {
+    at::Tensor result_buffer = get_buffer(result);
+    // See NestedTensor_sub_out for why dense operands are expanded.
+    at::pow_out(
+        result_buffer,
+        _buffer_or_tensor(base).expand_as(result_buffer),
+        _buffer_or_tensor(exp).expand_as(result_buffer));
+    return result;
+  }
   if (is_nested_tensor_impl(result, base, exp)) {
     torch_check_tensor_shape_matches(result, base, exp);
     apply_nested_tensor(
@@ -98,6 +125,14 @@ Tensor& NestedTensor_pow__1(Tensor& base, const Tensor& other) {
 }
 
 Tensor& NestedTensor_pow_out_2(Tensor& result, const Tensor& base, Scalar exp) {
+  if (is_nested_tensor_impl(result) && can_apply_to_buffers(result, base)) {
+    at::Tensor result_buffer = get_buffer(result);
+    // A dense base holds a single element and is expanded, since the out
+    // variant would otherwise resize result_buffer to its shape.
+    at::pow_out(
+        result_buffer, _buffer_or_tensor(base).expand_as(result_buffer), exp);
+    return result;
+  }
   apply_nested_tensor(
       [&exp](Tensor& result, Tensor& base) {
         return at::pow_out(result, base, exp);
@@ -108,11 +143,17 @@ Tensor& NestedTensor_pow_out_2(Tensor& result, const Tensor& base, Scalar exp) {
 }
 
 Tensor NestedTensor_pow_2(const Tensor& base, Scalar exp) {
-  return autograd_map_nested_tensor(
+  return autograd_map_elementwise_nested_tensor(
       [exp](Tensor base) { return at::pow(base, exp); }, base);
 }
 
 Tensor& NestedTensor_pow_out_3(Tensor& result, Scalar base, const Tensor& exp) {
+  if (is_nested_tensor_impl(result) && can_apply_to_buffers(result, exp)) {
+    at::Tensor result_buffer = get_buffer(result);
+    at::pow_out(
+        result_buffer, base, _buffer_or_tensor(exp).expand_as(result_buffer));
+    return result;
+  }
   apply_nested_tensor(
       [&base](Tensor& result, Tensor& exp) {
         return at::pow_out(result, base, exp);
@@ -123,7 +164,7 @@ Tensor& NestedTensor_pow_out_3(Tensor& result, Scalar base, const Tensor& exp) {
 }
 
 Tensor NestedTensor_pow_3(Scalar base, const Tensor& exp) {
-  return autograd_map_nested_tensor(
+  return autograd_map_elementwise_nested_tensor(
       [&base](Tensor exp) { return at::pow(base, exp); }, exp);
 }
 
@@ -27,6 +27,233 @@ inline void check_binary_shape(const Tensor& self, const Tensor& other) {
   }
 }
 
+// Returns the buffer of a NestedTensor and regular Tensors as they are. Only
+// use this if can_apply_to_buffers holds for the given Tensors.
+inline at::Tensor _buffer_or_tensor(const Tensor& tensor) {
+  if (is_nested_tensor_impl(tensor)) {
+    return get_buffer(tensor);
+  }
+  return tensor;
+}
+
+// A regular Tensor broadcasts against each constituent of a NestedTensor by
+// aligning with its trailing dimensions. If those dimensions are the same for
+// all constituents and dense doesn't expand them, an elementwise op can be
+// applied to the buffer of nt viewed as (-1, trailing sizes...) instead of to
+// each constituent. This returns that shape if nt is packed and contiguous.
+inline c10::optional<std::vector<int64_t>> _buffer_broadcast_shape(
+    const Tensor& nt,
+    const Tensor& dense) {
+  if (!is_nested_tensor_impl(nt) || is_nested_tensor_impl(dense) ||
+      !can_apply_to_buffers(nt)) {
+    return c10::nullopt;
+  }
+  auto impl = get_nested_tensor_impl(nt);
+  if (dense.dim() > nt.dim() - impl->nested_dim()) {
+    return c10::nullopt;
+  }
+  const std::vector<c10::optional<int64_t>>& opt_sizes = impl->opt_sizes();
+  std::vector<int64_t> shape{-1};
+  for (int64_t i = 0; i < dense.dim(); i++) {
+    c10::optional<int64_t> size = opt_sizes[nt.dim() - dense.dim() + i];
+    if (!size || *size == 0 ||
+        (dense.size(i) != *size && dense.size(i) != 1)) {
+      return c10::nullopt;
+    }
+    shape.push_back(*size);
+  }
+  return shape;
+}
+
+// A regular Tensor of the same dimension as a NestedTensor of nested
+// dimension 1 whose leading size matches the number of constituents
+// broadcasts one entry per constituent, e.g. a [N, 1, 1] Tensor scales each
+// constituent of a NestedTensor of N matrices by its own value. Entry i of the
+// regular Tensor then broadcasts against constituent i. This doesn't depend
+// on the packed mode or the sizes of the constituents.
+inline bool _is_segment_broadcast(const Tensor& nt, const Tensor& dense) {
+  return is_nested_tensor_impl(nt) && !is_nested_tensor_impl(dense) &&
+      get_nested_tensor_impl(nt)->nested_dim() == 1 &&
+      dense.dim() == nt.dim() && dense.size(0) == nt.size(0);
+}
+
+// Describes how to apply a segment broadcast to the buffer. The buffer is
+// viewed as (-1, trailing sizes...), in which constituent i owns the rows
+// [row_offsets[i], row_offsets[i + 1]), and the regular Tensor is viewed as
+// (N, trailing sizes...).
+struct SegmentBroadcast {
+  std::vector<int64_t> buffer_shape;
+  std::vector<int64_t> dense_shape;
+  std::vector<int64_t> row_offsets;
+};
+
+// Returns the SegmentBroadcast of dense against nt if the trailing sizes it
+// varies along are the same for all constituents. Otherwise the segment
+// broadcast needs to be applied to each constituent (see
+// _segments_as_nested_tensor).
+inline c10::optional<SegmentBroadcast> _segment_broadcast(
+    const Tensor& nt,
+    const Tensor& dense) {
+  if (get_packed_mode() == PackedMode::Never ||
+      !_is_segment_broadcast(nt, dense) || nt.numel() == 0) {
+    return c10::nullopt;
+  }
+  int64_t dim = nt.dim();
+  // The first dimension along which dense varies within a constituent. All
+  // dimensions from there on need to be regular.
+  int64_t first_trailing = 1;
+  while (first_trailing < dim && dense.size(first_trailing) == 1) {
+    first_trailing++;
+  }
+  const std::vector<c10::optional<int64_t>>& opt_sizes =
+      get_nested_tensor_impl(nt)->opt_sizes();
+  SegmentBroadcast result;
+  result.buffer_shape.push_back(-1);
+  result.dense_shape.push_back(dense.size(0));
+  for (int64_t i = first_trailing; i < dim; i++) {
+    c10::optional<int64_t> size = opt_sizes[i];
+    if (!size || *size == 0 ||
+        (dense.size(i) != *size && dense.size(i) != 1)) {
+      return c10::nullopt;
+    }
+    result.buffer_shape.push_back(*size);
+    result.dense_shape.push_back(dense.size(i));
+  }
+  const FlatSizeNode& nested_size =
+      get_nested_tensor_impl(nt)->flat_nested_size();
+  result.row_offsets.push_back(0);
+  for (int64_t i = 0; i < nested_size.num_leaves(); i++) {
+    c10::IntArrayRef size = nested_size.leaf(i);
+    int64_t rows = 1;
+    for (int64_t j = 0; j < first_trailing - 1; j++) {
+      rows *= size[j];
+    }
+    result.row_offsets.push_back(result.row_offsets.back() + rows);
+  }
+  return result;
+}
+
+// Calls fn(rows, entry) for the rows of each constituent in the view of
+// buffer given by segment_broadcast and the matching entry of dense.
+template <class F>
+inline void _for_each_segment(
+    F&& fn,
+    const Tensor& buffer,
+    const Tensor& dense,
+    const SegmentBroadcast& segment_broadcast) {
+  at::Tensor rows = buffer.view(segment_broadcast.buffer_shape);
+  at::Tensor entries = dense.reshape(segment_broadcast.dense_shape);
+  const std::vector<int64_t>& offsets = segment_broadcast.row_offsets;
+  for (size_t i = 0; i + 1 < offsets.size(); i++) {
+    at::Tensor segment =
+        rows.narrow(0, offsets[i], offsets[i + 1] - offsets[i]);
+    fn(segment, entries.narrow(0, i, 1));
+  }
+}
+
+// Applies the binary function fn to buffer and dense as described by
+// segment_broadcast and returns the result as a flat buffer. The entries of
+// dense are broadcast against the rows of one constituent at a time, so that
+// dense is never repeated to the size of the buffer. If nt_first is false the
+// arguments of fn are swapped.
+template <class F>
+inline at::Tensor _map_segments(
+    F&& fn,
+    const Tensor& buffer,
+    const Tensor& dense,
+    const SegmentBroadcast& segment_broadcast,
+    bool nt_first) {
+  at::Tensor result;
+  {
+    // Determines the type of the result, e.g. after type promotion.
+    at::NoGradGuard no_grad;
+    at::Tensor rows = buffer.view(segment_broadcast.buffer_shape);
+    at::Tensor entry = dense.reshape(segment_broadcast.dense_shape)[0];
+    at::Tensor no_rows = rows.narrow(0, 0, 0);
+    result = at::empty(
+        rows.sizes(),
+        (nt_first ? fn(no_rows, entry) : fn(entry, no_rows)).options());
+  }
+  int64_t offset = 0;
+  _for_each_segment(
+      [&fn, &result, &offset, nt_first](at::Tensor& rows, at::Tensor entry) {
+        result.narrow(0, offset, rows.size(0))
+            .copy_(nt_first ? fn(rows, entry) : fn(entry, rows));
+        offset += rows.size(0);
+      },
+      buffer,
+      dense,
+      segment_broadcast);
+  return result.reshape({-1});
+}
+
+// Returns a NestedTensor whose constituent i is dense[i] for a segment
+// broadcast that is applied to each constituent. The gradients of the
+// constituents are stacked into the gradient of dense.
+struct NestedTensorFunction_segments
+    : torch::autograd::Function<NestedTensorFunction_segments> {
+  static Tensor forward(
+      torch::autograd::AutogradContext* ctx,
+      const Tensor& dense) {
+    std::vector<TensorNode> segments;
+    for (int64_t i = 0; i < dense.size(0); i++) {
+      segments.push_back(TensorNode(dense.select(0, i)));
+    }
+    return wrap_tensor_node(TensorNode(std::move(segments)));
+  }
+  static torch::autograd::variable_list backward(
+      torch::autograd::AutogradContext* ctx,
+      torch::autograd::variable_list grad_output) {
+    TORCH_CHECK(grad_output.size() == 1, "Expected grad_output of size 1.");
+    if (!grad_output[0].defined()) {
+      return {grad_output[0]};
+    }
+    return {at::stack(flatten(get_nested_tensor_structure(grad_output[0])))};
+  }
+};
+
+inline at::Tensor _segments_as_nested_tensor(const Tensor& dense) {
+  return NestedTensorFunction_segments::apply(dense);
+}
+
+// Applies the inplace binary function fn to the buffer of self if possible.
+// A segment broadcast of other is always handled here, if need be by applying
+// fn to each constituent and its entry of other. Returns false if fn needs to
+// be applied to each constituent instead.
+template <class F>
+inline bool _apply_binary_to_buffer_(F&& fn, Tensor& self, const Tensor& other) {
+  if (!is_nested_tensor_impl(self)) {
+    return false;
+  }
+  if (can_apply_to_buffers(self, other)) {
+    at::Tensor self_buffer = get_buffer(self);
+    fn(self_buffer, _buffer_or_tensor(other));
+    return true;
+  }
+  c10::optional<std::vector<int64_t>> shape =
+      _buffer_broadcast_shape(self, other);
+  if (shape) {
+    at::Tensor self_buffer = get_buffer(self).view(*shape);
+    fn(self_buffer, other);
+    return true;
+  }
+  c10::optional<SegmentBroadcast> segment_broadcast =
+      _segment_broadcast(self, other);
+  if (segment_broadcast && can_apply_to_buffers(self)) {
+    _for_each_segment(fn, get_buffer(self), other, *segment_broadcast);
+    return true;
+  }
+  if (_is_segment_broadcast(self, other)) {
+    std::vector<at::Tensor> constituents =
+        flatten(get_nested_tensor_structure(self));
+    for (size_t i = 0; i < constituents.size(); i++) {
+      fn(constituents[i], other[i]);
+    }
+    return true;
+  }
+  return false;
+}
+
 inline std::tuple<at::Tensor, at::Tensor> _expand_other_as(const Tensor& self, const Tensor& other) {
   if (is_nested_tensor_impl(self, other)) {
     int64_t self_nested_dim = get_nested_tensor_impl(self)->nested_dim();
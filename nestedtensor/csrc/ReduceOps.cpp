@@ -1,4 +1,9 @@
+#include <ATen/AccumulateType.h>
+#include <ATen/Dispatch.h>
+#include <ATen/Parallel.h>
+#include <ATen/cpu/vec256/vec256.h>
 #include <ATen/core/op_registration/op_registration.h>
+#include <nestedtensor/csrc/ReduceOps.h>
 #include <nestedtensor/csrc/nested_tensor_impl.h>
 #include <torch/library.h>
 
@@ -6,6 +11,342 @@ namespace at {
 
 using namespace torch::nested_tensor;
 
+namespace impl {
+
+c10::optional<SegmentedReduction> segmented_reduction(
+    const Tensor& self,
+    std::vector<int64_t> dims,
+    bool keepdim) {
+  if (!can_apply_to_buffers(self) || dims.size() == 0) {
+    return c10::nullopt;
+  }
+  std::sort(dims.begin(), dims.end());
+  for (size_t i = 1; i < dims.size(); i++) {
+    if (dims[i] != dims[i - 1] + 1) {
+      return c10::nullopt;
+    }
+  }
+  int64_t begin = dims.front();
+  int64_t end = dims.back() + 1;
+  auto nt_impl = get_nested_tensor_impl(self);
+  const FlatSizeNode& nested_size = nt_impl->flat_nested_size();
+  const std::vector<int64_t>& input_offsets = nt_impl->contiguous_offsets();
+  std::vector<int64_t> outer;
+  std::vector<int64_t> reduce;
+  std::vector<int64_t> inner;
+  std::vector<int64_t> row_offsets;
+  std::vector<int64_t> output_offsets;
+  std::vector<int64_t> leaf_offsets;
+  std::vector<int64_t> values;
+  row_offsets.push_back(0);
+  output_offsets.push_back(0);
+  leaf_offsets.push_back(0);
+  for (int64_t i = 0; i < nested_size.num_leaves(); i++) {
+    c10::IntArrayRef size = nested_size.leaf(i);
+    int64_t o = 1;
+    int64_t r = 1;
+    int64_t n = 1;
+    for (int64_t j = 0; j < (int64_t)size.size(); j++) {
+      if (j < begin) {
+        o *= size[j];
+      } else if (j < end) {
+        r *= size[j];
+      } else {
+        n *= size[j];
+      }
+      if (j < begin || j >= end) {
+        values.push_back(size[j]);
+      } else if (keepdim) {
+        values.push_back(1);
+      }
+    }
+    outer.push_back(o);
+    reduce.push_back(r);
+    inner.push_back(n);
+    row_offsets.push_back(row_offsets.back() + o);
+    output_offsets.push_back(output_offsets.back() + o * n);
+    leaf_offsets.push_back(values.size());
+  }
+  return SegmentedReduction{std::move(outer),
+                            std::move(reduce),
+                            std::move(inner),
+                            input_offsets,
+                            std::move(row_offsets),
+                            std::move(output_offsets),
+                            FlatSizeNode(
+                                nested_size.structure(),
+                                std::move(leaf_offsets),
+                                std::move(values))};
+}
+
+bool use_segmented_reduction(
+    const Tensor& self,
+    c10::optional<ScalarType> dtype) {
+  return self.device().is_cpu() && at::isFloatingType(self.scalar_type()) &&
+      self.scalar_type() != at::kHalf && self.scalar_type() != at::kBFloat16 &&
+      (!dtype || *dtype == self.scalar_type());
+}
+
+namespace {
+
+// Whether autograd records operations on self.
+bool records_grad(const Tensor& self) {
+  return GradMode::is_enabled() && self.requires_grad();
+}
+
+// Number of entries of a contiguous row reduced in vector registers before
+// the partial result is folded into the accumulator of type acc_t.
+constexpr int64_t segment_reduce_chunk = 256;
+
+// Folds combine over the n contiguous entries of in starting from ident.
+// combine is applied lane-wise to Vec256 chunks of the row first.
+template <typename scalar_t, typename acc_t, typename F>
+acc_t reduce_row(const scalar_t* in, int64_t n, acc_t ident, const F& combine) {
+  using Vec = vec256::Vec256<scalar_t>;
+  acc_t acc = ident;
+  int64_t k = 0;
+  for (; k + segment_reduce_chunk <= n; k += segment_reduce_chunk) {
+    Vec partial = Vec::loadu(in + k);
+    for (int64_t c = Vec::size(); c < segment_reduce_chunk; c += Vec::size()) {
+      partial = combine(partial, Vec::loadu(in + k + c));
+    }
+    scalar_t lanes[Vec::size()];
+    partial.store(lanes);
+    for (int64_t l = 0; l < Vec::size(); l++) {
+      acc = combine(acc, acc_t(lanes[l]));
+    }
+  }
+  for (; k < n; k++) {
+    acc = combine(acc, acc_t(in[k]));
+  }
+  return acc;
+}
+
+// Reduces the rows of each segment by folding combine over the reduced
+// dimension starting from ident. The result is divided by the number of
+// reduced entries if mean is true. combine must accept both acc_t and Vec256
+// arguments.
+template <typename scalar_t, typename F>
+void segment_reduce_kernel(
+    const SegmentedReduction& r,
+    const scalar_t* input,
+    scalar_t* output,
+    at::acc_type<scalar_t, false> ident,
+    bool mean,
+    const F& combine) {
+  using acc_t = at::acc_type<scalar_t, false>;
+  parallel_for_segment_rows(r, [&](int64_t i, int64_t begin, int64_t end) {
+    const int64_t reduce = r.reduce[i];
+    const int64_t inner = r.inner[i];
+    const acc_t scale = mean ? acc_t(1) / acc_t(reduce) : acc_t(1);
+    const scalar_t* in = input + r.input_offsets[i];
+    scalar_t* out = output + r.output_offsets[i];
+    if (inner == 1) {
+      for (int64_t o = begin; o < end; o++) {
+        out[o] = reduce_row(in + o * reduce, reduce, ident, combine) * scale;
+      }
+      return;
+    }
+    std::vector<acc_t> acc(inner);
+    for (int64_t o = begin; o < end; o++) {
+      std::fill(acc.begin(), acc.end(), ident);
+      for (int64_t k = 0; k < reduce; k++) {
+        const scalar_t* in_k = in + (o * reduce + k) * inner;
+        for (int64_t j = 0; j < inner; j++) {
+          acc[j] = combine(acc[j], acc_t(in_k[j]));
+        }
+      }
+      scalar_t* out_o = out + o * inner;
+      for (int64_t j = 0; j < inner; j++) {
+        out_o[j] = acc[j] * scale;
+      }
+    }
+  });
+}
+
+// Writes the index along the reduced dimension of the entry for which better
+// holds against all others, and optionally its value.
+template <typename scalar_t, typename F>
+void segment_arg_reduce_kernel(
+    const SegmentedReduction& r,
+    const scalar_t* input,
+    scalar_t* values,
+    int64_t* indices,
+    F better) {
+  parallel_for_segment_rows(r, [&](int64_t i, int64_t begin, int64_t end) {
+    const int64_t reduce = r.reduce[i];
+    const int64_t inner = r.inner[i];
+    const scalar_t* in = input + r.input_offsets[i];
+    std::vector<scalar_t> best(inner);
+    for (int64_t o = begin; o < end; o++) {
+      int64_t* index_o = indices + r.output_offsets[i] + o * inner;
+      const scalar_t* in_o = in + o * reduce * inner;
+      std::copy(in_o, in_o + inner, best.begin());
+      std::fill(index_o, index_o + inner, 0);
+      for (int64_t k = 1; k < reduce; k++) {
+        const scalar_t* in_k = in_o + k * inner;
+        for (int64_t j = 0; j < inner; j++) {
+          if (better(in_k[j], best[j])) {
+            best[j] = in_k[j];
+            index_o[j] = k;
+          }
+        }
+      }
+      if (values != nullptr) {
+        std::copy(
+            best.begin(), best.end(), values + r.output_offsets[i] + o * inner);
+      }
+    }
+  });
+}
+
+enum class SegmentReduceOp { Sum, Mean, Prod };
+
+Tensor segment_reduce(
+    const Tensor& self,
+    const SegmentedReduction& r,
+    SegmentReduceOp op) {
+  trace_packed("segmented reduction");
+  Tensor input = get_buffer(self);
+  Tensor output = at::empty({r.output_offsets.back()}, input.options());
+  AT_DISPATCH_FLOATING_TYPES(input.scalar_type(), "segment_reduce", [&] {
+    const scalar_t* input_data = input.data_ptr<scalar_t>();
+    scalar_t* output_data = output.data_ptr<scalar_t>();
+    if (op == SegmentReduceOp::Prod) {
+      segment_reduce_kernel<scalar_t>(
+          r, input_data, output_data, 1, false, [](auto a, auto b) {
+            return a * b;
+          });
+    } else {
+      segment_reduce_kernel<scalar_t>(
+          r,
+          input_data,
+          output_data,
+          0,
+          op == SegmentReduceOp::Mean,
+          [](auto a, auto b) { return a + b; });
+    }
+  });
+  return wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+      std::move(output), r.output_nested_size));
+}
+
+// Returns the values (unless values_ is false) and the indices of the
+// maximum (or minimum) entries along the reduced dimension.
+std::tuple<Tensor, Tensor> segment_arg_reduce(
+    const Tensor& self,
+    const SegmentedReduction& r,
+    bool maximum,
+    bool values_) {
+  trace_packed("segmented arg reduction");
+  Tensor input = get_buffer(self);
+  for (int64_t i = 0; i < r.num_segments(); i++) {
+    TORCH_CHECK(
+        r.reduce[i] > 0 || r.outer[i] * r.inner[i] == 0,
+        "cannot perform reduction function on a constituent with no elements "
+        "along the reduced dimension.");
+  }
+  Tensor values;
+  if (values_) {
+    values = at::empty({r.output_offsets.back()}, input.options());
+  }
+  Tensor indices =
+      at::empty({r.output_offsets.back()}, input.options().dtype(at::kLong));
+  AT_DISPATCH_FLOATING_TYPES(input.scalar_type(), "segment_arg_reduce", [&] {
+    const scalar_t* input_data = input.data_ptr<scalar_t>();
+    scalar_t* values_data = values_ ? values.data_ptr<scalar_t>() : nullptr;
+    int64_t* indices_data = indices.data_ptr<int64_t>();
+    // NaNs propagate just like for at::max and at::min.
+    if (maximum) {
+      segment_arg_reduce_kernel<scalar_t>(
+          r, input_data, values_data, indices_data, [](scalar_t a, scalar_t b) {
+            return !std::isnan(b) && (std::isnan(a) || a > b);
+          });
+    } else {
+      segment_arg_reduce_kernel<scalar_t>(
+          r, input_data, values_data, indices_data, [](scalar_t a, scalar_t b) {
+            return !std::isnan(b) && (std::isnan(a) || a < b);
+          });
+    }
+  });
+  Tensor result_indices =
+      wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+          std::move(indices), r.output_nested_size));
+  if (!values_) {
+    return std::make_tuple(Tensor(), result_indices);
+  }
+  return std::make_tuple(
+      wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+          std::move(values), r.output_nested_size)),
+      result_indices);
+}
+
+// Writes the gradient of a segmented sum (or mean) into a new buffer laid out
+// like the input of the reduction by expanding grad along the reduced
+// dimension.
+Tensor segment_expand(
+    const Tensor& grad,
+    const SegmentedReduction& r,
+    const TensorOptions& options,
+    bool mean) {
+  Tensor input = get_buffer(grad.contiguous()).to(options.dtype());
+  Tensor output = at::empty({r.input_offsets.back()}, options);
+  AT_DISPATCH_FLOATING_TYPES(input.scalar_type(), "segment_expand", [&] {
+    const scalar_t* input_data = input.data_ptr<scalar_t>();
+    scalar_t* output_data = output.data_ptr<scalar_t>();
+    parallel_for_segment_rows(r, [&](int64_t i, int64_t begin, int64_t end) {
+      const int64_t reduce = r.reduce[i];
+      const int64_t inner = r.inner[i];
+      const scalar_t scale =
+          mean ? scalar_t(1) / scalar_t(reduce) : scalar_t(1);
+      const scalar_t* in = input_data + r.output_offsets[i];
+      scalar_t* out = output_data + r.input_offsets[i];
+      for (int64_t o = begin; o < end; o++) {
+        for (int64_t k = 0; k < reduce; k++) {
+          scalar_t* out_k = out + (o * reduce + k) * inner;
+          for (int64_t j = 0; j < inner; j++) {
+            out_k[j] = in[o * inner + j] * scale;
+          }
+        }
+      }
+    });
+  });
+  return output;
+}
+
+// Maps the given dimensions onto the tensor dimensions of the constituents.
+std::vector<int64_t> tensor_dims(
+    const Tensor& self,
+    c10::ArrayRef<int64_t> dims,
+    const std::string& name) {
+  auto nt_impl = get_nested_tensor_impl(self);
+  int64_t nested_dim = nt_impl->nested_dim();
+  std::vector<int64_t> newdims;
+  for (auto dim : dims) {
+    dim = maybe_wrap_dim(dim, nt_impl->dim());
+    TORCH_CHECK(
+        dim >= nested_dim,
+        name + " of nested dimensions is not implemented yet for dimension " +
+            std::to_string(dim));
+    newdims.push_back(dim - nested_dim);
+  }
+  return newdims;
+}
+
+// All tensor dimensions of the constituents.
+std::vector<int64_t> all_tensor_dims(const Tensor& self) {
+  auto nt_impl = get_nested_tensor_impl(self);
+  std::vector<int64_t> dims;
+  for (int64_t i = 0; i < nt_impl->dim() - nt_impl->nested_dim(); i++) {
+    dims.push_back(i);
+  }
+  return dims;
+}
+
+} // namespace
+
+} // namespace impl
+
 Tensor NestedTensor_cumsum(
     const Tensor& self,
     int64_t dim,
@@ -22,35 +363,175 @@ Tensor NestedTensor_cumsum(
       self);
 }
 
-#define REDUCE_DIM_LIST_FUNC(NAME, FUNC, MSG)                                 \
-  Tensor NestedTensor_##NAME(                                                 \
-      const Tensor& self,                                                     \
-      c10::ArrayRef<int64_t> dims,                                            \
-      bool keepdims,                                                          \
-      c10::optional<ScalarType> dtype) {                                      \
-    auto nt_impl = get_nested_tensor_impl(self);                              \
-    int64_t nested_dim = nt_impl->nested_dim();                               \
-    std::vector<int64_t> newdims;                                             \
-    for (auto dim : dims) {                                                   \
-      dim = maybe_wrap_dim(dim, nt_impl->dim());                              \
-      TORCH_CHECK(                                                            \
-          dim >= nested_dim,                                                  \
-          MSG " of nested dimensions is not implemented yet for dimension " + \
-              std::to_string(dim));                                           \
-      newdims.push_back(dim - nested_dim);                                    \
-    }                                                                         \
-    return autograd_map_nested_tensor(                                        \
-        [nested_dim, newdims, keepdims](at::Tensor tensor) {                  \
-          return FUNC(tensor, c10::ArrayRef<int64_t>(newdims), keepdims);     \
-        },                                                                    \
-        self);                                                                \
-  }
-
-REDUCE_DIM_LIST_FUNC(mean_dim, at::mean, "mean");
-REDUCE_DIM_LIST_FUNC(sum_dim, at::sum, "sum");
+// Sums (or averages) the tensor dimensions dims of a packed NestedTensor
+// with the segmented kernels. The backward expands the gradient straight into
+// a new buffer instead of calling autograd for each constituent.
+struct NestedTensorFunction_reduce_dim
+    : public torch::autograd::Function<NestedTensorFunction_reduce_dim> {
+  static Tensor forward(
+      torch::autograd::AutogradContext* ctx,
+      const Tensor& input,
+      std::vector<int64_t> dims,
+      bool keepdim,
+      bool mean) {
+    auto r = impl::segmented_reduction(input, dims, keepdim);
+    ctx->saved_data["0"] = dims;
+    ctx->saved_data["1"] = keepdim;
+    ctx->saved_data["2"] = mean;
+    ctx->save_for_backward({input});
+    return impl::segment_reduce(
+        input,
+        *r,
+        mean ? impl::SegmentReduceOp::Mean : impl::SegmentReduceOp::Sum);
+  }
+  static torch::autograd::variable_list backward(
+      torch::autograd::AutogradContext* ctx,
+      torch::autograd::variable_list grad_output_) {
+    at::Tensor input = ctx->get_saved_variables()[0];
+    std::vector<int64_t> dims = ctx->saved_data["0"].toIntVector();
+    bool keepdim = ctx->saved_data["1"].toBool();
+    bool mean = ctx->saved_data["2"].toBool();
+    at::Tensor grad_output = grad_output_[0];
+    TORCH_CHECK(
+        !grad_output.requires_grad(),
+        "NestedTensor sum and mean don't support double backward.");
+    auto r = impl::segmented_reduction(input, dims, keepdim);
+    TORCH_CHECK(r, "NestedTensor reduction input changed before backward.");
+    at::Tensor grad = wrap_tensor_node(
+        torch::nested_tensor::impl::build_structure(
+            impl::segment_expand(grad_output, *r, input.options(), mean),
+            get_nested_tensor_impl(input)->flat_nested_size()));
+    Tensor undef;
+    return {grad, undef, undef, undef};
+  }
+};
+
+#define REDUCE_DIM_LIST_FUNC(NAME, FUNC, MSG, MEAN)                          \
+  Tensor NestedTensor_##NAME(                                                \
+      const Tensor& self,                                                    \
+      c10::ArrayRef<int64_t> dims,                                           \
+      bool keepdims,                                                         \
+      c10::optional<ScalarType> dtype) {                                     \
+    std::vector<int64_t> newdims = impl::tensor_dims(self, dims, MSG);       \
+    if (impl::use_segmented_reduction(self, dtype) &&                        \
+        impl::segmented_reduction(self, newdims, keepdims)) {                \
+      return NestedTensorFunction_reduce_dim::apply(                         \
+          self, newdims, keepdims, MEAN);                                    \
+    }                                                                        \
+    return autograd_map_nested_tensor(                                       \
+        [newdims, keepdims, dtype](at::Tensor tensor) {                      \
+          return FUNC(                                                       \
+              tensor, c10::ArrayRef<int64_t>(newdims), keepdims, dtype);     \
+        },                                                                   \
+        self);                                                               \
+  }
+
+REDUCE_DIM_LIST_FUNC(mean_dim, at::mean, "mean", true);
+REDUCE_DIM_LIST_FUNC(sum_dim, at::sum, "sum", false);
 #undef REDUCE_DIM_LIST_FUNC
 
-Tensor NestedTensor_mean(const Tensor& self, c10::optional<ScalarType> dtype) {
+Tensor NestedTensor_prod_dim(
+    const Tensor& self,
+    int64_t dim,
+    bool keepdim,
+    c10::optional<ScalarType> dtype) {
+  std::vector<int64_t> newdims = impl::tensor_dims(self, {dim}, "prod");
+  if (!impl::records_grad(self) &&
+      impl::use_segmented_reduction(self, dtype)) {
+    auto r = impl::segmented_reduction(self, newdims, keepdim);
+    if (r) {
+      return impl::segment_reduce(self, *r, impl::SegmentReduceOp::Prod);
+    }
+  }
+  int64_t newdim = newdims[0];
+  return autograd_map_nested_tensor(
+      [newdim, keepdim, dtype](at::Tensor tensor) {
+        return at::prod(tensor, newdim, keepdim, dtype);
+      },
+      self);
+}
+
+#define ARG_REDUCE_DIM_FUNC(NAME, FUNC, MAXIMUM)                               \
+  std::tuple<Tensor, Tensor> NestedTensor_##NAME(                              \
+      const Tensor& self, int64_t dim, bool keepdim) {                         \
+    std::vector<int64_t> newdims = impl::tensor_dims(self, {dim}, #NAME);      \
+    if (!impl::records_grad(self) &&                                           \
+        impl::use_segmented_reduction(self, c10::nullopt)) {                   \
+      auto r = impl::segmented_reduction(self, newdims, keepdim);              \
+      if (r) {                                                                 \
+        return impl::segment_arg_reduce(self, *r, MAXIMUM, true);              \
+      }                                                                        \
+    }                                                                          \
+    int64_t newdim = newdims[0];                                               \
+    at::Tensor indices = map_nested_tensor(                                    \
+        [newdim, keepdim](at::Tensor tensor) {                                 \
+          return std::get<1>(FUNC(tensor, newdim, keepdim));                   \
+        },                                                                     \
+        self);                                                                 \
+    at::Tensor values = autograd_map_nested_tensor(                            \
+        [newdim, keepdim](at::Tensor tensor) {                                 \
+          return std::get<0>(FUNC(tensor, newdim, keepdim));                   \
+        },                                                                     \
+        self);                                                                 \
+    return std::make_tuple(values, indices);                                   \
+  }
+
+ARG_REDUCE_DIM_FUNC(max_dim, at::max, true);
+ARG_REDUCE_DIM_FUNC(min_dim, at::min, false);
+#undef ARG_REDUCE_DIM_FUNC
+
+Tensor NestedTensor_argmax(
+    const Tensor& self,
+    c10::optional<int64_t> dim,
+    bool keepdim) {
+  std::vector<int64_t> newdims = dim
+      ? impl::tensor_dims(self, {*dim}, "argmax")
+      : impl::all_tensor_dims(self);
+  if (impl::use_segmented_reduction(self, c10::nullopt) &&
+      (dim || !keepdim)) {
+    auto r = impl::segmented_reduction(self, newdims, keepdim);
+    if (r) {
+      return std::get<1>(impl::segment_arg_reduce(self, *r, true, false));
+    }
+  }
+  c10::optional<int64_t> newdim;
+  if (dim) {
+    newdim = newdims[0];
+  }
+  return map_nested_tensor(
+      [newdim, keepdim](at::Tensor tensor) {
+        return at::argmax(tensor, newdim, keepdim);
+      },
+      self);
+}
+
+// Reduces each constituent in full with the segmented kernels. Returns an
+// undefined Tensor if that's not possible.
+static Tensor _segment_reduce_constituents(
+    const Tensor& self,
+    c10::optional<ScalarType> dtype,
+    impl::SegmentReduceOp op) {
+  if (impl::records_grad(self) ||
+      !impl::use_segmented_reduction(self, dtype)) {
+    return Tensor();
+  }
+  std::vector<int64_t> dims = impl::all_tensor_dims(self);
+  if (dims.size() == 0) {
+    return Tensor();
+  }
+  auto r = impl::segmented_reduction(self, dims, false);
+  if (!r) {
+    return Tensor();
+  }
+  return get_buffer(impl::segment_reduce(self, *r, op));
+}
+
+Tensor _nested_mean(const Tensor& self, c10::optional<ScalarType> dtype) {
+  at::Tensor means =
+      _segment_reduce_constituents(self, dtype, impl::SegmentReduceOp::Mean);
+  if (means.defined() && means.numel() > 0) {
+    return at::mean(means, dtype);
+  }
   auto tensors = flatten(
       map([&dtype](at::Tensor tensor) { return at::mean(tensor, dtype); },
           get_nested_tensor_structure(self)));
@@ -65,6 +546,11 @@ Tensor NestedTensor_mean(const Tensor& self, c10::optional<ScalarType> dtype) {
 }
 
 Tensor NestedTensor_prod(const Tensor& self, c10::optional<ScalarType> dtype) {
+  at::Tensor prods =
+      _segment_reduce_constituents(self, dtype, impl::SegmentReduceOp::Prod);
+  if (prods.defined() && prods.numel() > 0) {
+    return at::prod(prods, dtype);
+  }
   auto tensors = flatten(
       map([&dtype](at::Tensor tensor) { return at::prod(tensor, dtype); },
           get_nested_tensor_structure(self)));
@@ -78,68 +564,82 @@ Tensor NestedTensor_prod(const Tensor& self, c10::optional<ScalarType> dtype) {
   return at::prod(all_tensor, dtype);
 }
 
-struct NestedTensorFunction_sum
-    : public torch::autograd::Function<NestedTensorFunction_sum> {
+Tensor _nested_sum(const Tensor& self, c10::optional<ScalarType> dtype) {
+  if (can_apply_to_buffers(self)) {
+    return at::sum(get_buffer(self), dtype);
+  }
+  auto tensors = flatten(
+      map([&dtype](at::Tensor tensor) { return at::sum(tensor, dtype); },
+          get_nested_tensor_structure(self)));
+  if (tensors.size() == 0) {
+    if (dtype) {
+      return at::ones({0}, *dtype);
+    }
+    return at::ones({0});
+  }
+  auto all_tensor = at::stack(tensors);
+  return at::sum(all_tensor, dtype);
+}
+
+// Sum or mean over all entries. The mean of a NestedTensor is the mean of the
+// means of its constituents. The backward writes the gradient straight into a
+// new buffer instead of calling autograd for each constituent.
+struct NestedTensorFunction_allreduce
+    : public torch::autograd::Function<NestedTensorFunction_allreduce> {
   static Tensor forward(
       torch::autograd::AutogradContext* ctx,
-      const Tensor& input_,
-      c10::optional<ScalarType> dtype) {
-    auto input = map_nested_tensor(
-        [](Tensor t) {
-          // XXX: Does this require autogradmode(true)?
-          AutoGradMode autogradmode(true);
-          auto alias = t.alias();
-          alias.requires_grad_();
-          return alias;
-        },
-        input_);
-    auto tensors = flatten(map(
-        [&dtype](at::Tensor tensor) {
-          AutoGradMode autogradmode(true);
-          return at::sum(tensor, dtype);
-        },
-        get_nested_tensor_structure(input)));
-    Tensor result;
-    {
-      AutoGradMode autogradmode(true);
-      if (tensors.size() == 0) {
-        if (dtype) {
-          return at::ones({0}, *dtype);
-        }
-        return at::ones({0});
-      }
-      auto all_tensor = at::stack(tensors);
-      result = at::sum(all_tensor, dtype);
-    }
-    ctx->save_for_backward({result, input});
-    return result.alias();
+      const Tensor& input,
+      c10::optional<ScalarType> dtype,
+      bool mean) {
+    ctx->saved_data["0"] = mean;
+    ctx->save_for_backward({input});
+    return mean ? _nested_mean(input, dtype) : _nested_sum(input, dtype);
   }
   static torch::autograd::variable_list backward(
       torch::autograd::AutogradContext* ctx,
       torch::autograd::variable_list grad_output_) {
-    auto saved = ctx->get_saved_variables();
-    at::Tensor result = saved[0];
-    at::Tensor input = saved[1];
+    at::Tensor input = ctx->get_saved_variables()[0];
+    bool mean = ctx->saved_data["0"].toBool();
     at::Tensor grad_output = grad_output_[0];
     TORCH_CHECK(
         !grad_output.requires_grad(),
-        "NestedTensor sum doesn't support double backward.");
+        "NestedTensor sum and mean don't support double backward.");
+    auto nt_impl = get_nested_tensor_impl(input);
+    const std::vector<int64_t>& offsets = nt_impl->contiguous_offsets();
+    grad_output = grad_output.to(input.scalar_type());
+    at::Tensor buffer;
+    if (mean) {
+      int64_t num_leaves = offsets.size() - 1;
+      std::vector<int64_t> numels;
+      std::vector<double> scales;
+      for (int64_t i = 0; i < num_leaves; i++) {
+        int64_t numel = offsets[i + 1] - offsets[i];
+        numels.push_back(numel);
+        scales.push_back(numel == 0 ? 0 : 1.0 / (num_leaves * numel));
+      }
+      at::Tensor scale = at::tensor(scales, input.options().dtype(at::kDouble))
+                             .to(input.scalar_type());
+      buffer = at::repeat_interleave(
+          scale * grad_output,
+          at::tensor(numels, input.options().dtype(at::kLong)),
+          0);
+    } else {
+      buffer = grad_output.reshape({1}).expand({offsets.back()}).contiguous();
+    }
+    at::Tensor grad = wrap_tensor_node(
+        torch::nested_tensor::impl::build_structure(
+            std::move(buffer), nt_impl->flat_nested_size()));
     Tensor undef;
-    // TODO:
-    // Flatten constituents and call grad on all of the variable lists at once
-    //
-    at::Tensor tensor = map_nested_tensor(
-        [&](Tensor i) {
-          // return grad_output.expand(i.sizes());
-          return torch::autograd::grad({result}, {i}, {grad_output}, true)[0];
-        },
-        input);
-    return {tensor, undef};
+    return {grad, undef, undef};
   }
 };
 
 Tensor NestedTensor_sum(const Tensor& self, c10::optional<ScalarType> dtype) {
-  return NestedTensorFunction_sum::apply(self, dtype);
+  return NestedTensorFunction_allreduce::apply(self, dtype, false);
+}
+
+Tensor NestedTensor_mean(const Tensor& self, c10::optional<ScalarType> dtype) {
+  return NestedTensorFunction_allreduce::apply(self, dtype, true);
 }
 
 TORCH_LIBRARY_IMPL(aten, AutogradPrivateUse1, m) {
@@ -148,6 +648,10 @@ TORCH_LIBRARY_IMPL(aten, AutogradPrivateUse1, m) {
   nt_impl(m, "mean.dim", NestedTensor_mean_dim);
   nt_impl(m, "mean", NestedTensor_mean);
   nt_impl(m, "prod", NestedTensor_prod);
+  nt_impl(m, "prod.dim_int", NestedTensor_prod_dim);
+  nt_impl(m, "max.dim", NestedTensor_max_dim);
+  nt_impl(m, "min.dim", NestedTensor_min_dim);
+  nt_impl(m, "argmax", NestedTensor_argmax);
   nt_impl(m, "cumsum", NestedTensor_cumsum);
 }
 
@@ -0,0 +1,72 @@
+#pragma once
+#include <ATen/Parallel.h>
+#include <nestedtensor/csrc/nested_tensor_impl.h>
+#include <algorithm>
+
+namespace at {
+namespace impl {
+
+// NOTE: Segmented reductions
+//
+// The constituents of a packed and contiguous NestedTensor are stored one
+// after the other in its buffer. A reduction over a contiguous range of
+// tensor dimensions [begin, end) views constituent i as a contiguous
+// (outer_i, reduce_i, inner_i) block and reduces along the middle dimension.
+// The result is another buffer with outer_i * inner_i entries per
+// constituent. All constituents are reduced in a single pass over the buffer
+// and the innermost loops run over contiguous memory. The work is split
+// across threads by rows, i.e. pairs of a constituent i and an index
+// o < outer_i, so that a few large constituents don't serialize.
+struct SegmentedReduction {
+  int64_t num_segments() const {
+    return outer.size();
+  }
+  std::vector<int64_t> outer;
+  std::vector<int64_t> reduce;
+  std::vector<int64_t> inner;
+  std::vector<int64_t> input_offsets;
+  // Segment i owns the rows [row_offsets[i], row_offsets[i + 1]).
+  std::vector<int64_t> row_offsets;
+  std::vector<int64_t> output_offsets;
+  FlatSizeNode output_nested_size;
+};
+
+// Returns a SegmentedReduction for reducing the tensor dimensions dims of
+// self if self is packed and contiguous and dims form a contiguous range.
+c10::optional<SegmentedReduction> segmented_reduction(
+    const Tensor& self,
+    std::vector<int64_t> dims,
+    bool keepdim);
+
+// Splits the rows of all segments evenly across threads, such that each task
+// covers roughly at::internal::GRAIN_SIZE elements. Calls fn(i, begin, end)
+// for each range [begin, end) of outer indices of segment i within a task.
+template <typename F>
+void parallel_for_segment_rows(const SegmentedReduction& r, const F& fn) {
+  const std::vector<int64_t>& rows = r.row_offsets;
+  int64_t per_row =
+      r.input_offsets.back() / std::max(rows.back(), (int64_t)1);
+  int64_t grain_size = std::max(
+      at::internal::GRAIN_SIZE / std::max(per_row, (int64_t)1), (int64_t)1);
+  at::parallel_for(
+      0, rows.back(), grain_size, [&](int64_t begin, int64_t end) {
+        int64_t i = std::upper_bound(rows.begin(), rows.end(), begin) -
+            rows.begin() - 1;
+        for (; begin < end; i++) {
+          int64_t row_end = std::min(end, rows[i + 1]);
+          if (row_end > begin) {
+            fn(i, begin - rows[i], row_end - rows[i]);
+            begin = row_end;
+          }
+        }
+      });
+}
+
+// The segmented kernels only support floating point types without
+// conversion.
+bool use_segmented_reduction(
+    const Tensor& self,
+    c10::optional<ScalarType> dtype);
+
+} // namespace impl
+} // namespace at
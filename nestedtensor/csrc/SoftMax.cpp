@@ -0,0 +1,376 @@
+#include <ATen/AccumulateType.h>
+#include <ATen/Dispatch.h>
+#include <ATen/Parallel.h>
+#include <ATen/cpu/vec256/vec256.h>
+#include <ATen/core/op_registration/op_registration.h>
+#include <nestedtensor/csrc/ReduceOps.h>
+#include <nestedtensor/csrc/nested_tensor_impl.h>
+#include <torch/library.h>
+
+namespace at {
+
+using namespace torch::nested_tensor;
+
+namespace impl {
+
+// NOTE: Segmented softmax
+//
+// A softmax along the tensor dimension dim of a packed NestedTensor
+// normalizes the reduce_i entries of each row of the (outer_i, reduce_i,
+// inner_i) blocks of the SegmentedReduction over {dim}. The kernels below
+// split the rows of all constituents across threads in one pass over the
+// buffer. Their innermost loops run over the inner_i contiguous rows of a
+// block at once. If inner_i is 1 the reduce_i entries of a row are contiguous
+// and the max, exp and sum are computed with Vec256. An optional additive
+// mask shares the layout of the input, so that e.g. packed [L_i, L_i]
+// attention scores can be masked per constituent.
+
+namespace {
+
+// Number of entries of a contiguous row summed in vector registers before the
+// partial sum is added to the accumulator of type acc_t.
+constexpr int64_t segment_softmax_chunk = 256;
+
+// Writes softmax(in + m), or its logarithm, of the n contiguous entries of a
+// row into out. in + m is written to out first, so that m is only read once.
+template <typename scalar_t>
+void softmax_row(
+    const scalar_t* in,
+    const scalar_t* m,
+    scalar_t* out,
+    int64_t n,
+    bool log) {
+  using Vec = vec256::Vec256<scalar_t>;
+  using acc_t = at::acc_type<scalar_t, false>;
+  if (n == 0) {
+    return;
+  }
+  const int64_t vec_end = n - n % Vec::size();
+  const scalar_t* x = in;
+  if (m) {
+    int64_t k = 0;
+    for (; k < vec_end; k += Vec::size()) {
+      (Vec::loadu(in + k) + Vec::loadu(m + k)).store(out + k);
+    }
+    for (; k < n; k++) {
+      out[k] = in[k] + m[k];
+    }
+    x = out;
+  }
+  scalar_t lanes[Vec::size()];
+  Vec max_vec(-std::numeric_limits<scalar_t>::infinity());
+  int64_t k = 0;
+  for (; k < vec_end; k += Vec::size()) {
+    max_vec = vec256::maximum(max_vec, Vec::loadu(x + k));
+  }
+  max_vec.store(lanes);
+  acc_t max = -std::numeric_limits<acc_t>::infinity();
+  for (int64_t l = 0; l < Vec::size(); l++) {
+    max = lanes[l] > max || std::isnan(lanes[l]) ? lanes[l] : max;
+  }
+  for (; k < n; k++) {
+    max = x[k] > max ? x[k] : max;
+  }
+  const Vec max_shift(static_cast<scalar_t>(max));
+  acc_t sum = 0;
+  k = 0;
+  while (k < vec_end) {
+    const int64_t chunk_end = std::min(k + segment_softmax_chunk, vec_end);
+    Vec partial(0);
+    for (; k < chunk_end; k += Vec::size()) {
+      Vec shifted = Vec::loadu(x + k) - max_shift;
+      Vec y = shifted.exp();
+      partial = partial + y;
+      (log ? shifted : y).store(out + k);
+    }
+    partial.store(lanes);
+    for (int64_t l = 0; l < Vec::size(); l++) {
+      sum += lanes[l];
+    }
+  }
+  for (; k < n; k++) {
+    acc_t shifted = x[k] - max;
+    acc_t y = std::exp(shifted);
+    sum += y;
+    out[k] = log ? shifted : y;
+  }
+  const scalar_t norm = log ? std::log(sum) : 1 / sum;
+  const Vec norm_vec(norm);
+  for (k = 0; k < vec_end; k += Vec::size()) {
+    Vec y = Vec::loadu(out + k);
+    (log ? y - norm_vec : y * norm_vec).store(out + k);
+  }
+  for (; k < n; k++) {
+    out[k] = log ? out[k] - norm : out[k] * norm;
+  }
+}
+
+} // namespace
+
+// Writes softmax(input + mask), or its logarithm, into output.
+template <typename scalar_t>
+void segment_softmax_kernel(
+    const SegmentedReduction& r,
+    const scalar_t* input,
+    const scalar_t* mask,
+    scalar_t* output,
+    bool log) {
+  using acc_t = at::acc_type<scalar_t, false>;
+  parallel_for_segment_rows(r, [&](int64_t i, int64_t begin, int64_t end) {
+    const int64_t reduce = r.reduce[i];
+    const int64_t inner = r.inner[i];
+    if (inner == 1) {
+      for (int64_t o = begin; o < end; o++) {
+        const int64_t offset = r.input_offsets[i] + o * reduce;
+        softmax_row(
+            input + offset,
+            mask ? mask + offset : nullptr,
+            output + offset,
+            reduce,
+            log);
+      }
+      return;
+    }
+    std::vector<acc_t> max(inner);
+    std::vector<acc_t> sum(inner);
+    for (int64_t o = begin; o < end; o++) {
+      const int64_t offset = r.input_offsets[i] + o * reduce * inner;
+      const scalar_t* in = input + offset;
+      const scalar_t* m = mask ? mask + offset : nullptr;
+      scalar_t* out = output + offset;
+      std::fill(
+          max.begin(), max.end(), -std::numeric_limits<acc_t>::infinity());
+      std::fill(sum.begin(), sum.end(), 0);
+      for (int64_t k = 0; k < reduce * inner; k += inner) {
+        for (int64_t j = 0; j < inner; j++) {
+          acc_t x = m ? in[k + j] + m[k + j] : in[k + j];
+          max[j] = x > max[j] ? x : max[j];
+        }
+      }
+      for (int64_t k = 0; k < reduce * inner; k += inner) {
+        for (int64_t j = 0; j < inner; j++) {
+          acc_t x = m ? in[k + j] + m[k + j] : in[k + j];
+          acc_t y = std::exp(x - max[j]);
+          sum[j] += y;
+          out[k + j] = log ? x - max[j] : y;
+        }
+      }
+      for (int64_t j = 0; j < inner; j++) {
+        sum[j] = log ? std::log(sum[j]) : 1 / sum[j];
+      }
+      for (int64_t k = 0; k < reduce * inner; k += inner) {
+        for (int64_t j = 0; j < inner; j++) {
+          out[k + j] = log ? out[k + j] - sum[j] : out[k + j] * sum[j];
+        }
+      }
+    }
+  });
+}
+
+// Computes the gradient of the input of segment_softmax_kernel from its
+// output and the gradient of its output.
+template <typename scalar_t>
+void segment_softmax_backward_kernel(
+    const SegmentedReduction& r,
+    const scalar_t* grad,
+    const scalar_t* output,
+    scalar_t* grad_input,
+    bool log) {
+  using acc_t = at::acc_type<scalar_t, false>;
+  parallel_for_segment_rows(r, [&](int64_t i, int64_t begin, int64_t end) {
+    const int64_t reduce = r.reduce[i];
+    const int64_t inner = r.inner[i];
+    std::vector<acc_t> sum(inner);
+    for (int64_t o = begin; o < end; o++) {
+      const int64_t offset = r.input_offsets[i] + o * reduce * inner;
+      const scalar_t* g = grad + offset;
+      const scalar_t* out = output + offset;
+      scalar_t* g_in = grad_input + offset;
+      std::fill(sum.begin(), sum.end(), 0);
+      for (int64_t k = 0; k < reduce * inner; k += inner) {
+        for (int64_t j = 0; j < inner; j++) {
+          sum[j] += log ? g[k + j] : g[k + j] * out[k + j];
+        }
+      }
+      for (int64_t k = 0; k < reduce * inner; k += inner) {
+        for (int64_t j = 0; j < inner; j++) {
+          g_in[k + j] = log ? g[k + j] - std::exp(out[k + j]) * sum[j]
+                            : out[k + j] * (g[k + j] - sum[j]);
+        }
+      }
+    }
+  });
+}
+
+} // namespace impl
+
+// Softmax or log_softmax along the tensor dimension dim of a packed
+// NestedTensor with an optional additive mask of the same nested size. The
+// backward runs on the packed output and gradient as well.
+struct NestedTensorFunction_segment_softmax
+    : public torch::autograd::Function<NestedTensorFunction_segment_softmax> {
+  static Tensor forward(
+      torch::autograd::AutogradContext* ctx,
+      const Tensor& input,
+      const Tensor& mask,
+      int64_t dim,
+      bool log) {
+    trace_packed(log ? "log_softmax" : "softmax");
+    auto r = impl::segmented_reduction(input, {dim}, true);
+    TORCH_CHECK(r, "segment softmax requires a packed NestedTensor.");
+    Tensor buffer = get_buffer(input);
+    Tensor mask_buffer = mask.defined() ? get_buffer(mask) : mask;
+    Tensor output = at::empty_like(buffer);
+    AT_DISPATCH_FLOATING_TYPES(buffer.scalar_type(), "segment_softmax", [&] {
+      impl::segment_softmax_kernel<scalar_t>(
+          *r,
+          buffer.data_ptr<scalar_t>(),
+          mask.defined() ? mask_buffer.data_ptr<scalar_t>() : nullptr,
+          output.data_ptr<scalar_t>(),
+          log);
+    });
+    Tensor result =
+        wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+            std::move(output),
+            get_nested_tensor_impl(input)->flat_nested_size()));
+    ctx->save_for_backward({result});
+    ctx->saved_data["0"] = dim;
+    ctx->saved_data["1"] = log;
+    ctx->saved_data["2"] = mask.defined() && mask.requires_grad();
+    return result;
+  }
+  static torch::autograd::variable_list backward(
+      torch::autograd::AutogradContext* ctx,
+      torch::autograd::variable_list grad_output) {
+    TORCH_CHECK(grad_output.size() == 1, "Expected grad_output of size 1.");
+    TORCH_CHECK(
+        !grad_output[0].requires_grad(),
+        "NestedTensor softmax doesn't support double backward.");
+    // The backward may run on a thread with a different packed mode.
+    PackedModeGuard guard(PackedMode::Auto);
+    Tensor output = ctx->get_saved_variables()[0];
+    int64_t dim = ctx->saved_data["0"].toInt();
+    bool log = ctx->saved_data["1"].toBool();
+    bool mask_requires_grad = ctx->saved_data["2"].toBool();
+    auto r = impl::segmented_reduction(output, {dim}, true);
+    TORCH_CHECK(r, "NestedTensor softmax output changed before backward.");
+    Tensor grad = get_buffer(pack_nested_tensor(grad_output[0]));
+    Tensor output_buffer = get_buffer(output);
+    Tensor grad_input = at::empty_like(output_buffer);
+    AT_DISPATCH_FLOATING_TYPES(
+        output_buffer.scalar_type(), "segment_softmax_backward", [&] {
+          impl::segment_softmax_backward_kernel<scalar_t>(
+              *r,
+              grad.data_ptr<scalar_t>(),
+              output_buffer.data_ptr<scalar_t>(),
+              grad_input.data_ptr<scalar_t>(),
+              log);
+        });
+    Tensor result =
+        wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+            std::move(grad_input),
+            get_nested_tensor_impl(output)->flat_nested_size()));
+    Tensor undef;
+    // The mask gradient gets its own copy so that accumulating into one of
+    // the two doesn't alias the other.
+    return {
+        result, mask_requires_grad ? result.clone() : undef, undef, undef};
+  }
+};
+
+// Returns the tensor dimension dim refers to if the segmented kernels apply
+// to input and mask.
+c10::optional<int64_t> _segment_softmax_dim(
+    const Tensor& input,
+    const Tensor& mask,
+    int64_t dim,
+    c10::optional<ScalarType> dtype) {
+  auto nt_impl = get_nested_tensor_impl(input);
+  int64_t nested_dim = nt_impl->nested_dim();
+  dim = maybe_wrap_dim(dim, input.dim());
+  TORCH_CHECK(
+      dim >= nested_dim,
+      "Cannot apply softmax across nested dimensions ",
+      std::to_string(dim));
+  if (!impl::use_segmented_reduction(input, dtype) ||
+      (mask.defined() &&
+       (mask.scalar_type() != input.scalar_type() ||
+        !can_apply_to_buffers(input, mask))) ||
+      !impl::segmented_reduction(input, {dim - nested_dim}, true)) {
+    return c10::nullopt;
+  }
+  return dim - nested_dim;
+}
+
+Tensor NestedTensor_softmax(
+    const Tensor& input_,
+    const int64_t dim,
+    c10::optional<ScalarType> dtype) {
+  Tensor input = get_packed_mode() == PackedMode::Always
+      ? pack_nested_tensor(input_)
+      : input_;
+  Tensor undef;
+  auto tensor_dim = _segment_softmax_dim(input, undef, dim, dtype);
+  if (tensor_dim) {
+    return NestedTensorFunction_segment_softmax::apply(
+        input, undef, *tensor_dim, false);
+  }
+  int64_t nested_dim = get_nested_tensor_impl(input)->nested_dim();
+  int64_t wrapped_dim = maybe_wrap_dim(dim, input.dim());
+  return autograd_map_nested_tensor(
+      [wrapped_dim, nested_dim, dtype](const at::Tensor t) {
+        return at::softmax(t, wrapped_dim - nested_dim, dtype);
+      },
+      input);
+}
+
+Tensor NestedTensor__log_softmax(
+    const Tensor& self_,
+    const int64_t dim,
+    const bool half_to_float) {
+  Tensor self = get_packed_mode() == PackedMode::Always
+      ? pack_nested_tensor(self_)
+      : self_;
+  Tensor undef;
+  auto tensor_dim = _segment_softmax_dim(self, undef, dim, c10::nullopt);
+  if (tensor_dim && !half_to_float) {
+    return NestedTensorFunction_segment_softmax::apply(
+        self, undef, *tensor_dim, true);
+  }
+  int64_t nested_dim = get_nested_tensor_impl(self)->nested_dim();
+  int64_t wrapped_dim = maybe_wrap_dim(dim, self.dim());
+  return autograd_map_nested_tensor(
+      [wrapped_dim, nested_dim, half_to_float](Tensor a) {
+        return at::_log_softmax(a, wrapped_dim - nested_dim, half_to_float);
+      },
+      self);
+}
+
+// softmax(input + mask) along dim, where mask is a NestedTensor of the same
+// nested size as input. If both are packed the sum is never materialized.
+Tensor NestedTensor_masked_softmax(Tensor input, Tensor mask, int64_t dim) {
+  TORCH_CHECK(
+      is_nested_tensor_impl(input, mask),
+      "masked_softmax expects NestedTensor input and mask.");
+  if (get_packed_mode() == PackedMode::Always) {
+    input = pack_nested_tensor(input);
+    mask = pack_nested_tensor(mask);
+  }
+  auto tensor_dim = _segment_softmax_dim(input, mask, dim, c10::nullopt);
+  if (tensor_dim) {
+    return NestedTensorFunction_segment_softmax::apply(
+        input, mask, *tensor_dim, false);
+  }
+  return at::softmax(at::add(input, mask), dim);
+}
+
+static auto registry = torch::RegisterOperators().op(
+    "nestedtensor::masked_softmax",
+    &NestedTensor_masked_softmax);
+
+TORCH_LIBRARY_IMPL(aten, AutogradPrivateUse1, m) {
+  nt_impl(m, "_log_softmax", NestedTensor__log_softmax);
+  nt_impl(m, "softmax.int", NestedTensor_softmax);
+}
+
+} // namespace at
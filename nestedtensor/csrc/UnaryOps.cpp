@@ -6,30 +6,55 @@ namespace at {
 
 using namespace torch::nested_tensor;
 
+// Applies the inplace function fn to the buffer of self if possible and to
+// each constituent otherwise.
+template <class F>
+void _apply_unary_(F&& fn, Tensor& self) {
+  if (can_apply_to_buffers(self)) {
+    at::Tensor buffer = get_buffer(self);
+    fn(buffer);
+    return;
+  }
+  apply_nested_tensor(std::move(fn), self);
+}
+
+// Same as _apply_unary_ for out variants.
+template <class F>
+void _apply_unary_out(F&& fn, Tensor& result, const Tensor& self) {
+  if (is_nested_tensor_impl(result, self) &&
+      can_apply_to_buffers(result, self)) {
+    at::Tensor result_buffer = get_buffer(result);
+    at::Tensor self_buffer = get_buffer(self);
+    fn(result_buffer, self_buffer);
+    return;
+  }
+  apply_nested_tensor(std::move(fn), result, self);
+}
+
 // NOTE: Can't reuse dispatch from cos_ to cos_out either, because it requries
 // support for at::empty through unary_op_impl
 template <class F, F func>
 Tensor& NestedTensor_unary_(Tensor& self) {
-  apply_nested_tensor([](at::Tensor& tensor) { func(tensor); }, self);
+  _apply_unary_([](at::Tensor& tensor) { func(tensor); }, self);
   return self;
 }
 
 // NOTE: Missing at::sign_ etc. -> very annoying. not clear why.
 template <class F, F func>
 Tensor& NestedTensor_unary_method_(Tensor& self) {
-  apply_nested_tensor([](at::Tensor& tensor) { (tensor.*func)(); }, self);
+  _apply_unary_([](at::Tensor& tensor) { (tensor.*func)(); }, self);
   return self;
 }
 
 template <class F, F func>
 Tensor NestedTensor_unary(const Tensor& self) {
-  return autograd_map_nested_tensor(
+  return autograd_map_elementwise_nested_tensor(
       [](at::Tensor tensor) { return func(tensor); }, self);
 }
 
 template <class F, F func>
 Tensor& NestedTensor_unary_out(Tensor& result, const Tensor& self) {
-  apply_nested_tensor(
+  _apply_unary_out(
       [](at::Tensor& result, at::Tensor& tensor) { func(result, tensor); },
       result,
       self);
@@ -40,7 +65,7 @@ Tensor& NestedTensor_clamp_(
     Tensor& self,
     optional<Scalar> min,
     optional<Scalar> max) {
-  apply_nested_tensor(
+  _apply_unary_(
       [min, max](at::Tensor& tensor) { at::clamp_(tensor, min, max); }, self);
   return self;
 }
@@ -49,7 +74,7 @@ Tensor NestedTensor_clamp(
     const Tensor& self,
     optional<Scalar> min,
     optional<Scalar> max) {
-  return autograd_map_nested_tensor(
+  return autograd_map_elementwise_nested_tensor(
       [min, max](at::Tensor tensor) { return at::clamp(tensor, min, max); },
       self);
 }
@@ -59,7 +84,7 @@ Tensor& NestedTensor_clamp_out(
     const Tensor& self,
     optional<Scalar> min,
     optional<Scalar> max) {
-  apply_nested_tensor(
+  _apply_unary_out(
       [min, max](at::Tensor result, const at::Tensor tensor) {
         at::clamp_out(result, tensor, min, max);
       },
@@ -69,13 +94,13 @@ Tensor& NestedTensor_clamp_out(
 }
 
 Tensor& NestedTensor_clamp_min_(Tensor& self, Scalar min) {
-  apply_nested_tensor(
+  _apply_unary_(
       [min](at::Tensor& tensor) { at::clamp_min_(tensor, min); }, self);
   return self;
 }
 
 Tensor NestedTensor_clamp_min(const Tensor& self, Scalar min) {
-  return autograd_map_nested_tensor(
+  return autograd_map_elementwise_nested_tensor(
       [min](at::Tensor tensor) { return at::clamp_min(tensor, min); }, self);
 }
 
@@ -83,7 +108,7 @@ Tensor& NestedTensor_clamp_min_out(
     Tensor& result,
     const Tensor& self,
     Scalar min) {
-  apply_nested_tensor(
+  _apply_unary_out(
       [min](at::Tensor result, const at::Tensor tensor) {
         at::clamp_min_out(result, tensor, min);
       },
@@ -93,13 +118,13 @@ Tensor& NestedTensor_clamp_min_out(
 }
 
 Tensor& NestedTensor_clamp_max_(Tensor& self, Scalar min) {
-  apply_nested_tensor(
+  _apply_unary_(
       [min](at::Tensor tensor) { at::clamp_max_(tensor, min); }, self);
   return self;
 }
 
 Tensor NestedTensor_clamp_max(const Tensor& self, Scalar min) {
-  return autograd_map_nested_tensor(
+  return autograd_map_elementwise_nested_tensor(
       [min](at::Tensor tensor) { return at::clamp_max(tensor, min); }, self);
 }
 
@@ -107,7 +132,7 @@ Tensor& NestedTensor_clamp_max_out(
     Tensor& result,
     const Tensor& self,
     Scalar min) {
-  apply_nested_tensor(
+  _apply_unary_out(
       [min](at::Tensor result, const at::Tensor tensor) {
         at::clamp_max_out(result, tensor, min);
       },
@@ -117,12 +142,12 @@ Tensor& NestedTensor_clamp_max_out(
 }
 
 Tensor& NestedTensor_mvlgamma_(Tensor& self, int64_t p) {
-  apply_nested_tensor([p](at::Tensor tensor) { tensor.mvlgamma_(p); }, self);
+  _apply_unary_([p](at::Tensor tensor) { tensor.mvlgamma_(p); }, self);
   return self;
 }
 
 Tensor NestedTensor_mvlgamma(const Tensor& self, int64_t p) {
-  return autograd_map_nested_tensor(
+  return autograd_map_elementwise_nested_tensor(
       [p](at::Tensor tensor) { return at::mvlgamma(tensor, p); }, self);
 }
 
@@ -9,20 +9,17 @@ namespace F = torch::nn::functional;
 namespace at {
 
 Tensor NestedTensor_gelu(const Tensor& self) {
-  return autograd_map_nested_tensor(
+  return autograd_map_elementwise_nested_tensor(
       [](at::Tensor tensor) { return at::gelu(tensor); }, self);
 }
 
 // Registered below autograd
 Tensor NestedTensor_relu(const Tensor& self) {
-  auto impl = get_nested_tensor_impl(self);
-  auto structure = get_nested_tensor_structure(self);
-  if (structure.buffer()) {
-#ifdef TRACEPACKED
-    std::cout << "calling packed relu" << std::endl;
-#endif
+  if (can_apply_to_buffers(self)) {
+    trace_packed("relu");
     return wrap_tensor_node(torch::nested_tensor::impl::build_structure(
-        at::relu(*structure.buffer()), impl->nested_size()));
+        at::relu(get_buffer(self)),
+        get_nested_tensor_impl(self)->flat_nested_size()));
   }
   return map_nested_tensor(
       [](at::Tensor tensor) { return at::relu(tensor); }, self);
@@ -30,6 +27,11 @@ Tensor NestedTensor_relu(const Tensor& self) {
 
 // Registered below autograd
 Tensor& NestedTensor_relu_(Tensor& self) {
+  if (can_apply_to_buffers(self)) {
+    at::Tensor buffer = get_buffer(self);
+    at::relu_(buffer);
+    return self;
+  }
   apply_nested_tensor([](at::Tensor& tensor) { at::relu_(tensor); }, self);
   return self;
 }
@@ -39,6 +41,11 @@ Tensor NestedTensor_threshold_backward(
     const Tensor& grad,
     const Tensor& self,
     Scalar threshold) {
+  if (is_nested_tensor_impl(grad, self) && can_apply_to_buffers(grad, self)) {
+    return wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+        threshold_backward(get_buffer(grad), get_buffer(self), threshold),
+        get_nested_tensor_impl(self)->flat_nested_size()));
+  }
   return map_nested_tensor(
       [&](at::Tensor g, at::Tensor s) {
         return threshold_backward(g, s, threshold);
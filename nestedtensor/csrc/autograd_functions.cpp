@@ -1,3 +1,4 @@
+#include <nestedtensor/csrc/bucketing.h>
 #include <nestedtensor/csrc/nested_tensor_impl.h>
 #include <nestedtensor/csrc/utils/nested_node_functions.h>
 #include <torch/extension.h>
@@ -19,15 +20,10 @@ Tensor NestedTensor_upsample_bilinear2d(
     bool align_corners,
     c10::optional<double> scales_h,
     c10::optional<double> scales_w) {
-  return autograd_map_nested_tensor(
+  return autograd_map_size_buckets(
       [&](at::Tensor t) {
         return at::upsample_bilinear2d(
-                   t.unsqueeze(0),
-                   output_size,
-                   align_corners,
-                   scales_h,
-                   scales_w)
-            .squeeze(0);
+            t, output_size, align_corners, scales_h, scales_w);
       },
       input);
 }
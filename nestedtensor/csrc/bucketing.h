@@ -0,0 +1,304 @@
+#pragma once
+#include <nestedtensor/csrc/nested_tensor_impl.h>
+#include <map>
+
+namespace at {
+
+// NOTE: Size buckets
+//
+// Many NestedTensors only contain a handful of distinct constituent sizes.
+// Ops that are defined on batches, such as conv2d or pooling, can then be
+// called once per bucket of same-size constituents on a dense batch instead
+// of once per constituent on a batch of one. The constituents of a bucket are
+// viewed as a batch without copies if they are adjacent in a contiguous
+// buffer and stacked otherwise. The results are written into the buffer of a
+// new packed NestedTensor.
+
+// Groups the indices of the constituents of nt by size. Buckets are ordered
+// by their first constituent.
+inline std::vector<std::vector<int64_t>> bucket_by_size(const Tensor& nt) {
+  const FlatSizeNode& nested_size =
+      get_nested_tensor_impl(nt)->flat_nested_size();
+  std::map<std::vector<int64_t>, size_t> bucket_index;
+  std::vector<std::vector<int64_t>> buckets;
+  for (int64_t i = 0; i < nested_size.num_leaves(); i++) {
+    std::vector<int64_t> size = nested_size.leaf(i).vec();
+    auto it = bucket_index.find(size);
+    if (it == bucket_index.end()) {
+      bucket_index[size] = buckets.size();
+      buckets.push_back({i});
+    } else {
+      buckets[it->second].push_back(i);
+    }
+  }
+  return buckets;
+}
+
+// Size buckets only pay off if at least two constituents share a size.
+inline bool use_size_buckets(
+    const Tensor& nt,
+    const std::vector<std::vector<int64_t>>& buckets) {
+  return get_packed_mode() != PackedMode::Never &&
+      (int64_t)buckets.size() <
+      get_nested_tensor_impl(nt)->flat_nested_size().num_leaves();
+}
+
+namespace detail {
+
+inline bool is_adjacent(const std::vector<int64_t>& bucket) {
+  for (size_t j = 1; j < bucket.size(); j++) {
+    if (bucket[j] != bucket[j - 1] + 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns the given constituents as a single batch. This is a view if they
+// are adjacent and tensors are the constituents of a contiguous buffer.
+inline Tensor gather_bucket(
+    const std::vector<Tensor>& tensors,
+    const std::vector<int64_t>& bucket,
+    bool contiguous) {
+  if (contiguous && is_adjacent(bucket)) {
+    const Tensor& first = tensors[bucket[0]];
+    std::vector<int64_t> sizes{(int64_t)bucket.size()};
+    std::vector<int64_t> strides{first.numel()};
+    for (int64_t i = 0; i < first.dim(); i++) {
+      sizes.push_back(first.size(i));
+      strides.push_back(first.stride(i));
+    }
+    return first.as_strided(sizes, strides);
+  }
+  std::vector<Tensor> bucket_tensors;
+  for (int64_t index : bucket) {
+    bucket_tensors.push_back(tensors[index]);
+  }
+  return at::stack(bucket_tensors);
+}
+
+// Returns the batches of each bucket as the constituents of a new packed
+// NestedTensor with the given structure.
+inline Tensor scatter_buckets(
+    const std::vector<std::vector<int64_t>>& buckets,
+    const std::vector<Tensor>& batches,
+    const NestedStructurePtr& structure) {
+  int64_t num_leaves = structure->num_leaves();
+  std::vector<c10::IntArrayRef> sizes(num_leaves);
+  for (size_t b = 0; b < buckets.size(); b++) {
+    for (int64_t index : buckets[b]) {
+      sizes[index] = batches[b].sizes().slice(1);
+    }
+  }
+  std::vector<int64_t> leaf_offsets{0};
+  std::vector<int64_t> values;
+  std::vector<int64_t> offsets{0};
+  for (int64_t i = 0; i < num_leaves; i++) {
+    values.insert(values.end(), sizes[i].begin(), sizes[i].end());
+    leaf_offsets.push_back(values.size());
+    int64_t numel = 1;
+    for (int64_t size : sizes[i]) {
+      numel *= size;
+    }
+    offsets.push_back(offsets.back() + numel);
+  }
+  Tensor buffer = at::empty({offsets.back()}, batches[0].options());
+  for (size_t b = 0; b < buckets.size(); b++) {
+    const std::vector<int64_t>& bucket = buckets[b];
+    if (is_adjacent(bucket)) {
+      buffer
+          .narrow(0, offsets[bucket[0]], offsets[bucket.back() + 1] -
+                      offsets[bucket[0]])
+          .view(batches[b].sizes())
+          .copy_(batches[b]);
+      continue;
+    }
+    for (size_t j = 0; j < bucket.size(); j++) {
+      buffer
+          .narrow(0, offsets[bucket[j]], offsets[bucket[j] + 1] -
+                      offsets[bucket[j]])
+          .view(sizes[bucket[j]])
+          .copy_(batches[b][j]);
+    }
+  }
+  return wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+      std::move(buffer),
+      FlatSizeNode(structure, std::move(leaf_offsets), std::move(values))));
+}
+
+} // namespace detail
+
+// Applies fn to a batch of the constituents of input for each size bucket.
+// The regular Tensors a are passed along as they are. Doesn't record anything
+// for autograd.
+template <class F, class... A>
+inline Tensor map_size_buckets(
+    F&& fn,
+    const std::vector<std::vector<int64_t>>& buckets,
+    const Tensor& input,
+    A... a) {
+  std::vector<Tensor> tensors = flatten(get_nested_tensor_structure(input));
+  bool contiguous = is_packed(input) && input.is_contiguous();
+  std::vector<Tensor> batches;
+  for (const auto& bucket : buckets) {
+    batches.push_back(
+        fn(detail::gather_bucket(tensors, bucket, contiguous), a...));
+  }
+  return detail::scatter_buckets(
+      buckets,
+      batches,
+      get_nested_tensor_impl(input)->flat_nested_size().structure());
+}
+
+// Size bucket counterpart of NestedTensorFunction_mapper. The forward records
+// fn for each bucket, the backward gathers the incoming gradient in the same
+// buckets and differentiates all buckets in a single call to autograd.
+template <class F, class... Args>
+struct NestedTensorFunction_bucket_mapper
+    : public torch::autograd::Function<
+          NestedTensorFunction_bucket_mapper<F, Args...>> {
+  static Tensor forward(
+      torch::autograd::AutogradContext* ctx,
+      F&& fn,
+      const Tensor& input,
+      Args... a) {
+    std::vector<std::vector<int64_t>> buckets = bucket_by_size(input);
+    std::vector<Tensor> tensors = flatten(get_nested_tensor_structure(input));
+    bool contiguous = is_packed(input) && input.is_contiguous();
+    bool input_requires_grad = input.requires_grad();
+    std::vector<Tensor> dense{a...};
+    std::vector<Tensor> autograd_inputs;
+    std::vector<bool> requires_grad_vector;
+    for (auto& t : dense) {
+      bool requires_grad = t.defined() && t.requires_grad() &&
+          torch::autograd::isDifferentiableType(t.scalar_type());
+      if (requires_grad) {
+        AutoGradMode autogradmode(true);
+        t = t.alias();
+        t.requires_grad_();
+        autograd_inputs.push_back(t);
+      }
+      requires_grad_vector.push_back(requires_grad);
+    }
+    std::vector<Tensor> batch_inputs;
+    std::vector<Tensor> batch_outputs;
+    std::vector<Tensor> outputs;
+    for (const auto& bucket : buckets) {
+      Tensor batch =
+          detail::gather_bucket(tensors, bucket, contiguous).detach();
+      AutoGradMode autogradmode(true);
+      if (input_requires_grad) {
+        batch.requires_grad_();
+        batch_inputs.push_back(batch);
+      }
+      std::vector<Tensor> fn_inputs{batch};
+      fn_inputs.insert(fn_inputs.end(), dense.begin(), dense.end());
+      Tensor output = detail::apply_to_vector(
+          fn, fn_inputs, std::index_sequence_for<Tensor, Args...>());
+      outputs.push_back(output.detach());
+      batch_outputs.push_back(output);
+    }
+    std::vector<int64_t> bucket_sizes;
+    std::vector<int64_t> bucket_indices;
+    for (const auto& bucket : buckets) {
+      bucket_sizes.push_back(bucket.size());
+      bucket_indices.insert(bucket_indices.end(), bucket.begin(), bucket.end());
+    }
+    std::vector<Tensor> saved = batch_inputs;
+    saved.insert(saved.end(), autograd_inputs.begin(), autograd_inputs.end());
+    saved.insert(saved.end(), batch_outputs.begin(), batch_outputs.end());
+    ctx->save_for_backward(saved);
+    ctx->saved_data["0"] = bucket_sizes;
+    ctx->saved_data["1"] = bucket_indices;
+    ctx->saved_data["2"] = input_requires_grad;
+    ctx->saved_data["3"] = requires_grad_vector;
+    return detail::scatter_buckets(
+        buckets,
+        outputs,
+        get_nested_tensor_impl(input)->flat_nested_size().structure());
+  }
+  static torch::autograd::variable_list backward(
+      torch::autograd::AutogradContext* ctx,
+      torch::autograd::variable_list grad_output_) {
+    TORCH_CHECK(
+        grad_output_.size() == 1,
+        "Only one incoming gradient supported for now.");
+    at::Tensor grad = grad_output_[0];
+    TORCH_CHECK(
+        !grad.requires_grad(),
+        "bucket mapper doesn't support double backward.");
+    std::vector<int64_t> bucket_sizes = ctx->saved_data["0"].toIntVector();
+    std::vector<int64_t> bucket_indices = ctx->saved_data["1"].toIntVector();
+    bool input_requires_grad = ctx->saved_data["2"].toBool();
+    std::vector<bool> requires_grad_vector =
+        ctx->saved_data["3"].toBoolList().vec();
+    std::vector<std::vector<int64_t>> buckets;
+    auto bucket_begin = bucket_indices.begin();
+    for (int64_t bucket_size : bucket_sizes) {
+      buckets.emplace_back(bucket_begin, bucket_begin + bucket_size);
+      bucket_begin += bucket_size;
+    }
+    std::vector<Tensor> saved = ctx->get_saved_variables();
+    std::vector<Tensor> batch_outputs(
+        saved.end() - buckets.size(), saved.end());
+    std::vector<Tensor> inputs(saved.begin(), saved.end() - buckets.size());
+
+    std::vector<Tensor> grad_tensors =
+        flatten(get_nested_tensor_structure(grad));
+    bool contiguous = is_packed(grad) && grad.is_contiguous();
+    std::vector<Tensor> grad_batches;
+    for (const auto& bucket : buckets) {
+      grad_batches.push_back(
+          detail::gather_bucket(grad_tensors, bucket, contiguous));
+    }
+    std::vector<Tensor> grads = torch::autograd::grad(
+        batch_outputs, inputs, grad_batches, c10::nullopt, false, true);
+
+    // NOTE: First entry needs to return undef for function value input.
+    at::Tensor undef;
+    std::vector<Tensor> grad_input(sizeof...(Args) + 2, undef);
+    size_t index = 0;
+    if (input_requires_grad) {
+      std::vector<Tensor> input_grads;
+      for (size_t b = 0; b < buckets.size(); b++) {
+        input_grads.push_back(
+            grads[b].defined() ? grads[b] : at::zeros_like(inputs[b]));
+      }
+      grad_input[1] = detail::scatter_buckets(
+          buckets,
+          input_grads,
+          get_nested_tensor_impl(grad)->flat_nested_size().structure());
+      index = buckets.size();
+    }
+    for (size_t i = 0; i < sizeof...(Args); i++) {
+      if (requires_grad_vector[i]) {
+        grad_input[i + 2] = grads[index];
+        index++;
+      }
+    }
+    return grad_input;
+  }
+};
+
+// Applies fn, a function of a batch of constituents of input and the regular
+// Tensors a, once per size bucket if at least two constituents share a size.
+// Otherwise fn is applied to each constituent as a batch of one.
+template <class F, class... A>
+inline Tensor autograd_map_size_buckets(F&& fn, const Tensor& input, A... a) {
+  std::vector<std::vector<int64_t>> buckets = bucket_by_size(input);
+  if (!use_size_buckets(input, buckets)) {
+    return autograd_map_nested_tensor_parallel(
+        [&fn](Tensor t, A... b) { return fn(t.unsqueeze(0), b...).squeeze(0); },
+        input,
+        a...);
+  }
+  trace_packed("size buckets");
+  if (!requires_autograd(input, a...)) {
+    at::NoGradGuard no_grad;
+    return map_size_buckets(std::move(fn), buckets, input, a...);
+  }
+  return NestedTensorFunction_bucket_mapper<F, A...>::apply(
+      std::move(fn), input, a...);
+}
+
+} // namespace at
@@ -1,3 +1,4 @@
+#include <nestedtensor/csrc/bucketing.h>
 #include <nestedtensor/csrc/nested_tensor_impl.h>
 #include <nestedtensor/csrc/utils/nested_node_functions.h>
 #include <torch/extension.h>
@@ -9,138 +10,199 @@ namespace F = torch::nn::functional;
 namespace at {
 
 namespace impl {
-// Transliteration of
-// https://github.com/pytorch/pytorch/blob/1f0cfbaaad09921f588adf549751041b8cb2e283/torch/nn/grad.py#L8
-// into C++
-std::vector<int64_t> _grad_input_padding(
-    at::Tensor grad_output,
-    IntArrayRef input_size_,
+// NOTE: Packed conv2d
+//
+// Each constituent i of the input is lowered by im2col into L_i columns of
+// C_in * kh * kw entries, where L_i is the number of output pixels of
+// constituent i. The columns of all constituents are placed next to each
+// other in a single column buffer, which is multiplied by the weight in one
+// GEMM for all constituents without padding. The columns of constituent i of
+// the product are then its output. To bound memory, the columns are built for
+// chunks of constituents at a time, each with their own GEMM.
+//
+// The backward recomputes the columns of each chunk to accumulate the weight
+// gradient and multiplies the transposed weight by the output gradient of the
+// chunk. col2im sums the resulting columns back into the input gradient.
+struct PackedConv2dLayout {
+  std::vector<int64_t> col_offsets;
+  FlatSizeNode output_nested_size;
+};
+
+PackedConv2dLayout _packed_conv2d_layout(
+    const Tensor& input,
+    int64_t out_channels,
+    IntArrayRef kernel_size,
     IntArrayRef stride,
     IntArrayRef padding,
-    IntArrayRef kernel_size,
     IntArrayRef dilation) {
-  size_t k = grad_output.dim() - 2;
-  std::vector<int64_t> input_size;
-  if (input_size_.size() == k + 2) {
-    for (size_t i = 2; i < k + 2; i++) {
-      input_size.push_back(input_size_[i]);
-    }
-  } else {
-    input_size = input_size_.vec();
+  const FlatSizeNode& nested_size =
+      get_nested_tensor_impl(input)->flat_nested_size();
+  std::vector<int64_t> col_offsets{0};
+  std::vector<int64_t> leaf_offsets{0};
+  std::vector<int64_t> values;
+  for (int64_t i = 0; i < nested_size.num_leaves(); i++) {
+    c10::IntArrayRef size = nested_size.leaf(i);
+    int64_t height = (size[1] + 2 * padding[0] -
+                      dilation[0] * (kernel_size[0] - 1) - 1) /
+            stride[0] +
+        1;
+    int64_t width = (size[2] + 2 * padding[1] -
+                     dilation[1] * (kernel_size[1] - 1) - 1) /
+            stride[1] +
+        1;
+    TORCH_CHECK(
+        height > 0 && width > 0,
+        "conv2d input constituent ",
+        i,
+        " is smaller than the kernel.");
+    col_offsets.push_back(col_offsets.back() + height * width);
+    values.push_back(out_channels);
+    values.push_back(height);
+    values.push_back(width);
+    leaf_offsets.push_back(values.size());
   }
-  TORCH_CHECK(
-      input_size.size() == k,
-      "input_size must have ",
-      k + 2,
-      " elements (got ",
-      input_size_.size(),
-      ")");
+  return PackedConv2dLayout{
+      std::move(col_offsets),
+      FlatSizeNode(
+          nested_size.structure(),
+          std::move(leaf_offsets),
+          std::move(values))};
+}
 
-  std::vector<int64_t> result_size;
-  for (size_t d = 0; d < k; d++) {
-    int64_t min_size = ((grad_output.size(d + 2) - 1) * stride[d]) -
-        (2 * padding[d]) + 1 + (dilation[d] * (kernel_size[d] - 1));
-    int64_t max_size = min_size + stride[d] - 1;
-    TORCH_CHECK(
-        !(input_size[d] < min_size || input_size[d] > max_size),
-        "input grad size outside of valid range. input_size[",
-        d,
-        "]: ",
-        input_size[d],
-        " min_size: ",
-        min_size,
-        " max_size: ",
-        max_size);
-    result_size.push_back(input_size[d] - min_size);
+// Upper bound on the number of entries of the column buffer of a chunk of
+// constituents. This bounds the memory of the columns similar to a dense
+// batched convolution, which lowers one image at a time.
+constexpr int64_t packed_conv2d_chunk_numel = 1 << 24;
+
+// Returns the boundaries of consecutive chunks of constituents whose columns,
+// of rows entries each, fit into packed_conv2d_chunk_numel. A constituent
+// whose columns alone exceed that forms a chunk by itself.
+std::vector<int64_t> _col_chunks(
+    const std::vector<int64_t>& col_offsets,
+    int64_t rows) {
+  std::vector<int64_t> chunks{0};
+  int64_t num_leaves = col_offsets.size() - 1;
+  for (int64_t i = 1; i < num_leaves; i++) {
+    if ((col_offsets[i + 1] - col_offsets[chunks.back()]) * rows >
+        packed_conv2d_chunk_numel) {
+      chunks.push_back(i);
+    }
   }
-  return result_size;
+  chunks.push_back(num_leaves);
+  return chunks;
 }
 
-// Transliteration of
-// https://github.com/pytorch/pytorch/blob/1f0cfbaaad09921f588adf549751041b8cb2e283/torch/nn/grad.py#L129
-// into C++
-at::Tensor _conv2d_grad_input(
-    const Tensor& grad_output,
-    const Tensor& input,
-    const Tensor& weight,
-    const c10::optional<Tensor>& bias,
+// Lowers the constituents [begin, end) into a single column buffer of shape
+// (C_in * kh * kw, sum_i L_i).
+at::Tensor _packed_im2col(
+    const std::vector<at::Tensor>& tensors,
+    const std::vector<int64_t>& col_offsets,
+    int64_t begin,
+    int64_t end,
+    IntArrayRef kernel_size,
     IntArrayRef stride,
     IntArrayRef padding,
-    IntArrayRef dilation,
-    int64_t groups) {
-  std::vector<int64_t> kernel_size{weight.size(2), weight.size(3)};
-  auto grad_input_padding = _grad_input_padding(
-      grad_output,
-      input.sizes(),
-      IntArrayRef(stride),
-      IntArrayRef(padding),
-      IntArrayRef(kernel_size),
-      IntArrayRef(dilation));
-  auto grad_input = at::conv_transpose2d(
-      grad_output,
-      weight,
-      c10::nullopt, //*bias,
-      IntArrayRef(stride),
-      IntArrayRef(padding),
-      IntArrayRef(grad_input_padding),
-      groups,
-      IntArrayRef(dilation));
-  return grad_input;
+    IntArrayRef dilation) {
+  at::Tensor cols = at::empty(
+      {tensors[begin].size(0) * kernel_size[0] * kernel_size[1],
+       col_offsets[end] - col_offsets[begin]},
+      tensors[begin].options());
+  for (int64_t i = begin; i < end; i++) {
+    cols.narrow(
+            1,
+            col_offsets[i] - col_offsets[begin],
+            col_offsets[i + 1] - col_offsets[i])
+        .copy_(at::im2col(
+                   tensors[i].unsqueeze(0),
+                   kernel_size,
+                   dilation,
+                   padding,
+                   stride)
+                   .squeeze(0));
+  }
+  return cols;
 }
 
-// Transliteration of
-// https://github.com/pytorch/pytorch/blob/1f0cfbaaad09921f588adf549751041b8cb2e283/torch/nn/grad.py#L170
-// into C++
-at::Tensor _conv2d_grad_weight(
-    const Tensor& grad_output_,
-    const Tensor& input_,
-    const Tensor& weight,
-    const c10::optional<Tensor>& bias,
+// Adjoint of _packed_im2col. Sums the columns of the constituents
+// [begin, end) in cols back into buffer, in which constituent i is of size
+// nested_size.leaf(i) and starts at offsets[i].
+void _packed_col2im(
+    at::Tensor& buffer,
+    const Tensor& cols,
+    const FlatSizeNode& nested_size,
+    const std::vector<int64_t>& offsets,
+    const std::vector<int64_t>& col_offsets,
+    int64_t begin,
+    int64_t end,
+    IntArrayRef kernel_size,
     IntArrayRef stride,
     IntArrayRef padding,
-    IntArrayRef dilation,
-    int64_t groups) {
-  int64_t in_channels = input_.size(1);
-  int64_t out_channels = grad_output_.size(1);
-  int64_t min_batch = input_.size(0);
-  auto weight_size = weight.sizes();
-  // std::cout << "00 grad_output_.sizes(): " << grad_output_.sizes()<<
-  // std::endl;
-  at::Tensor grad_output =
-      grad_output_.contiguous().repeat({1, in_channels / groups, 1, 1});
-  grad_output =
-      grad_output.contiguous().view({grad_output.size(0) * grad_output.size(1),
-                                     1,
-                                     grad_output.size(2),
-                                     grad_output.size(3)});
-  at::Tensor input = input_.contiguous().view(
-      {1, input_.size(0) * input_.size(1), input_.size(2), input_.size(3)});
-  at::Tensor grad_weight = at::conv2d(
-      input,
-      grad_output,
-      c10::nullopt,
-      dilation,
-      padding,
-      stride,
-      in_channels * min_batch);
-  grad_weight = grad_weight.contiguous().view({min_batch,
-                                               grad_weight.size(1) / min_batch,
-                                               grad_weight.size(2),
-                                               grad_weight.size(3)});
-  return grad_weight.sum(0)
-      .view({in_channels / groups,
-             out_channels,
-             grad_weight.size(2),
-             grad_weight.size(3)})
-      .transpose(0, 1)
-      .narrow(2, 0, weight_size[2])
-      .narrow(3, 0, weight_size[3]);
+    IntArrayRef dilation) {
+  for (int64_t i = begin; i < end; i++) {
+    c10::IntArrayRef size = nested_size.leaf(i);
+    buffer.narrow(0, offsets[i], offsets[i + 1] - offsets[i])
+        .view(size)
+        .copy_(at::col2im(
+                   cols.narrow(
+                           1,
+                           col_offsets[i] - col_offsets[begin],
+                           col_offsets[i + 1] - col_offsets[i])
+                       .unsqueeze(0),
+                   {size[1], size[2]},
+                   kernel_size,
+                   dilation,
+                   padding,
+                   stride)
+                   .squeeze(0));
+  }
+}
+
+// Copies the columns of the constituents [begin, end) out of cols, of shape
+// (channels, sum_i L_i), into buffer, in which constituent i is of shape
+// (channels, L_i).
+void _copy_cols_to_buffer(
+    at::Tensor& buffer,
+    const Tensor& cols,
+    const std::vector<int64_t>& col_offsets,
+    int64_t begin,
+    int64_t end) {
+  int64_t channels = cols.size(0);
+  for (int64_t i = begin; i < end; i++) {
+    int64_t length = col_offsets[i + 1] - col_offsets[i];
+    buffer.narrow(0, channels * col_offsets[i], channels * length)
+        .view({channels, length})
+        .copy_(cols.narrow(1, col_offsets[i] - col_offsets[begin], length));
+  }
+}
+
+// Inverse of _copy_cols_to_buffer for the constituents in tensors.
+at::Tensor _tensors_to_cols(
+    const std::vector<at::Tensor>& tensors,
+    int64_t channels,
+    const std::vector<int64_t>& col_offsets,
+    int64_t begin,
+    int64_t end) {
+  at::Tensor cols = at::empty(
+      {channels, col_offsets[end] - col_offsets[begin]},
+      tensors[begin].options());
+  for (int64_t i = begin; i < end; i++) {
+    cols.narrow(
+            1,
+            col_offsets[i] - col_offsets[begin],
+            col_offsets[i + 1] - col_offsets[i])
+        .copy_(tensors[i].reshape({channels, -1}));
+  }
+  return cols;
 }
 
 } // namespace impl
 
-struct NestedTensorFunction_conv2d
-    : torch::autograd::Function<NestedTensorFunction_conv2d> {
+// Convolution without groups of a NestedTensor of 3-dim constituents through
+// a single GEMM over the columns of all constituents. The bias is fused into
+// the GEMM and a ReLU, if requested, is applied to its result before it's
+// written into the output buffer.
+struct NestedTensorFunction_packed_conv2d
+    : torch::autograd::Function<NestedTensorFunction_packed_conv2d> {
   static Tensor forward(
       torch::autograd::AutogradContext* ctx,
       const Tensor& input,
@@ -149,124 +211,218 @@ struct NestedTensorFunction_conv2d
       IntArrayRef stride,
       IntArrayRef padding,
       IntArrayRef dilation,
-      int64_t groups) {
-    TORCH_CHECK(
-        !is_nested_tensor_impl(weight),
-        "weight needs to be a regular tensors.");
-    if (bias) {
-      TORCH_CHECK(
-          !is_nested_tensor_impl(*bias), "bias needs to be a regular tensors.");
+      bool relu) {
+    trace_packed(relu ? "conv2d_relu" : "conv2d");
+    int64_t out_channels = weight.size(0);
+    IntArrayRef kernel_size = weight.sizes().slice(2);
+    impl::PackedConv2dLayout layout = impl::_packed_conv2d_layout(
+        input, out_channels, kernel_size, stride, padding, dilation);
+    std::vector<at::Tensor> tensors =
+        flatten(get_nested_tensor_structure(input));
+    at::Tensor weight_2d = weight.reshape({out_channels, -1});
+    at::Tensor buffer = at::empty(
+        {out_channels * layout.col_offsets.back()}, input.options());
+    std::vector<int64_t> chunks =
+        impl::_col_chunks(layout.col_offsets, weight_2d.size(1));
+    for (size_t c = 0; c + 1 < chunks.size(); c++) {
+      at::Tensor cols = impl::_packed_im2col(
+          tensors,
+          layout.col_offsets,
+          chunks[c],
+          chunks[c + 1],
+          kernel_size,
+          stride,
+          padding,
+          dilation);
+      at::Tensor output_cols = bias
+          ? at::addmm((*bias).unsqueeze(1), weight_2d, cols)
+          : at::mm(weight_2d, cols);
+      if (relu) {
+        output_cols.relu_();
+      }
+      impl::_copy_cols_to_buffer(
+          buffer, output_cols, layout.col_offsets, chunks[c], chunks[c + 1]);
     }
-    // The final call to .contiguous is of questionable general value
-    // but in the context of DETR we'll make it the default.
-    at::Tensor output = map_nested_tensor(
-        [&](at::Tensor t) {
-          return at::conv2d(
-                     t.unsqueeze(0),
-                     weight,
-                     bias,
-                     stride,
-                     padding,
-                     dilation,
-                     groups)
-              .squeeze(0);
-        },
-        input);
-    // std::cout << "00 output.sizes(): " << output.sizes()<< std::endl;
-    // std::cout << "00 input.sizes(): " << input.sizes()<< std::endl;
+    at::Tensor output =
+        wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+            std::move(buffer), layout.output_nested_size));
     at::Tensor undef;
-    ctx->save_for_backward({weight, bias ? *bias : undef, output, input});
-    ctx->saved_data["4"] = stride.vec();
-    ctx->saved_data["5"] = padding.vec();
-    ctx->saved_data["6"] = groups;
-    ctx->saved_data["7"] = dilation.vec();
+    ctx->save_for_backward(
+        {input, weight, bias ? *bias : undef, relu ? output : undef});
+    ctx->saved_data["3"] = stride.vec();
+    ctx->saved_data["4"] = padding.vec();
+    ctx->saved_data["5"] = dilation.vec();
+    ctx->saved_data["6"] = input.requires_grad();
     return output;
   }
   static torch::autograd::variable_list backward(
       torch::autograd::AutogradContext* ctx,
-      // TODO: To prevent double backward (for now) check that grad_output
-      // doesn't require gradients.
       torch::autograd::variable_list grad_output) {
+    TORCH_CHECK(grad_output.size() == 1, "Expected grad_output of size 1.");
+    at::Tensor grad = grad_output[0];
+    TORCH_CHECK(
+        !grad.requires_grad(), "conv2d doesn't support double backward.");
     auto saved_data = ctx->get_saved_variables();
-    auto weight = saved_data[0];
-    c10::optional<at::Tensor> bias;
-    if (saved_data[1].defined()) {
-      bias = saved_data[1];
-    }
-    auto autograd_output = saved_data[2];
-    auto autograd_input = saved_data[3];
-
-    auto stride = ctx->saved_data["4"].toIntList().vec();
-    auto padding = ctx->saved_data["5"].toIntList().vec();
-    auto groups = ctx->saved_data["6"].toInt();
-    auto dilation = ctx->saved_data["7"].toIntList().vec();
-
-    auto weight_grad = torch::zeros_like(weight);
-    c10::optional<at::Tensor> bias_grad;
-    if (bias) {
-      bias_grad = torch::zeros_like(*bias);
+    at::Tensor input = saved_data[0];
+    at::Tensor weight = saved_data[1];
+    at::Tensor bias = saved_data[2];
+    auto stride = ctx->saved_data["3"].toIntList().vec();
+    auto padding = ctx->saved_data["4"].toIntList().vec();
+    auto dilation = ctx->saved_data["5"].toIntList().vec();
+    bool input_requires_grad = ctx->saved_data["6"].toBool();
+    int64_t out_channels = weight.size(0);
+    IntArrayRef kernel_size = weight.sizes().slice(2);
+    impl::PackedConv2dLayout layout = impl::_packed_conv2d_layout(
+        input, out_channels, kernel_size, stride, padding, dilation);
+    std::vector<at::Tensor> tensors =
+        flatten(get_nested_tensor_structure(input));
+    std::vector<at::Tensor> grad_tensors =
+        flatten(get_nested_tensor_structure(grad));
+    at::Tensor output = saved_data[3];
+    if (output.defined()) {
+      std::vector<at::Tensor> output_tensors =
+          flatten(get_nested_tensor_structure(output));
+      for (size_t i = 0; i < grad_tensors.size(); i++) {
+        grad_tensors[i] =
+            at::threshold_backward(grad_tensors[i], output_tensors[i], 0);
+      }
     }
 
-    TORCH_CHECK(grad_output.size() == 1, "not supported 0");
-    at::Tensor grad = map_nested_tensor(
-        [&](at::Tensor r, at::Tensor i, at::Tensor g) {
-          TORCH_CHECK(
-              !g.requires_grad(), "conv2d doesn't support double backward.");
-          if (bias) {
-            (*bias_grad).add_(g.sum(1).sum(1));
-          }
-          auto i_ = i.unsqueeze(0);
-          auto g_ = g.unsqueeze(0);
-          weight_grad.add_(impl::_conv2d_grad_weight(
-              g_, i_, weight, bias, stride, padding, dilation, groups));
-          return impl::_conv2d_grad_input(
-                     g_, i_, weight, bias, stride, padding, dilation, groups)
-              .squeeze(0);
-        },
-        autograd_output,
-        autograd_input,
-        grad_output[0]);
+    // The weight gradient is accumulated over chunks of columns, which are
+    // recomputed instead of saved during the forward. The input gradient of a
+    // chunk is computed from the output gradient of the same chunk.
     at::Tensor undef;
-    return {grad,
-            weight_grad,
-            bias ? *bias_grad : undef,
-            undef,
-            undef,
-            undef,
-            undef,
-            undef};
+    at::Tensor weight_2d = weight.reshape({out_channels, -1});
+    at::Tensor grad_weight = at::zeros_like(weight_2d);
+    at::Tensor grad_bias = bias.defined() ? at::zeros_like(bias) : undef;
+    const FlatSizeNode& input_nested_size =
+        get_nested_tensor_impl(input)->flat_nested_size();
+    const std::vector<int64_t>& input_offsets =
+        get_nested_tensor_impl(input)->contiguous_offsets();
+    at::Tensor grad_input_buffer = input_requires_grad
+        ? at::empty({input_offsets.back()}, input.options())
+        : undef;
+    std::vector<int64_t> chunks =
+        impl::_col_chunks(layout.col_offsets, weight_2d.size(1));
+    for (size_t c = 0; c + 1 < chunks.size(); c++) {
+      at::Tensor grad_cols = impl::_tensors_to_cols(
+          grad_tensors,
+          out_channels,
+          layout.col_offsets,
+          chunks[c],
+          chunks[c + 1]);
+      at::Tensor cols = impl::_packed_im2col(
+          tensors,
+          layout.col_offsets,
+          chunks[c],
+          chunks[c + 1],
+          kernel_size,
+          stride,
+          padding,
+          dilation);
+      grad_weight.addmm_(grad_cols, cols.t());
+      if (bias.defined()) {
+        grad_bias.add_(grad_cols.sum(1));
+      }
+      if (input_requires_grad) {
+        impl::_packed_col2im(
+            grad_input_buffer,
+            weight_2d.t().mm(grad_cols),
+            input_nested_size,
+            input_offsets,
+            layout.col_offsets,
+            chunks[c],
+            chunks[c + 1],
+            kernel_size,
+            stride,
+            padding,
+            dilation);
+      }
+    }
+    grad_weight = grad_weight.view(weight.sizes());
+    at::Tensor grad_input = input_requires_grad
+        ? wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+              std::move(grad_input_buffer), input_nested_size))
+        : undef;
+    return {grad_input, grad_weight, grad_bias, undef, undef, undef, undef};
   }
 };
 
-Tensor NestedTensor_conv2d(
+Tensor _nested_conv2d(
     const Tensor& input,
     const Tensor& weight,
     const c10::optional<Tensor>& bias,
     IntArrayRef stride,
     IntArrayRef padding,
     IntArrayRef dilation,
-    int64_t groups) {
-  // return NestedTensorFunction_conv2d::apply(
-  //     input, weight, bias, stride, padding, dilation, groups);
+    int64_t groups,
+    bool relu) {
+  // If most constituents are of distinct sizes, size buckets don't help and a
+  // single GEMM over the columns of all constituents is used instead.
+  if (groups == 1 && get_packed_mode() != PackedMode::Never &&
+      get_nested_tensor_impl(input)->nested_dim() == 1 && input.dim() == 4 &&
+      weight.dim() == 4) {
+    int64_t num_buckets = bucket_by_size(input).size();
+    if (2 * num_buckets > input.size(0)) {
+      return NestedTensorFunction_packed_conv2d::apply(
+          input, weight, bias, stride, padding, dilation, relu);
+    }
+  }
   if (bias) {
-  return autograd_map_nested_tensor(
-      [&stride, &padding, &dilation, &groups](at::Tensor input, at::Tensor weight, at::Tensor bias) {
-        return at::conv2d(input.unsqueeze(0), weight, bias, stride, padding, dilation, groups).squeeze(0);
-        // return at::conv2d(input, self, c10::nullopt, stride, padding, dilation, groups);
-      },
-      input,
-      weight,
-      *bias);
+    return autograd_map_size_buckets(
+        [&stride, &padding, &dilation, &groups, &relu](
+            at::Tensor input, at::Tensor weight, at::Tensor bias) {
+          at::Tensor output = at::conv2d(
+              input, weight, bias, stride, padding, dilation, groups);
+          return relu ? at::relu(output) : output;
+        },
+        input,
+        weight,
+        *bias);
   }
-  return autograd_map_nested_tensor(
-      [&stride, &padding, &dilation, &groups](at::Tensor input, at::Tensor weight) {
-        return at::conv2d(input.unsqueeze(0), weight, c10::nullopt, stride, padding, dilation, groups).squeeze(0);
-        // return at::conv2d(input, self, c10::nullopt, stride, padding, dilation, groups);
+  return autograd_map_size_buckets(
+      [&stride, &padding, &dilation, &groups, &relu](
+          at::Tensor input, at::Tensor weight) {
+        at::Tensor output = at::conv2d(
+            input, weight, c10::nullopt, stride, padding, dilation, groups);
+        return relu ? at::relu(output) : output;
       },
       input,
       weight);
 }
 
+Tensor NestedTensor_conv2d(
+    const Tensor& input,
+    const Tensor& weight,
+    const c10::optional<Tensor>& bias,
+    IntArrayRef stride,
+    IntArrayRef padding,
+    IntArrayRef dilation,
+    int64_t groups) {
+  return _nested_conv2d(
+      input, weight, bias, stride, padding, dilation, groups, false);
+}
+
+// conv2d followed by relu without materializing the output of conv2d as a
+// separate NestedTensor.
+Tensor NestedTensor_conv2d_relu(
+    Tensor input,
+    Tensor weight,
+    c10::optional<Tensor> bias,
+    std::vector<int64_t> stride,
+    std::vector<int64_t> padding,
+    std::vector<int64_t> dilation,
+    int64_t groups) {
+  TORCH_CHECK(
+      is_nested_tensor_impl(input), "conv2d_relu expects a NestedTensor.");
+  return _nested_conv2d(
+      input, weight, bias, stride, padding, dilation, groups, true);
+}
+
+static auto registry = torch::RegisterOperators().op(
+    "nestedtensor::conv2d_relu",
+    &NestedTensor_conv2d_relu);
+
 TORCH_LIBRARY_IMPL(aten, AutogradPrivateUse1, m) {
   nt_impl(m, "conv2d", NestedTensor_conv2d);
 }
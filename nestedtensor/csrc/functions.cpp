@@ -31,25 +31,6 @@ Tensor NestedTensor_embedding(
       indices);
 }
 
-
-Tensor NestedTensor_softmax(
-    const Tensor& input,
-    const int64_t dim_,
-    c10::optional<ScalarType> dtype) {
-  int64_t dim = maybe_wrap_dim(dim_, input.dim());
-  auto input_data = get_nested_tensor_impl(input);
-  int64_t nested_dim = input_data->nested_dim();
-  TORCH_CHECK(
-      dim >= nested_dim,
-      "Cannot apply softmax across nested dimensions ",
-      std::to_string(dim));
-  return autograd_map_nested_tensor(
-      [dim, nested_dim, dtype](const at::Tensor t) {
-        return at::softmax(t, dim - nested_dim, dtype);
-      },
-      input);
-}
-
 Tensor NestedTensor_layer_norm(
     const Tensor& input,
     IntArrayRef normalized_shape,
@@ -65,6 +46,48 @@ Tensor NestedTensor_layer_norm(
       input_data->opt_sizes()[input.dim() - 1],
       "Cannot normalize across irregular dimension ",
       std::to_string(input.dim() - 1));
+  TORCH_CHECK(
+      (weight && bias) || (!weight && !bias),
+      "Either both weight and bias are used or not.");
+  // The constituents of a packed NestedTensor are rows of length D of its
+  // buffer viewed as (-1, D), which are normalized by a single call. The
+  // gradients of weight and bias are then a single reduction over all rows.
+  int64_t features = *input_data->opt_sizes()[input.dim() - 1];
+  at::Tensor packed_input = get_packed_mode() == PackedMode::Always
+      ? pack_nested_tensor(input)
+      : input;
+  if (can_apply_to_buffers(packed_input)) {
+    trace_packed("layer_norm");
+    if (weight && bias) {
+      return autograd_map_packed_nested_tensor(
+          [normalized_shape, eps, features](
+              const at::Tensor buffer, Tensor w, Tensor b) {
+            return at::layer_norm(
+                       buffer.view({-1, features}),
+                       normalized_shape,
+                       w,
+                       b,
+                       eps,
+                       true)
+                .view({-1});
+          },
+          packed_input,
+          *weight,
+          *bias);
+    }
+    return autograd_map_packed_nested_tensor(
+        [normalized_shape, eps, features](const at::Tensor buffer) {
+          return at::layer_norm(
+                     buffer.view({-1, features}),
+                     normalized_shape,
+                     c10::nullopt,
+                     c10::nullopt,
+                     eps,
+                     true)
+              .view({-1});
+        },
+        packed_input);
+  }
   if (weight && bias) {
     return autograd_map_nested_tensor(
         [normalized_shape, eps](
@@ -77,7 +100,6 @@ Tensor NestedTensor_layer_norm(
         *weight,
         *bias);
   }
-  TORCH_CHECK(!weight && !bias, "Either both weight and bias are used or not.");
   return autograd_map_nested_tensor(
       [normalized_shape, eps](const at::Tensor t) {
         return at::layer_norm(
@@ -126,14 +148,6 @@ Tensor NestedTensor_any(const Tensor& self) {
   return gathered.any();
 }
 
-Tensor NestedTensor__log_softmax(
-    const Tensor& self,
-    const int64_t dim_,
-    const bool half_to_float) {
-  return autograd_map_nested_tensor(
-      [&](Tensor a) { return at::_log_softmax(a, dim_, half_to_float); }, self);
-}
-
 Tensor NestedTensor_pin_memory(const Tensor& self) {
   return map_nested_tensor(
       [](Tensor tensor) { return at::native::pin_memory(tensor); }, self);
@@ -238,8 +252,6 @@ TORCH_LIBRARY_IMPL(aten, AutogradPrivateUse1, m) {
   nt_impl(m, "embedding", NestedTensor_embedding);
   nt_impl(m, "any", NestedTensor_any);
   nt_impl(m, "all", NestedTensor_all);
-  nt_impl(m, "_log_softmax", NestedTensor__log_softmax);
-  nt_impl(m, "softmax.int", NestedTensor_softmax);
   nt_impl(m, "layer_norm", NestedTensor_layer_norm);
   nt_impl(m, "pin_memory", NestedTensor_pin_memory);
   nt_impl(m, "flatten.using_ints", NestedTensor_flatten);
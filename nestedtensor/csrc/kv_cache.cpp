@@ -0,0 +1,188 @@
+#include <nestedtensor/csrc/kv_cache.h>
+#include <nestedtensor/csrc/mha.h>
+#include <algorithm>
+#include <numeric>
+
+namespace torch {
+namespace nested_tensor {
+
+namespace {
+
+// Returns the rows of t, a NestedTensor of shape (N, L_i, dim) or a Tensor of
+// shape (N, dim), as a Tensor of shape (T, dim) along with the number of rows
+// of each sequence.
+std::tuple<at::Tensor, std::vector<int64_t>> _sequence_rows(
+    const at::Tensor& t,
+    int64_t num_sequences,
+    int64_t dim) {
+  if (is_nested_tensor_impl(t)) {
+    auto nt_impl = get_nested_tensor_impl(t);
+    TORCH_CHECK(
+        nt_impl->nested_dim() == 1 && t.dim() == 3 &&
+            t.size(0) == num_sequences && nt_impl->opt_sizes()[2] &&
+            t.size(2) == dim,
+        "Expected a NestedTensor of shape (",
+        num_sequences,
+        ", L_i, ",
+        dim,
+        ").");
+    const FlatSizeNode& nested_size = nt_impl->flat_nested_size();
+    std::vector<int64_t> counts;
+    for (int64_t i = 0; i < nested_size.num_leaves(); i++) {
+      counts.push_back(nested_size.leaf(i)[0]);
+    }
+    return std::make_tuple(
+        get_buffer(pack_nested_tensor(t)).view({-1, dim}), std::move(counts));
+  }
+  TORCH_CHECK(
+      t.dim() == 2 && t.size(0) == num_sequences && t.size(1) == dim,
+      "Expected a Tensor of shape (",
+      num_sequences,
+      ", ",
+      dim,
+      ").");
+  return std::make_tuple(t, std::vector<int64_t>(num_sequences, 1));
+}
+
+at::Tensor _index_tensor(const std::vector<int64_t>& index, at::Device device) {
+  return at::tensor(index, at::kLong).to(device);
+}
+
+} // namespace
+
+RaggedKVCache::RaggedKVCache(
+    int64_t num_sequences,
+    int64_t key_dim,
+    int64_t value_dim,
+    int64_t capacity,
+    const at::Tensor& like)
+    : starts_(num_sequences),
+      lengths_(num_sequences, 0),
+      capacities_(num_sequences, capacity),
+      end_(num_sequences * capacity) {
+  TORCH_CHECK(
+      num_sequences >= 0 && capacity >= 0,
+      "num_sequences and capacity must be non-negative.");
+  for (int64_t i = 0; i < num_sequences; i++) {
+    starts_[i] = i * capacity;
+  }
+  keys_ = at::empty({end_, key_dim}, like.options());
+  values_ = at::empty({end_, value_dim}, like.options());
+}
+
+void RaggedKVCache::_reallocate() {
+  int64_t rows = std::accumulate(
+      capacities_.begin(), capacities_.end(), (int64_t)0);
+  at::Tensor keys = at::empty({2 * rows, keys_.size(1)}, keys_.options());
+  at::Tensor values = at::empty({2 * rows, values_.size(1)}, values_.options());
+  std::vector<int64_t> source;
+  std::vector<int64_t> target;
+  int64_t row = 0;
+  for (int64_t i = 0; i < num_sequences(); i++) {
+    for (int64_t j = 0; j < lengths_[i]; j++) {
+      source.push_back(starts_[i] + j);
+      target.push_back(row + j);
+    }
+    starts_[i] = row;
+    row += capacities_[i];
+  }
+  if (!source.empty()) {
+    at::Tensor source_index = _index_tensor(source, keys_.device());
+    at::Tensor target_index = _index_tensor(target, keys_.device());
+    keys.index_copy_(0, target_index, keys_.index_select(0, source_index));
+    values.index_copy_(0, target_index, values_.index_select(0, source_index));
+  }
+  keys_ = std::move(keys);
+  values_ = std::move(values);
+  end_ = row;
+}
+
+void RaggedKVCache::_reserve(int64_t index, int64_t length) {
+  if (length <= capacities_[index]) {
+    return;
+  }
+  int64_t capacity = std::max(length, 2 * capacities_[index]);
+  if (end_ + capacity > keys_.size(0)) {
+    capacities_[index] = capacity;
+    _reallocate();
+    return;
+  }
+  int64_t used = lengths_[index];
+  if (used > 0) {
+    keys_.narrow(0, end_, used).copy_(keys_.narrow(0, starts_[index], used));
+    values_.narrow(0, end_, used)
+        .copy_(values_.narrow(0, starts_[index], used));
+  }
+  starts_[index] = end_;
+  capacities_[index] = capacity;
+  end_ += capacity;
+}
+
+void RaggedKVCache::append(const at::Tensor& keys, const at::Tensor& values) {
+  at::NoGradGuard no_grad;
+  TORCH_CHECK(
+      keys.scalar_type() == keys_.scalar_type() &&
+          values.scalar_type() == values_.scalar_type(),
+      "keys and values must be of the same type as the cache.");
+  at::Tensor key_rows, value_rows;
+  std::vector<int64_t> counts, value_counts;
+  std::tie(key_rows, counts) =
+      _sequence_rows(keys, num_sequences(), keys_.size(1));
+  std::tie(value_rows, value_counts) =
+      _sequence_rows(values, num_sequences(), values_.size(1));
+  TORCH_CHECK(
+      counts == value_counts,
+      "keys and values must have the same number of rows per sequence.");
+  for (int64_t i = 0; i < num_sequences(); i++) {
+    _reserve(i, lengths_[i] + counts[i]);
+  }
+  std::vector<int64_t> target;
+  for (int64_t i = 0; i < num_sequences(); i++) {
+    for (int64_t j = 0; j < counts[i]; j++) {
+      target.push_back(starts_[i] + lengths_[i] + j);
+    }
+    lengths_[i] += counts[i];
+  }
+  if (target.empty()) {
+    return;
+  }
+  at::Tensor target_index = _index_tensor(target, keys_.device());
+  keys_.index_copy_(0, target_index, key_rows);
+  values_.index_copy_(0, target_index, value_rows);
+}
+
+void RaggedKVCache::add_sequences(int64_t count) {
+  TORCH_CHECK(count >= 0, "count must be non-negative.");
+  for (int64_t i = 0; i < count; i++) {
+    starts_.push_back(end_);
+    lengths_.push_back(0);
+    capacities_.push_back(0);
+  }
+}
+
+void RaggedKVCache::remove(std::vector<int64_t> indices) {
+  std::sort(indices.begin(), indices.end());
+  indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+  TORCH_CHECK(
+      indices.empty() ||
+          (indices.front() >= 0 && indices.back() < num_sequences()),
+      "Sequence indices are out of range.");
+  for (auto it = indices.rbegin(); it != indices.rend(); it++) {
+    int64_t index = *it;
+    starts_.erase(starts_.begin() + index);
+    lengths_.erase(lengths_.begin() + index);
+    capacities_.erase(capacities_.begin() + index);
+  }
+}
+
+at::Tensor RaggedKVCache::attention(
+    const at::Tensor& query,
+    int64_t num_heads,
+    double scaling,
+    bool is_causal) const {
+  return cached_ragged_attention(
+      query, keys_, values_, lengths_, starts_, num_heads, scaling, is_causal);
+}
+
+} // namespace nested_tensor
+} // namespace torch
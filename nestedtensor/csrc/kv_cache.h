@@ -0,0 +1,80 @@
+#pragma once
+#include <nestedtensor/csrc/nested_tensor_impl.h>
+
+namespace torch {
+namespace nested_tensor {
+
+// NOTE: Ragged KV cache
+//
+// Incremental decoding appends the keys and values of a few rows per sequence
+// and step. Concatenating NestedTensors copies all previous rows each time.
+// A RaggedKVCache instead keeps them in two buffers of shape (R, E) and
+// (R, Ev). Sequence i owns capacities_[i] rows starting at starts_[i], of
+// which the first lengths_[i] are in use. A sequence that outgrows its rows
+// moves to the unused rows past end_ with twice its capacity, so each row is
+// copied O(1) times on average. Removed sequences and moved rows leave slack
+// behind, which is reclaimed once the buffers are full. They are then
+// reallocated with twice the capacity of the live sequences and compacted.
+// Attention reads the rows of each sequence from the buffers in place.
+class RaggedKVCache {
+ public:
+  // like provides the dtype and device of the buffers.
+  RaggedKVCache(
+      int64_t num_sequences,
+      int64_t key_dim,
+      int64_t value_dim,
+      int64_t capacity,
+      const at::Tensor& like);
+
+  // Appends keys and values to each sequence. Both are either NestedTensors
+  // of shape (N, L_i, E) or Tensors of shape (N, E) with one row per sequence.
+  void append(const at::Tensor& keys, const at::Tensor& values);
+
+  // Adds count empty sequences after the existing ones.
+  void add_sequences(int64_t count);
+
+  // Removes the given sequences, e.g. because they are finished. The
+  // remaining sequences keep their order.
+  void remove(std::vector<int64_t> indices);
+
+  // Ragged attention of query, a NestedTensor of shape (N, L_i, E) or a Tensor
+  // of shape (N, E), over the cached keys and values of each sequence. If
+  // is_causal the queries of a sequence are its newest L_i cached positions
+  // and each attends to the keys up to its own position.
+  at::Tensor attention(
+      const at::Tensor& query,
+      int64_t num_heads,
+      double scaling,
+      bool is_causal) const;
+
+  int64_t num_sequences() const {
+    return lengths_.size();
+  }
+  const std::vector<int64_t>& lengths() const {
+    return lengths_;
+  }
+  const std::vector<int64_t>& starts() const {
+    return starts_;
+  }
+  const at::Tensor& key_buffer() const {
+    return keys_;
+  }
+  const at::Tensor& value_buffer() const {
+    return values_;
+  }
+
+ private:
+  void _reserve(int64_t index, int64_t length);
+  void _reallocate();
+
+  at::Tensor keys_;
+  at::Tensor values_;
+  std::vector<int64_t> starts_;
+  std::vector<int64_t> lengths_;
+  std::vector<int64_t> capacities_;
+  // First row that isn't owned by any sequence.
+  int64_t end_;
+};
+
+} // namespace nested_tensor
+} // namespace torch
@@ -1,3 +1,4 @@
+#include <ATen/ExpandUtils.h>
 #include <nestedtensor/csrc/nested_tensor_impl.h>
 #include <nestedtensor/csrc/utils/nested_node_functions.h>
 #include <torch/extension.h>
@@ -7,6 +8,136 @@ using namespace torch::nn;
 namespace F = torch::nn::functional;
 
 namespace at {
+
+// Returns true if the NT x NT matmul of self and other can write into a single
+// new buffer.
+static bool _packed_nt_matmul_applies(const Tensor& self, const Tensor& other) {
+  if (get_packed_mode() == PackedMode::Never ||
+      !is_nested_tensor_impl(self, other) || !is_packed(self, other) ||
+      self.dim() != 4 || other.dim() != 4) {
+    return false;
+  }
+  auto impl_self = get_nested_tensor_impl(self);
+  auto impl_other = get_nested_tensor_impl(other);
+  const auto& self_sizes = impl_self->opt_sizes();
+  const auto& other_sizes = impl_other->opt_sizes();
+  return self_sizes[0] && other_sizes[0] && self_sizes[1] && other_sizes[1] &&
+      self_sizes[3] && other_sizes[2] &&
+      (*self_sizes[0] == *other_sizes[0]) &&
+      (*self_sizes[1] == *other_sizes[1]) &&
+      (*self_sizes[3] == *other_sizes[2]);
+}
+
+// Returns true if the rows of all constituents of self can be multiplied with
+// the matrix other at once.
+static bool _packed_matmul_applies(const Tensor& self, const Tensor& other) {
+  if (!is_nested_tensor_impl(self) || is_nested_tensor_impl(other) ||
+      self.dim() != 3 || other.dim() != 2 || !can_apply_to_buffers(self) ||
+      get_nested_tensor_impl(self)->nested_dim() != 1) {
+    return false;
+  }
+  c10::optional<int64_t> last_size =
+      get_nested_tensor_impl(self)->opt_sizes()[2];
+  return last_size && *last_size == other.size(0);
+}
+
+// Stacks the rows of all constituents of the 3-dim NestedTensor nt into a
+// single matrix with cols columns.
+static Tensor _stack_rows(const Tensor& nt, int64_t cols) {
+  if (can_apply_to_buffers(nt)) {
+    return get_buffer(nt).reshape({-1, cols});
+  }
+  std::vector<at::Tensor> rows;
+  for (const auto& tensor : flatten(get_nested_tensor_structure(nt))) {
+    rows.push_back(tensor.reshape({-1, cols}));
+  }
+  if (rows.size() == 0) {
+    return at::empty({0, cols}, nt.options());
+  }
+  return at::cat(rows);
+}
+
+// Returns count consecutive constituents of a contiguous buffer, starting at
+// first, as one batch of matrices without copying.
+static Tensor _batch(
+    const std::vector<Tensor>& tensors,
+    int64_t first,
+    int64_t count) {
+  const Tensor& t = tensors[first];
+  return t.as_strided(
+      {count * t.size(0), t.size(1), t.size(2)},
+      {t.stride(0), t.stride(1), t.stride(2)});
+}
+
+// Multiplies the 3-dim constituents of self and other into those of result
+// with as few GEMM calls as possible. Constituents are grouped by the shape of
+// their product. Within a group, runs of consecutive constituents are
+// adjacent in contiguous buffers and are multiplied by a single bmm without
+// copies. The remaining constituents of a group are gathered into one batch
+// and the products are copied into result.
+static void _grouped_matmul_out(
+    Tensor& result,
+    const Tensor& self,
+    const Tensor& other) {
+  std::vector<Tensor> result_tensors =
+      flatten(get_nested_tensor_structure(result));
+  std::vector<Tensor> self_tensors = flatten(get_nested_tensor_structure(self));
+  std::vector<Tensor> other_tensors =
+      flatten(get_nested_tensor_structure(other));
+  bool contiguous = result.is_contiguous() && self.is_contiguous() &&
+      other.is_contiguous();
+  std::map<std::pair<int64_t, int64_t>, std::vector<int64_t>> groups;
+  for (size_t i = 0; i < self_tensors.size(); i++) {
+    groups[std::make_pair(self_tensors[i].size(1), other_tensors[i].size(2))]
+        .push_back(i);
+  }
+  for (const auto& group : groups) {
+    const std::vector<int64_t>& indices = group.second;
+    std::vector<int64_t> leftovers;
+    size_t begin = 0;
+    while (begin < indices.size()) {
+      size_t end = begin + 1;
+      while (end < indices.size() && indices[end] == indices[end - 1] + 1) {
+        end++;
+      }
+      int64_t count = end - begin;
+      if (contiguous && count > 1) {
+        Tensor result_batch = _batch(result_tensors, indices[begin], count);
+        at::bmm_out(
+            result_batch,
+            _batch(self_tensors, indices[begin], count),
+            _batch(other_tensors, indices[begin], count));
+      } else {
+        for (size_t j = begin; j < end; j++) {
+          leftovers.push_back(indices[j]);
+        }
+      }
+      begin = end;
+    }
+    if (leftovers.size() == 1) {
+      at::matmul_out(
+          result_tensors[leftovers[0]],
+          self_tensors[leftovers[0]],
+          other_tensors[leftovers[0]]);
+    }
+    if (leftovers.size() > 1) {
+      std::vector<Tensor> self_batch;
+      std::vector<Tensor> other_batch;
+      for (int64_t index : leftovers) {
+        self_batch.push_back(self_tensors[index]);
+        other_batch.push_back(other_tensors[index]);
+      }
+      Tensor result_batch =
+          at::matmul(at::stack(self_batch), at::stack(other_batch));
+      for (size_t j = 0; j < leftovers.size(); j++) {
+        result_tensors[leftovers[j]].copy_(result_batch[j]);
+      }
+    }
+  }
+}
+
+// Runs on the buffers of self and other. Only use this if either
+// _packed_nt_matmul_applies or _packed_matmul_applies holds.
 struct NestedTensorFunction_matmul
     : torch::autograd::Function<NestedTensorFunction_matmul> {
   static Tensor forward(
@@ -15,73 +146,39 @@ struct NestedTensorFunction_matmul
       const Tensor& other) {
     ctx->save_for_backward({self, other});
     auto impl_self = get_nested_tensor_impl(self);
-    auto structure_self = get_nested_tensor_structure(self);
     if (is_nested_tensor_impl(other)) {
+      trace_packed("NT x NT matmul");
       auto impl_other = get_nested_tensor_impl(other);
-      auto structure_other = get_nested_tensor_structure(other);
-      if (structure_self.buffer() && structure_other.buffer() &&
-          self.dim() == 4 && other.dim() == 4 && impl_self->opt_sizes()[0] &&
-          impl_other->opt_sizes()[0] && impl_self->opt_sizes()[1] &&
-          impl_other->opt_sizes()[1] && impl_self->opt_sizes()[3] &&
-          impl_other->opt_sizes()[2] &&
-          (*impl_self->opt_sizes()[0] == *impl_other->opt_sizes()[0]) &&
-          (*impl_self->opt_sizes()[1] == *impl_other->opt_sizes()[1]) &&
-          (*impl_self->opt_sizes()[3] == *impl_other->opt_sizes()[2])) {
-#ifdef TRACEPACKED
-        std::cout << "calling packed NT x NT matmul" << std::endl;
-#endif
-        SizeNode new_nested_size = map(
-            [&](c10::List<int64_t> self_size, c10::List<int64_t> other_size) {
-              c10::List<int64_t> new_size{
-                  self_size[0], self_size[1], other_size[2]};
-              return std::move(new_size);
-            },
-            impl_self->nested_size(),
-            impl_other->nested_size());
-        auto fn = [](c10::List<int64_t> leaf, int64_t input) {
-          return input + leaf[0] * leaf[1] * leaf[2];
-        };
-        int64_t new_numel = reduce<decltype(fn), int64_t, c10::List<int64_t>>(
-            new_nested_size, fn, 0);
-        Tensor new_buffer = at::empty({new_numel}, self.options());
-        Tensor result =
-            wrap_tensor_node(torch::nested_tensor::impl::build_structure(
-                std::move(new_buffer), new_nested_size));
-        apply_nested_tensor(
-            [](at::Tensor& result, at::Tensor self, at::Tensor other) {
-              at::matmul_out(result, self, other);
-            },
-            result,
-            self,
-            other);
-        return result;
-      }
-      return map_nested_tensor(
-          [](Tensor s, Tensor o) { return at::matmul(s, o); }, self, other);
-    }
-    if (structure_self.buffer()) {
-      if (self.dim() == 3 && other.dim() == 2 && impl_self->opt_sizes()[0] &&
-          impl_self->opt_sizes()[2] &&
-          impl_self->opt_sizes()[self.dim() - 1] ==
-              other.size(self.dim() - 2)) {
-#ifdef TRACEPACKED
-        std::cout << "calling packed NT x T matmul" << std::endl;
-#endif
-        SizeNode new_nested_size = map(
-            [&](c10::List<int64_t> self_size) {
-              c10::List<int64_t> new_size{self_size[0], other.size(1)};
-              return std::move(new_size);
-            },
-            impl_self->nested_size());
-        return wrap_tensor_node(torch::nested_tensor::impl::build_structure(
-            at::matmul(
-                (*structure_self.buffer()).reshape({-1, other.size(0)}), other)
-                .reshape(-1),
-            new_nested_size));
-      }
+      SizeNode new_nested_size = map(
+          [&](c10::List<int64_t> self_size, c10::List<int64_t> other_size) {
+            c10::List<int64_t> new_size{
+                self_size[0], self_size[1], other_size[2]};
+            return std::move(new_size);
+          },
+          impl_self->nested_size(),
+          impl_other->nested_size());
+      auto fn = [](c10::List<int64_t> leaf, int64_t input) {
+        return input + leaf[0] * leaf[1] * leaf[2];
+      };
+      int64_t new_numel = reduce<decltype(fn), int64_t, c10::List<int64_t>>(
+          new_nested_size, fn, 0);
+      Tensor new_buffer = at::empty({new_numel}, self.options());
+      Tensor result =
+          wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+              std::move(new_buffer), new_nested_size));
+      _grouped_matmul_out(result, self, other);
+      return result;
     }
-    return map_nested_tensor(
-        [&other](Tensor tensor) { return at::matmul(tensor, other); }, self);
+    trace_packed("NT x T matmul");
+    SizeNode new_nested_size = map(
+        [&](c10::List<int64_t> self_size) {
+          c10::List<int64_t> new_size{self_size[0], other.size(1)};
+          return std::move(new_size);
+        },
+        impl_self->nested_size());
+    return wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+        at::matmul(_stack_rows(self, other.size(0)), other).reshape(-1),
+        new_nested_size));
   }
   static torch::autograd::variable_list backward(
       torch::autograd::AutogradContext* ctx,
@@ -89,32 +186,22 @@ struct NestedTensorFunction_matmul
       // doesn't require gradients.
       torch::autograd::variable_list grad_output) {
     TORCH_CHECK(
-        grad_output.size() == 1, "Expected grad_output of size 1 for addmm.");
+        grad_output.size() == 1, "Expected grad_output of size 1 for matmul.");
     auto grad = grad_output[0];
     TORCH_CHECK(
-        !grad.requires_grad(), "addmm does not support double backward.");
+        !grad.requires_grad(), "matmul does not support double backward.");
     auto saved_data = ctx->get_saved_variables();
     auto self = saved_data[0];
     auto other = saved_data[1];
     TORCH_CHECK(self.dim() >= 3, "NT self must be at least 3-dim.");
     TORCH_CHECK(is_nested_tensor_impl(self), "self must be NestedTensor");
     if (!is_nested_tensor_impl(other)) {
-      TORCH_CHECK(other.dim() >= 2, "T other must be at least 2-dim.");
-      // auto grad_other_nt =
-      //     at::matmul(self.transpose(self.dim() - 2, self.dim() - 1), grad);
-      // TODO: Implement sum over nested dimensions
-      auto grad_other = torch::zeros_like(other);
-      // apply_nested_tensor(
-      //     [&grad_other](at::Tensor& t) { grad_other.add_(t);
-      //     },
-      //     grad_other_nt);
-      apply_nested_tensor(
-          [&grad_other](at::Tensor& s, at::Tensor& g) {
-            grad_other.add_(
-                at::matmul(s.transpose(s.dim() - 2, s.dim() - 1), g));
-          },
-          self,
-          grad);
+      TORCH_CHECK(other.dim() == 2, "T other must be 2-dim.");
+      // The gradient of other sums over all rows of all constituents, which
+      // is a single matrix product of the stacked rows.
+      auto grad_other = at::matmul(
+          _stack_rows(self, other.size(0)).transpose(0, 1),
+          _stack_rows(grad, other.size(1)));
       auto grad_self = at::matmul(grad, other.transpose(0, 1));
       return {grad_self, grad_other};
     }
@@ -125,14 +212,20 @@ struct NestedTensorFunction_matmul
 };
 
 Tensor NestedTensor_matmul(const Tensor& self, const Tensor& other) {
-#ifdef USEPACKED
-  return NestedTensorFunction_matmul::apply(self, other);
-#else
+  at::Tensor packed_self = self;
+  at::Tensor packed_other = other;
+  if (get_packed_mode() == PackedMode::Always) {
+    packed_self = pack_nested_tensor(self);
+    packed_other = pack_nested_tensor(other);
+  }
+  if (_packed_nt_matmul_applies(packed_self, packed_other) ||
+      _packed_matmul_applies(packed_self, packed_other)) {
+    return NestedTensorFunction_matmul::apply(packed_self, packed_other);
+  }
   return autograd_map_nested_tensor(
       [](at::Tensor self, at::Tensor other) { return at::matmul(self, other); },
       self,
       other);
-#endif
 }
 
 Tensor& NestedTensor_matmul_out(
@@ -149,15 +242,11 @@ Tensor& NestedTensor_matmul_out(
   return result;
 }
 
-at::Tensor mm_mat1_backward(
-    at::Tensor grad,
-    at::Tensor other,
-    c10::Scalar alpha) {
-  return maybe_multiply(at::matmul(grad, other.transpose(0, 1)), alpha);
-}
-
 // TODO: Technically this has the wrong semantics and shouldn't accept NTs of
 // 3dim, but there's not addmatml
+//
+// Runs on the buffer of self. Only use this if _packed_matmul_applies holds
+// for self and other and input is a regular Tensor.
 struct NestedTensorFunction_addmm
     : torch::autograd::Function<NestedTensorFunction_addmm> {
   static Tensor forward(
@@ -165,48 +254,26 @@ struct NestedTensorFunction_addmm
       const Tensor& input,
       const Tensor& self,
       const Tensor& other,
-      c10::Scalar alpha,
-      c10::Scalar beta) {
+      c10::Scalar beta,
+      c10::Scalar alpha) {
     TORCH_CHECK(!is_nested_tensor_impl(input), "input must be Tensor");
     TORCH_CHECK(is_nested_tensor_impl(self), "self must be NestedTensor");
     TORCH_CHECK(!is_nested_tensor_impl(other), "other must be Tensor");
-    // TORCH_CHECK(alpha == 1, "alpha must be 1.");
-    // TORCH_CHECK(beta == 1, "beta must be 1.");
     auto impl_self = get_nested_tensor_impl(self);
-    auto structure_self = get_nested_tensor_structure(self);
     ctx->save_for_backward({input, self, other});
-    ctx->saved_data["3"] = alpha;
-    ctx->saved_data["4"] = beta;
-    if (structure_self.buffer()) {
-      if (self.dim() == 3 && other.dim() == 2 && impl_self->opt_sizes()[0] &&
-          impl_self->opt_sizes()[2] &&
-          impl_self->opt_sizes()[self.dim() - 1] ==
-              other.size(self.dim() - 2)) {
-#ifdef TRACEPACKED
-        std::cout << "calling packed T x NT x T addmm" << std::endl;
-#endif
-        SizeNode new_nested_size = map(
-            [&](c10::List<int64_t> self_size) {
-              c10::List<int64_t> new_size{self_size[0], other.size(1)};
-              return std::move(new_size);
-            },
-            impl_self->nested_size());
-        return wrap_tensor_node(torch::nested_tensor::impl::build_structure(
-            at::addmm(
-                input,
-                (*structure_self.buffer()).reshape({-1, other.size(0)}),
-                other,
-                alpha,
-                beta)
-                .reshape(-1),
-            new_nested_size));
-      }
-    }
-    return map_nested_tensor(
-        [&](Tensor tensor) {
-          return at::addmm(input, tensor, other, alpha, beta);
+    ctx->saved_data["3"] = beta;
+    ctx->saved_data["4"] = alpha;
+    trace_packed("T x NT x T addmm");
+    SizeNode new_nested_size = map(
+        [&](c10::List<int64_t> self_size) {
+          c10::List<int64_t> new_size{self_size[0], other.size(1)};
+          return std::move(new_size);
         },
-        self);
+        impl_self->nested_size());
+    return wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+        at::addmm(input, _stack_rows(self, other.size(0)), other, beta, alpha)
+            .reshape(-1),
+        new_nested_size));
   }
   static torch::autograd::variable_list backward(
       torch::autograd::AutogradContext* ctx,
@@ -222,18 +289,20 @@ struct NestedTensorFunction_addmm
     auto input = saved_data[0];
     auto self = saved_data[1];
     auto other = saved_data[2];
-    auto alpha = ctx->saved_data["3"].toScalar();
-    auto beta = ctx->saved_data["4"].toScalar();
-    auto grad_other_nt = at::mul(at::matmul(self.transpose(1, 2), grad), alpha);
-    auto grad_other = torch::zeros_like(other);
-    apply_nested_tensor(
-        [&grad_other](at::Tensor& t) { grad_other.add_(t); }, grad_other_nt);
+    auto beta = ctx->saved_data["3"].toScalar();
+    auto alpha = ctx->saved_data["4"].toScalar();
+    at::Tensor grad_rows = _stack_rows(grad, other.size(1));
+    // input is broadcast against all rows of all constituents.
+    at::Tensor grad_input =
+        maybe_multiply(at::sum_to(grad_rows, input.sizes()), beta);
+    at::Tensor grad_self = maybe_multiply(
+        at::matmul(grad, other.transpose(0, 1)), alpha);
+    at::Tensor grad_other = maybe_multiply(
+        at::matmul(
+            _stack_rows(self, other.size(0)).transpose(0, 1), grad_rows),
+        alpha);
     at::Tensor undef;
-    return {at::mul(input, beta),
-            mm_mat1_backward(grad, other, alpha),
-            grad_other,
-            undef,
-            undef};
+    return {grad_input, grad_self, grad_other, undef, undef};
   }
 };
 
@@ -241,19 +310,24 @@ Tensor NestedTensor_addmm(
     const Tensor& input,
     const Tensor& self,
     const Tensor& other,
-    c10::Scalar alpha,
-    c10::Scalar beta) {
-#ifdef USEPACKED
-  return NestedTensorFunction_addmm::apply(input, self, other, alpha, beta);
-#else
+    c10::Scalar beta,
+    c10::Scalar alpha) {
+  at::Tensor packed_self = self;
+  if (get_packed_mode() == PackedMode::Always) {
+    packed_self = pack_nested_tensor(self);
+  }
+  if (!is_nested_tensor_impl(input) &&
+      _packed_matmul_applies(packed_self, other)) {
+    return NestedTensorFunction_addmm::apply(
+        input, packed_self, other, beta, alpha);
+  }
   return autograd_map_nested_tensor(
-      [&alpha, &beta](at::Tensor input, at::Tensor self, at::Tensor other) {
-        return at::addmm(input, self, other, alpha, beta);
+      [&beta, &alpha](at::Tensor input, at::Tensor self, at::Tensor other) {
+        return at::addmm(input, self, other, beta, alpha);
       },
       input,
       self,
       other);
-#endif
 }
 
 TORCH_LIBRARY_IMPL(aten, AutogradPrivateUse1, m) {
@@ -1,4 +1,8 @@
+#include <ATen/AccumulateType.h>
+#include <ATen/Dispatch.h>
+#include <ATen/Parallel.h>
 #include <nestedtensor/csrc/creation.h>
+#include <nestedtensor/csrc/mha.h>
 #include <nestedtensor/csrc/nested_tensor_impl.h>
 #include <nestedtensor/csrc/python_functions.h>
 #include <nestedtensor/csrc/utils/nested_node_functions.h>
@@ -15,6 +19,951 @@ using namespace at;
 namespace torch {
 namespace nested_tensor {
 
+namespace impl {
+
+// NOTE: Ragged attention
+//
+// Query, key and value are the rows of Tensors of shape (T, E), such as the
+// buffers of packed NestedTensors of shape (N, L_i, E). Row l of sequence i
+// starts at (rows[i] + l) * stride, where rows are the prefix sums of the
+// sequence lengths and stride is E unless the rows are column slices of a
+// wider Tensor. Head h of a row is the slice [h * D, (h + 1) * D) with
+// D = E / num_heads. The attention of each (sequence, head) pair is computed
+// by a separate task. Queries are processed in blocks of attention_block_q
+// rows against blocks of attention_block_k keys. The scores of a pair of
+// blocks and their product with the values are GEMMs on views of the rows.
+// An online softmax keeps the running maximum and sum of each query row, so
+// the [L_i, S_i] score matrix is never materialized. The logsumexp of each
+// row is kept for the backward, which recomputes the scores block by block.
+//
+// Masks are applied to the scores as they are computed. A causal mask limits
+// query l of a sequence to its keys [0, l], and key blocks past the last
+// query of a block are skipped entirely. If causal_align_end is set the mask
+// is aligned to the last key instead, so that query l of sequence i attends
+// to its keys [0, S_i - L_i + l]. This is the case for the queries of the
+// newest L_i positions of a sequence in a RaggedKVCache. An additive bias
+// holds the [L_i, S_i] entries of sequence i at bias_offsets[i], the prefix
+// sums of L_i * S_i, and is shared by all heads. A key padding mask holds one
+// flag per key row, which excludes that key from the attention of all queries
+// of its sequence. Rows that attend to no key are zero.
+//
+// The keys and values of sequence i don't need to follow those of sequence
+// i - 1. They start at row kv_starts[i] of k and v, which defaults to
+// kv_rows[i]. This lets the kernels read a RaggedKVCache, which leaves slack
+// between sequences, in place. The bias and key padding mask are always laid
+// out by kv_rows.
+constexpr int64_t attention_block_q = 32;
+constexpr int64_t attention_block_k = 64;
+
+struct RaggedAttentionLayout {
+  int64_t num_heads;
+  int64_t embed_dim;
+  int64_t value_dim;
+  int64_t q_stride;
+  int64_t k_stride;
+  int64_t v_stride;
+  bool causal;
+  bool causal_align_end;
+  std::vector<int64_t> q_rows;
+  std::vector<int64_t> kv_rows;
+  std::vector<int64_t> kv_starts;
+  std::vector<int64_t> bias_offsets;
+};
+
+std::vector<int64_t> _row_offsets(const at::Tensor& nt) {
+  const FlatSizeNode& nested_size =
+      get_nested_tensor_impl(nt)->flat_nested_size();
+  std::vector<int64_t> rows{0};
+  for (int64_t i = 0; i < nested_size.num_leaves(); i++) {
+    rows.push_back(rows.back() + nested_size.leaf(i)[0]);
+  }
+  return rows;
+}
+
+// q, k and v are Tensors of shape (T, E) whose rows may be strided, such as
+// column slices of a larger Tensor. If kv_starts is empty the keys and values
+// of the sequences are adjacent.
+RaggedAttentionLayout _ragged_attention_layout(
+    const at::Tensor& q,
+    const at::Tensor& k,
+    const at::Tensor& v,
+    std::vector<int64_t> q_rows,
+    std::vector<int64_t> kv_rows,
+    int64_t num_heads,
+    bool causal,
+    std::vector<int64_t> kv_starts = {}) {
+  for (const auto& t : {q, k, v}) {
+    TORCH_CHECK(
+        t.dim() == 2 && t.stride(1) == 1,
+        "ragged_attention expects rows of contiguous entries.");
+    TORCH_CHECK(
+        t.size(1) % num_heads == 0,
+        "The embedding dimension must be divisible by num_heads.");
+  }
+  TORCH_CHECK(
+      q.size(1) == k.size(1),
+      "query and key must have the same embedding dimension.");
+  TORCH_CHECK(
+      q_rows.size() == kv_rows.size() && q.size(0) == q_rows.back(),
+      "query doesn't match the given row offsets.");
+  if (kv_starts.empty()) {
+    kv_starts.assign(kv_rows.begin(), kv_rows.end() - 1);
+    TORCH_CHECK(
+        k.size(0) == kv_rows.back() && v.size(0) == kv_rows.back(),
+        "key and value don't match the given row offsets.");
+  }
+  TORCH_CHECK(
+      kv_starts.size() + 1 == kv_rows.size(),
+      "Expected one start row per sequence.");
+  for (size_t i = 0; i < kv_starts.size(); i++) {
+    const int64_t kv_end = kv_starts[i] + kv_rows[i + 1] - kv_rows[i];
+    TORCH_CHECK(
+        kv_starts[i] >= 0 && kv_end <= k.size(0) && kv_end <= v.size(0),
+        "The keys and values of sequence ",
+        i,
+        " are out of bounds.");
+  }
+  std::vector<int64_t> bias_offsets{0};
+  for (size_t i = 0; i + 1 < q_rows.size(); i++) {
+    bias_offsets.push_back(
+        bias_offsets.back() +
+        (q_rows[i + 1] - q_rows[i]) * (kv_rows[i + 1] - kv_rows[i]));
+  }
+  return RaggedAttentionLayout{num_heads,
+                               q.size(1),
+                               v.size(1),
+                               q.stride(0),
+                               k.stride(0),
+                               v.stride(0),
+                               causal,
+                               false,
+                               std::move(q_rows),
+                               std::move(kv_rows),
+                               std::move(kv_starts),
+                               std::move(bias_offsets)};
+}
+
+RaggedAttentionLayout _ragged_attention_layout(
+    const at::Tensor& q,
+    const at::Tensor& k,
+    const at::Tensor& v,
+    int64_t num_heads,
+    bool causal) {
+  for (const auto& t : {q, k, v}) {
+    TORCH_CHECK(
+        is_nested_tensor_impl(t) &&
+            get_nested_tensor_impl(t)->nested_dim() == 1 && t.dim() == 3,
+        "ragged_attention expects NestedTensors of shape (N, L_i, E).");
+    TORCH_CHECK(
+        get_nested_tensor_impl(t)->opt_sizes()[2],
+        "ragged_attention requires a regular embedding dimension.");
+  }
+  TORCH_CHECK(
+      q.size(0) == k.size(0) && k.size(0) == v.size(0),
+      "query, key and value must have the same number of sequences.");
+  std::vector<int64_t> kv_rows = _row_offsets(k);
+  TORCH_CHECK(
+      kv_rows == _row_offsets(v), "key and value must have the same lengths.");
+  return _ragged_attention_layout(
+      get_buffer(q).view({-1, q.size(2)}),
+      get_buffer(k).view({-1, k.size(2)}),
+      get_buffer(v).view({-1, v.size(2)}),
+      _row_offsets(q),
+      std::move(kv_rows),
+      num_heads,
+      causal);
+}
+
+// Adds the bias of key c to the scaled score of a query row and excludes
+// padded keys.
+template <typename acc_t, typename scalar_t>
+inline acc_t _attention_score(
+    acc_t score,
+    const scalar_t* bias_r,
+    const bool* key_mask_i,
+    int64_t c) {
+  if (key_mask_i && key_mask_i[c]) {
+    return -std::numeric_limits<acc_t>::infinity();
+  }
+  return bias_r ? score + bias_r[c] : score;
+}
+
+// Computes out and lse for the rows of q, k and v, which are Tensors of shape
+// (T, E) laid out as described by a. The scores of a block of queries against
+// a block of keys and their product with the values are computed with
+// at::mm on views of q, k and v. The online softmax between the two runs
+// over the small [attention_block_q, attention_block_k] tile of scores.
+template <typename scalar_t>
+void ragged_attention_kernel(
+    const RaggedAttentionLayout& a,
+    const at::Tensor& q,
+    const at::Tensor& k,
+    const at::Tensor& v,
+    const scalar_t* bias,
+    const bool* key_mask,
+    scalar_t* out,
+    scalar_t* lse,
+    double scaling) {
+  using acc_t = at::acc_type<scalar_t, false>;
+  const int64_t H = a.num_heads;
+  const int64_t Ev = a.value_dim;
+  const int64_t D = a.embed_dim / H;
+  const int64_t Dv = Ev / H;
+  const int64_t num_sequences = a.q_rows.size() - 1;
+  const acc_t neg_inf = -std::numeric_limits<acc_t>::infinity();
+  at::parallel_for(0, num_sequences * H, 1, [&](int64_t begin, int64_t end) {
+    at::NoGradGuard no_grad;
+    at::Tensor scores =
+        at::empty({attention_block_q, attention_block_k}, q.options());
+    at::Tensor acc = at::empty({attention_block_q, Dv}, q.options());
+    scalar_t* s_data = scores.data_ptr<scalar_t>();
+    scalar_t* acc_data = acc.data_ptr<scalar_t>();
+    std::vector<acc_t> max(attention_block_q);
+    std::vector<acc_t> sum(attention_block_q);
+    for (int64_t p = begin; p < end; p++) {
+      const int64_t i = p / H;
+      const int64_t h = p % H;
+      const int64_t q_len = a.q_rows[i + 1] - a.q_rows[i];
+      const int64_t kv_len = a.kv_rows[i + 1] - a.kv_rows[i];
+      const at::Tensor q_i =
+          q.narrow(0, a.q_rows[i], q_len).narrow(1, h * D, D);
+      const at::Tensor k_i =
+          k.narrow(0, a.kv_starts[i], kv_len).narrow(1, h * D, D);
+      const at::Tensor v_i =
+          v.narrow(0, a.kv_starts[i], kv_len).narrow(1, h * Dv, Dv);
+      const bool* key_mask_i = key_mask ? key_mask + a.kv_rows[i] : nullptr;
+      const int64_t shift = a.causal_align_end ? kv_len - q_len : 0;
+      for (int64_t q0 = 0; q0 < q_len; q0 += attention_block_q) {
+        const int64_t nq = std::min(attention_block_q, q_len - q0);
+        const at::Tensor q_block = q_i.narrow(0, q0, nq);
+        at::Tensor acc_block = acc.narrow(0, 0, nq);
+        acc_block.zero_();
+        std::fill(max.begin(), max.end(), neg_inf);
+        std::fill(sum.begin(), sum.end(), 0);
+        const int64_t kv_end =
+            a.causal ? std::min(kv_len, q0 + nq + shift) : kv_len;
+        for (int64_t k0 = 0; k0 < kv_end; k0 += attention_block_k) {
+          const int64_t nk = std::min(attention_block_k, kv_end - k0);
+          at::Tensor s_block = scores.narrow(0, 0, nq).narrow(1, 0, nk);
+          at::mm_out(s_block, q_block, k_i.narrow(0, k0, nk).t());
+          // Turns each row of scores into the weights of its keys relative to
+          // the running maximum and rescales the accumulated output.
+          for (int64_t r = 0; r < nq; r++) {
+            const scalar_t* bias_r = bias
+                ? bias + a.bias_offsets[i] + (q0 + r) * kv_len + k0
+                : nullptr;
+            const int64_t nk_r = a.causal
+                ? std::max(std::min(nk, q0 + r + 1 + shift - k0), (int64_t)0)
+                : nk;
+            scalar_t* s_r = s_data + r * attention_block_k;
+            acc_t block_max = max[r];
+            for (int64_t c = 0; c < nk_r; c++) {
+              const acc_t score = _attention_score<acc_t>(
+                  s_r[c] * scaling, bias_r, key_mask_i, k0 + c);
+              s_r[c] = score;
+              block_max = score > block_max ? score : block_max;
+            }
+            if (block_max == neg_inf) {
+              std::fill(s_r, s_r + nk, 0);
+              continue;
+            }
+            const acc_t correction = std::exp(max[r] - block_max);
+            scalar_t* acc_r = acc_data + r * Dv;
+            sum[r] *= correction;
+            for (int64_t d = 0; d < Dv; d++) {
+              acc_r[d] *= correction;
+            }
+            for (int64_t c = 0; c < nk_r; c++) {
+              const acc_t weight = std::exp(s_r[c] - block_max);
+              sum[r] += weight;
+              s_r[c] = weight;
+            }
+            std::fill(s_r + nk_r, s_r + nk, 0);
+            max[r] = block_max;
+          }
+          acc_block.addmm_(s_block, v_i.narrow(0, k0, nk));
+        }
+        for (int64_t r = 0; r < nq; r++) {
+          const int64_t row = a.q_rows[i] + q0 + r;
+          const scalar_t* acc_r = acc_data + r * Dv;
+          scalar_t* out_r = out + row * Ev + h * Dv;
+          // Rows without any key attend to nothing and are zero.
+          const acc_t scale = sum[r] > 0 ? 1 / sum[r] : 0;
+          for (int64_t d = 0; d < Dv; d++) {
+            out_r[d] = acc_r[d] * scale;
+          }
+          lse[row * H + h] = sum[r] > 0 ? max[r] + std::log(sum[r]) : neg_inf;
+        }
+      }
+    }
+  });
+}
+
+// Recomputes the attention weights of each block of queries and keys from the
+// saved logsumexp and accumulates the gradients of query, key and value with
+// at::mm on views, just like the forward. Each (sequence, head) pair only
+// writes to its own slices, so tasks don't need to synchronize. Unlike the
+// inputs the gradients are contiguous.
+template <typename scalar_t>
+void ragged_attention_backward_kernel(
+    const RaggedAttentionLayout& a,
+    const at::Tensor& q,
+    const at::Tensor& k,
+    const at::Tensor& v,
+    const scalar_t* bias,
+    const bool* key_mask,
+    const at::Tensor& out,
+    const scalar_t* lse,
+    const at::Tensor& grad,
+    at::Tensor& grad_q,
+    at::Tensor& grad_k,
+    at::Tensor& grad_v,
+    double scaling) {
+  using acc_t = at::acc_type<scalar_t, false>;
+  const int64_t H = a.num_heads;
+  const int64_t D = a.embed_dim / H;
+  const int64_t Dv = a.value_dim / H;
+  const int64_t num_sequences = a.q_rows.size() - 1;
+  const acc_t neg_inf = -std::numeric_limits<acc_t>::infinity();
+  const scalar_t* out_data = out.data_ptr<scalar_t>();
+  const scalar_t* grad_data = grad.data_ptr<scalar_t>();
+  at::parallel_for(0, num_sequences * H, 1, [&](int64_t begin, int64_t end) {
+    at::NoGradGuard no_grad;
+    at::Tensor weights =
+        at::empty({attention_block_q, attention_block_k}, q.options());
+    at::Tensor grad_scores =
+        at::empty({attention_block_q, attention_block_k}, q.options());
+    scalar_t* w_data = weights.data_ptr<scalar_t>();
+    scalar_t* gs_data = grad_scores.data_ptr<scalar_t>();
+    std::vector<acc_t> grad_dot_out(attention_block_q);
+    for (int64_t p = begin; p < end; p++) {
+      const int64_t i = p / H;
+      const int64_t h = p % H;
+      const int64_t q_len = a.q_rows[i + 1] - a.q_rows[i];
+      const int64_t kv_len = a.kv_rows[i + 1] - a.kv_rows[i];
+      const at::Tensor q_i =
+          q.narrow(0, a.q_rows[i], q_len).narrow(1, h * D, D);
+      const at::Tensor k_i =
+          k.narrow(0, a.kv_starts[i], kv_len).narrow(1, h * D, D);
+      const at::Tensor v_i =
+          v.narrow(0, a.kv_starts[i], kv_len).narrow(1, h * Dv, Dv);
+      const at::Tensor grad_i =
+          grad.narrow(0, a.q_rows[i], q_len).narrow(1, h * Dv, Dv);
+      at::Tensor grad_q_i =
+          grad_q.narrow(0, a.q_rows[i], q_len).narrow(1, h * D, D);
+      at::Tensor grad_k_i =
+          grad_k.narrow(0, a.kv_starts[i], kv_len).narrow(1, h * D, D);
+      at::Tensor grad_v_i =
+          grad_v.narrow(0, a.kv_starts[i], kv_len).narrow(1, h * Dv, Dv);
+      const bool* key_mask_i = key_mask ? key_mask + a.kv_rows[i] : nullptr;
+      const int64_t shift = a.causal_align_end ? kv_len - q_len : 0;
+      for (int64_t q0 = 0; q0 < q_len; q0 += attention_block_q) {
+        const int64_t nq = std::min(attention_block_q, q_len - q0);
+        const at::Tensor q_block = q_i.narrow(0, q0, nq);
+        const at::Tensor grad_block = grad_i.narrow(0, q0, nq);
+        at::Tensor grad_q_block = grad_q_i.narrow(0, q0, nq);
+        for (int64_t r = 0; r < nq; r++) {
+          const int64_t row = a.q_rows[i] + q0 + r;
+          const scalar_t* out_r = out_data + row * a.value_dim + h * Dv;
+          const scalar_t* grad_r = grad_data + row * a.value_dim + h * Dv;
+          acc_t dot = 0;
+          for (int64_t d = 0; d < Dv; d++) {
+            dot += static_cast<acc_t>(grad_r[d]) * out_r[d];
+          }
+          grad_dot_out[r] = dot;
+        }
+        const int64_t kv_end =
+            a.causal ? std::min(kv_len, q0 + nq + shift) : kv_len;
+        for (int64_t k0 = 0; k0 < kv_end; k0 += attention_block_k) {
+          const int64_t nk = std::min(attention_block_k, kv_end - k0);
+          const at::Tensor k_block = k_i.narrow(0, k0, nk);
+          const at::Tensor v_block = v_i.narrow(0, k0, nk);
+          at::Tensor w_block = weights.narrow(0, 0, nq).narrow(1, 0, nk);
+          at::Tensor gs_block = grad_scores.narrow(0, 0, nq).narrow(1, 0, nk);
+          at::mm_out(w_block, q_block, k_block.t());
+          at::mm_out(gs_block, grad_block, v_block.t());
+          // Replaces the scores by the attention weights and the gradient of
+          // the weights by the gradient of the scores.
+          for (int64_t r = 0; r < nq; r++) {
+            const int64_t row = a.q_rows[i] + q0 + r;
+            const acc_t row_lse = lse[row * H + h];
+            const scalar_t* bias_r = bias
+                ? bias + a.bias_offsets[i] + (q0 + r) * kv_len + k0
+                : nullptr;
+            const int64_t nk_r = row_lse == neg_inf
+                ? 0
+                : a.causal
+                ? std::max(std::min(nk, q0 + r + 1 + shift - k0), (int64_t)0)
+                : nk;
+            scalar_t* w_r = w_data + r * attention_block_k;
+            scalar_t* gs_r = gs_data + r * attention_block_k;
+            for (int64_t c = 0; c < nk_r; c++) {
+              const acc_t score = _attention_score<acc_t>(
+                  w_r[c] * scaling, bias_r, key_mask_i, k0 + c);
+              const acc_t weight =
+                  score == neg_inf ? 0 : std::exp(score - row_lse);
+              w_r[c] = weight;
+              gs_r[c] = weight * (gs_r[c] - grad_dot_out[r]) * scaling;
+            }
+            std::fill(w_r + nk_r, w_r + nk, 0);
+            std::fill(gs_r + nk_r, gs_r + nk, 0);
+          }
+          grad_v_i.narrow(0, k0, nk).addmm_(w_block.t(), grad_block);
+          grad_q_block.addmm_(gs_block, k_block);
+          grad_k_i.narrow(0, k0, nk).addmm_(gs_block.t(), q_block);
+        }
+      }
+    }
+  });
+}
+
+// Returns the entries of attn_mask that apply to each sequence as an
+// additive bias laid out by bias_offsets. attn_mask is either a NestedTensor
+// of shape (N, L_i, S_i) or a Tensor of shape (L, S) whose leading [L_i, S_i]
+// block applies to sequence i. Entries of boolean masks that are true are
+// excluded.
+at::Tensor _attention_bias(
+    const at::Tensor& attn_mask,
+    const std::vector<int64_t>& q_rows,
+    const std::vector<int64_t>& kv_rows,
+    const at::TensorOptions& options) {
+  TORCH_CHECK(
+      !attn_mask.requires_grad(),
+      "ragged_attention doesn't support gradients of attn_mask.");
+  const int64_t num_sequences = q_rows.size() - 1;
+  at::Tensor mask;
+  if (is_nested_tensor_impl(attn_mask)) {
+    TORCH_CHECK(
+        get_nested_tensor_impl(attn_mask)->nested_dim() == 1 &&
+            attn_mask.dim() == 3,
+        "attn_mask must be a NestedTensor of shape (N, L_i, S_i).");
+    const FlatSizeNode& nested_size =
+        get_nested_tensor_impl(attn_mask)->flat_nested_size();
+    TORCH_CHECK(
+        nested_size.num_leaves() == num_sequences,
+        "attn_mask must have one entry per sequence.");
+    for (int64_t i = 0; i < num_sequences; i++) {
+      TORCH_CHECK(
+          nested_size.leaf(i)[0] == q_rows[i + 1] - q_rows[i] &&
+              nested_size.leaf(i)[1] == kv_rows[i + 1] - kv_rows[i],
+          "attn_mask entry ",
+          i,
+          " doesn't match the lengths of query and key.");
+    }
+    mask = get_buffer(pack_nested_tensor(attn_mask));
+  } else {
+    TORCH_CHECK(attn_mask.dim() == 2, "attn_mask must be of shape (L, S).");
+    std::vector<at::Tensor> blocks;
+    for (int64_t i = 0; i < num_sequences; i++) {
+      const int64_t q_len = q_rows[i + 1] - q_rows[i];
+      const int64_t kv_len = kv_rows[i + 1] - kv_rows[i];
+      TORCH_CHECK(
+          q_len <= attn_mask.size(0) && kv_len <= attn_mask.size(1),
+          "attn_mask is smaller than sequence ",
+          i);
+      blocks.push_back(
+          attn_mask.narrow(0, 0, q_len).narrow(1, 0, kv_len).reshape({-1}));
+    }
+    mask = at::cat(blocks);
+  }
+  if (mask.scalar_type() == at::kBool) {
+    return at::zeros(mask.sizes(), options)
+        .masked_fill_(mask, -std::numeric_limits<double>::infinity());
+  }
+  return mask.to(options.dtype()).contiguous();
+}
+
+// Returns one flag per key row, which is true for keys to exclude.
+// key_padding_mask is either a NestedTensor of shape (N, S_i) or a Tensor of
+// shape (N, S) whose leading S_i entries of row i apply to sequence i.
+at::Tensor _key_padding_mask(
+    const at::Tensor& key_padding_mask,
+    const std::vector<int64_t>& kv_rows) {
+  TORCH_CHECK(
+      key_padding_mask.scalar_type() == at::kBool,
+      "key_padding_mask must be a boolean mask.");
+  const int64_t num_sequences = kv_rows.size() - 1;
+  if (is_nested_tensor_impl(key_padding_mask)) {
+    TORCH_CHECK(
+        get_nested_tensor_impl(key_padding_mask)->nested_dim() == 1 &&
+            key_padding_mask.dim() == 2 &&
+            _row_offsets(key_padding_mask) == kv_rows,
+        "key_padding_mask must be a NestedTensor of shape (N, S_i).");
+    return get_buffer(pack_nested_tensor(key_padding_mask));
+  }
+  TORCH_CHECK(
+      key_padding_mask.dim() == 2 &&
+          key_padding_mask.size(0) == num_sequences,
+      "key_padding_mask must be of shape (N, S).");
+  std::vector<at::Tensor> rows;
+  for (int64_t i = 0; i < num_sequences; i++) {
+    const int64_t kv_len = kv_rows[i + 1] - kv_rows[i];
+    TORCH_CHECK(
+        kv_len <= key_padding_mask.size(1),
+        "key_padding_mask is shorter than sequence ",
+        i);
+    rows.push_back(key_padding_mask[i].narrow(0, 0, kv_len));
+  }
+  return at::cat(rows);
+}
+
+// Converts the optional masks of ragged_attention and min_mha into the
+// additive bias and key flags read by the kernels. Masks that are not given
+// are undefined.
+std::tuple<at::Tensor, at::Tensor> _attention_masks(
+    const c10::optional<at::Tensor>& attn_mask,
+    const c10::optional<at::Tensor>& key_padding_mask,
+    const std::vector<int64_t>& q_rows,
+    const std::vector<int64_t>& kv_rows,
+    const at::TensorOptions& options) {
+  at::Tensor bias, key_mask;
+  if (attn_mask && attn_mask->defined()) {
+    bias = _attention_bias(*attn_mask, q_rows, kv_rows, options);
+  }
+  if (key_padding_mask && key_padding_mask->defined()) {
+    key_mask = _key_padding_mask(*key_padding_mask, kv_rows);
+  }
+  return std::make_tuple(std::move(bias), std::move(key_mask));
+}
+
+// Returns the output of shape (q_rows.back(), value_dim) and the logsumexp
+// of shape (q_rows.back(), num_heads).
+std::tuple<at::Tensor, at::Tensor> _ragged_attention_forward(
+    const RaggedAttentionLayout& a,
+    const at::Tensor& q,
+    const at::Tensor& k,
+    const at::Tensor& v,
+    const at::Tensor& bias,
+    const at::Tensor& key_mask,
+    double scaling) {
+  TORCH_CHECK(
+      !bias.defined() || bias.numel() == a.bias_offsets.back(),
+      "The attention bias doesn't match the lengths of query and key.");
+  TORCH_CHECK(
+      !key_mask.defined() || key_mask.numel() == a.kv_rows.back(),
+      "The key padding mask doesn't match the lengths of key.");
+  at::Tensor out = at::empty({a.q_rows.back(), a.value_dim}, q.options());
+  at::Tensor lse = at::empty({a.q_rows.back(), a.num_heads}, q.options());
+  AT_DISPATCH_FLOATING_TYPES(q.scalar_type(), "ragged_attention", [&] {
+    ragged_attention_kernel<scalar_t>(
+        a,
+        q,
+        k,
+        v,
+        bias.defined() ? bias.data_ptr<scalar_t>() : nullptr,
+        key_mask.defined() ? key_mask.data_ptr<bool>() : nullptr,
+        out.data_ptr<scalar_t>(),
+        lse.data_ptr<scalar_t>(),
+        scaling);
+  });
+  return std::make_tuple(std::move(out), std::move(lse));
+}
+
+std::tuple<at::Tensor, at::Tensor, at::Tensor> _ragged_attention_backward(
+    const RaggedAttentionLayout& a,
+    const at::Tensor& q,
+    const at::Tensor& k,
+    const at::Tensor& v,
+    const at::Tensor& bias,
+    const at::Tensor& key_mask,
+    const at::Tensor& out,
+    const at::Tensor& lse,
+    const at::Tensor& grad,
+    double scaling) {
+  at::Tensor grad_q = at::zeros({q.size(0), a.embed_dim}, q.options());
+  at::Tensor grad_k = at::zeros({k.size(0), a.embed_dim}, k.options());
+  at::Tensor grad_v = at::zeros({v.size(0), a.value_dim}, v.options());
+  at::Tensor out_rows = out.contiguous().view({-1, a.value_dim});
+  at::Tensor grad_rows = grad.contiguous().view({-1, a.value_dim});
+  AT_DISPATCH_FLOATING_TYPES(
+      q.scalar_type(), "ragged_attention_backward", [&] {
+        ragged_attention_backward_kernel<scalar_t>(
+            a,
+            q,
+            k,
+            v,
+            bias.defined() ? bias.data_ptr<scalar_t>() : nullptr,
+            key_mask.defined() ? key_mask.data_ptr<bool>() : nullptr,
+            out_rows,
+            lse.data_ptr<scalar_t>(),
+            grad_rows,
+            grad_q,
+            grad_k,
+            grad_v,
+            scaling);
+      });
+  return std::make_tuple(
+      std::move(grad_q), std::move(grad_k), std::move(grad_v));
+}
+
+at::Tensor _wrap_rows(
+    at::Tensor buffer,
+    const at::Tensor& like,
+    int64_t embed_dim) {
+  if (like.size(2) == embed_dim) {
+    return wrap_tensor_node(impl::build_structure(
+        std::move(buffer), get_nested_tensor_impl(like)->flat_nested_size()));
+  }
+  const FlatSizeNode& nested_size =
+      get_nested_tensor_impl(like)->flat_nested_size();
+  std::vector<int64_t> leaf_offsets{0};
+  std::vector<int64_t> values;
+  for (int64_t i = 0; i < nested_size.num_leaves(); i++) {
+    values.push_back(nested_size.leaf(i)[0]);
+    values.push_back(embed_dim);
+    leaf_offsets.push_back(values.size());
+  }
+  return wrap_tensor_node(impl::build_structure(
+      std::move(buffer),
+      FlatSizeNode(
+          nested_size.structure(),
+          std::move(leaf_offsets),
+          std::move(values))));
+}
+
+// Attention of a single sequence q of shape (L, E) over k and v of shape
+// (S, E) and (S, Ev) with at::matmul. bias is an additive mask of shape
+// (L, S) or undefined. Queries for which bias excludes all keys are zero,
+// just like in ragged_attention_kernel.
+at::Tensor _sequence_attention(
+    const at::Tensor& q,
+    const at::Tensor& k,
+    const at::Tensor& v,
+    const at::Tensor& bias,
+    int64_t num_heads,
+    double scaling) {
+  at::Tensor q_h = q.reshape({q.size(0), num_heads, -1}).transpose(0, 1);
+  at::Tensor k_h = k.reshape({k.size(0), num_heads, -1}).transpose(0, 1);
+  at::Tensor v_h = v.reshape({v.size(0), num_heads, -1}).transpose(0, 1);
+  at::Tensor scores = at::matmul(q_h, k_h.transpose(1, 2)) * scaling;
+  at::Tensor empty_rows;
+  if (bias.defined()) {
+    empty_rows =
+        (bias == -std::numeric_limits<double>::infinity()).all(1, true);
+    scores = scores + bias.masked_fill(empty_rows, 0);
+  }
+  at::Tensor weights = at::softmax(scores, -1);
+  if (bias.defined()) {
+    weights = weights.masked_fill(empty_rows, 0);
+  }
+  return at::matmul(weights, v_h).transpose(0, 1).reshape({q.size(0), -1});
+}
+
+// Returns true if the ragged attention kernel applies to q, k and v, which
+// requires float or double CPU tensors and a packed mode other than Never.
+bool _ragged_attention_kernel_applies(
+    const at::Tensor& q,
+    const at::Tensor& k,
+    const at::Tensor& v) {
+  at::ScalarType dtype = q.scalar_type();
+  return get_packed_mode() != PackedMode::Never &&
+      (dtype == at::kFloat || dtype == at::kDouble) &&
+      k.scalar_type() == dtype && v.scalar_type() == dtype &&
+      q.device().is_cpu() && k.device().is_cpu() && v.device().is_cpu();
+}
+
+// ragged_attention as a map of _sequence_attention over the constituents.
+// The masks are combined into one additive bias per sequence.
+at::Tensor _ragged_attention_per_constituent(
+    const at::Tensor& q,
+    const at::Tensor& k,
+    const at::Tensor& v,
+    int64_t num_heads,
+    double scaling,
+    const c10::optional<at::Tensor>& attn_mask,
+    const c10::optional<at::Tensor>& key_padding_mask,
+    bool is_causal) {
+  std::vector<int64_t> q_rows = _row_offsets(q);
+  std::vector<int64_t> kv_rows = _row_offsets(k);
+  at::Tensor bias, key_mask;
+  std::tie(bias, key_mask) = _attention_masks(
+      attn_mask, key_padding_mask, q_rows, kv_rows, q.options());
+  if (!bias.defined() && !key_mask.defined() && !is_causal) {
+    return autograd_map_nested_tensor(
+        [num_heads, scaling](at::Tensor q, at::Tensor k, at::Tensor v) {
+          return _sequence_attention(q, k, v, at::Tensor(), num_heads, scaling);
+        },
+        q,
+        k,
+        v);
+  }
+  const double neg_inf = -std::numeric_limits<double>::infinity();
+  std::vector<TensorNode> biases;
+  int64_t offset = 0;
+  for (size_t i = 0; i + 1 < q_rows.size(); i++) {
+    const int64_t q_len = q_rows[i + 1] - q_rows[i];
+    const int64_t kv_len = kv_rows[i + 1] - kv_rows[i];
+    at::Tensor bias_i = bias.defined()
+        ? bias.narrow(0, offset, q_len * kv_len).view({q_len, kv_len})
+        : at::zeros({q_len, kv_len}, q.options());
+    offset += q_len * kv_len;
+    if (key_mask.defined()) {
+      bias_i = bias_i.masked_fill(
+          key_mask.narrow(0, kv_rows[i], kv_len).view({1, kv_len}), neg_inf);
+    }
+    if (is_causal) {
+      bias_i = bias_i.masked_fill(
+          at::ones({q_len, kv_len}, q.options().dtype(at::kBool)).triu(1),
+          neg_inf);
+    }
+    biases.push_back(TensorNode(std::move(bias_i)));
+  }
+  return autograd_map_nested_tensor(
+      [num_heads, scaling](
+          at::Tensor q, at::Tensor k, at::Tensor v, at::Tensor bias) {
+        return _sequence_attention(q, k, v, bias, num_heads, scaling);
+      },
+      q,
+      k,
+      v,
+      wrap_tensor_node(TensorNode(std::move(biases))));
+}
+
+} // namespace impl
+
+struct NestedTensorFunction_ragged_attention
+    : public torch::autograd::Function<NestedTensorFunction_ragged_attention> {
+  static at::Tensor forward(
+      torch::autograd::AutogradContext* ctx,
+      const at::Tensor& q,
+      const at::Tensor& k,
+      const at::Tensor& v,
+      const at::Tensor& bias,
+      const at::Tensor& key_mask,
+      int64_t num_heads,
+      double scaling,
+      bool causal) {
+    trace_packed("ragged_attention");
+    impl::RaggedAttentionLayout a =
+        impl::_ragged_attention_layout(q, k, v, num_heads, causal);
+    at::Tensor out, lse;
+    std::tie(out, lse) = impl::_ragged_attention_forward(
+        a,
+        get_buffer(q).view({-1, a.embed_dim}),
+        get_buffer(k).view({-1, a.embed_dim}),
+        get_buffer(v).view({-1, a.value_dim}),
+        bias,
+        key_mask,
+        scaling);
+    at::Tensor result = impl::_wrap_rows(out.view({-1}), q, a.value_dim);
+    ctx->save_for_backward({q, k, v, result, lse, bias, key_mask});
+    ctx->saved_data["0"] = num_heads;
+    ctx->saved_data["1"] = scaling;
+    ctx->saved_data["2"] = causal;
+    return result;
+  }
+  static torch::autograd::variable_list backward(
+      torch::autograd::AutogradContext* ctx,
+      torch::autograd::variable_list grad_output) {
+    TORCH_CHECK(grad_output.size() == 1, "Expected grad_output of size 1.");
+    TORCH_CHECK(
+        !grad_output[0].requires_grad(),
+        "ragged_attention doesn't support double backward.");
+    auto saved = ctx->get_saved_variables();
+    at::Tensor q = saved[0];
+    at::Tensor k = saved[1];
+    at::Tensor v = saved[2];
+    int64_t num_heads = ctx->saved_data["0"].toInt();
+    double scaling = ctx->saved_data["1"].toDouble();
+    bool causal = ctx->saved_data["2"].toBool();
+    impl::RaggedAttentionLayout a =
+        impl::_ragged_attention_layout(q, k, v, num_heads, causal);
+    at::Tensor grad_q, grad_k, grad_v;
+    std::tie(grad_q, grad_k, grad_v) = impl::_ragged_attention_backward(
+        a,
+        get_buffer(q).view({-1, a.embed_dim}),
+        get_buffer(k).view({-1, a.embed_dim}),
+        get_buffer(v).view({-1, a.value_dim}),
+        saved[5],
+        saved[6],
+        get_buffer(saved[3]),
+        saved[4],
+        get_buffer(pack_nested_tensor(grad_output[0])),
+        scaling);
+    at::Tensor undef;
+    return {impl::_wrap_rows(grad_q.view({-1}), q, a.embed_dim),
+            impl::_wrap_rows(grad_k.view({-1}), k, a.embed_dim),
+            impl::_wrap_rows(grad_v.view({-1}), v, a.value_dim),
+            undef,
+            undef,
+            undef,
+            undef,
+            undef};
+  }
+};
+
+// Ragged attention over the rows of the regular Tensors q, k and v of shape
+// (T, E), where the sequences are given by the row offsets q_rows and
+// kv_rows. The rows may be strided, so that q, k and v can be column slices
+// of a single projection. Gradients are returned as contiguous Tensors. bias
+// and key_mask are laid out as returned by _attention_masks.
+struct NestedTensorFunction_ragged_attention_rows
+    : public torch::autograd::Function<
+          NestedTensorFunction_ragged_attention_rows> {
+  static at::Tensor forward(
+      torch::autograd::AutogradContext* ctx,
+      const at::Tensor& q,
+      const at::Tensor& k,
+      const at::Tensor& v,
+      const at::Tensor& bias,
+      const at::Tensor& key_mask,
+      std::vector<int64_t> q_rows,
+      std::vector<int64_t> kv_rows,
+      int64_t num_heads,
+      double scaling,
+      bool causal) {
+    trace_packed("ragged_attention");
+    impl::RaggedAttentionLayout a = impl::_ragged_attention_layout(
+        q, k, v, q_rows, kv_rows, num_heads, causal);
+    at::Tensor out, lse;
+    std::tie(out, lse) =
+        impl::_ragged_attention_forward(a, q, k, v, bias, key_mask, scaling);
+    ctx->save_for_backward({q, k, v, out, lse, bias, key_mask});
+    ctx->saved_data["0"] = num_heads;
+    ctx->saved_data["1"] = scaling;
+    ctx->saved_data["2"] = q_rows;
+    ctx->saved_data["3"] = kv_rows;
+    ctx->saved_data["4"] = causal;
+    return out;
+  }
+  static torch::autograd::variable_list backward(
+      torch::autograd::AutogradContext* ctx,
+      torch::autograd::variable_list grad_output) {
+    TORCH_CHECK(grad_output.size() == 1, "Expected grad_output of size 1.");
+    TORCH_CHECK(
+        !grad_output[0].requires_grad(),
+        "ragged_attention doesn't support double backward.");
+    auto saved = ctx->get_saved_variables();
+    impl::RaggedAttentionLayout a = impl::_ragged_attention_layout(
+        saved[0],
+        saved[1],
+        saved[2],
+        ctx->saved_data["2"].toIntVector(),
+        ctx->saved_data["3"].toIntVector(),
+        ctx->saved_data["0"].toInt(),
+        ctx->saved_data["4"].toBool());
+    at::Tensor grad_q, grad_k, grad_v;
+    std::tie(grad_q, grad_k, grad_v) = impl::_ragged_attention_backward(
+        a,
+        saved[0],
+        saved[1],
+        saved[2],
+        saved[5],
+        saved[6],
+        saved[3],
+        saved[4],
+        grad_output[0].contiguous(),
+        ctx->saved_data["1"].toDouble());
+    at::Tensor undef;
+    return {grad_q,
+            grad_k,
+            grad_v,
+            undef,
+            undef,
+            undef,
+            undef,
+            undef,
+            undef,
+            undef};
+  }
+};
+
+// softmax(q k^T * scaling + attn_mask) v for each head of each sequence of
+// the NestedTensors q, k and v of shape (N, L_i, E) without materializing the
+// attention weights. Keys flagged by key_padding_mask are ignored and
+// is_causal limits each query to the keys up to its own position. If the
+// kernel doesn't apply (see _ragged_attention_kernel_applies) the attention
+// is computed for each constituent with at::matmul instead.
+at::Tensor ragged_attention(
+    at::Tensor q,
+    at::Tensor k,
+    at::Tensor v,
+    int64_t num_heads,
+    double scaling,
+    c10::optional<at::Tensor> attn_mask,
+    c10::optional<at::Tensor> key_padding_mask,
+    bool is_causal) {
+  if (!impl::_ragged_attention_kernel_applies(q, k, v)) {
+    return impl::_ragged_attention_per_constituent(
+        q, k, v, num_heads, scaling, attn_mask, key_padding_mask, is_causal);
+  }
+  at::Tensor bias, key_mask;
+  std::tie(bias, key_mask) = impl::_attention_masks(
+      attn_mask,
+      key_padding_mask,
+      impl::_row_offsets(q),
+      impl::_row_offsets(k),
+      q.options());
+  return NestedTensorFunction_ragged_attention::apply(
+      pack_nested_tensor(q),
+      pack_nested_tensor(k),
+      pack_nested_tensor(v),
+      bias,
+      key_mask,
+      num_heads,
+      scaling,
+      is_causal);
+}
+
+at::Tensor cached_ragged_attention(
+    const at::Tensor& query,
+    const at::Tensor& keys,
+    const at::Tensor& values,
+    const std::vector<int64_t>& kv_lengths,
+    const std::vector<int64_t>& kv_starts,
+    int64_t num_heads,
+    double scaling,
+    bool is_causal) {
+  TORCH_CHECK(
+      !(at::GradMode::is_enabled() && query.requires_grad()),
+      "Attention over a RaggedKVCache doesn't support autograd.");
+  TORCH_CHECK(
+      query.scalar_type() == keys.scalar_type(),
+      "query must be of the same type as the cached keys.");
+  TORCH_CHECK(
+      query.device().is_cpu() && keys.device().is_cpu() &&
+          values.device().is_cpu(),
+      "Attention over a RaggedKVCache only supports CPU tensors.");
+  std::vector<int64_t> kv_rows{0};
+  for (int64_t length : kv_lengths) {
+    kv_rows.push_back(kv_rows.back() + length);
+  }
+  bool nested = is_nested_tensor_impl(query);
+  at::Tensor q;
+  std::vector<int64_t> q_rows;
+  if (nested) {
+    TORCH_CHECK(
+        get_nested_tensor_impl(query)->nested_dim() == 1 &&
+            query.dim() == 3 && get_nested_tensor_impl(query)->opt_sizes()[2],
+        "query must be a NestedTensor of shape (N, L_i, E).");
+    q = get_buffer(pack_nested_tensor(query)).view({-1, query.size(2)});
+    q_rows = impl::_row_offsets(query);
+  } else {
+    TORCH_CHECK(query.dim() == 2, "query must be a Tensor of shape (N, E).");
+    q = query.contiguous();
+    for (int64_t i = 0; i <= query.size(0); i++) {
+      q_rows.push_back(i);
+    }
+  }
+  impl::RaggedAttentionLayout a = impl::_ragged_attention_layout(
+      q,
+      keys,
+      values,
+      std::move(q_rows),
+      std::move(kv_rows),
+      num_heads,
+      is_causal,
+      kv_starts);
+  a.causal_align_end = true;
+  at::Tensor undef, out, lse;
+  std::tie(out, lse) = impl::_ragged_attention_forward(
+      a, q, keys, values, undef, undef, scaling);
+  if (!nested) {
+    return out;
+  }
+  return impl::_wrap_rows(out.view({-1}), query, a.value_dim);
+}
+
 at::Tensor min_mha(
     int64_t num_heads,
     int64_t head_dim,
@@ -27,12 +976,69 @@ at::Tensor min_mha(
     c10::optional<at::Tensor> in_proj_bias,
     double scaling,
     at::Tensor out_proj_weight,
-    at::Tensor out_proj_bias) {
+    at::Tensor out_proj_bias,
+    c10::optional<at::Tensor> attn_mask,
+    c10::optional<at::Tensor> key_padding_mask,
+    bool is_causal) {
   TORCH_CHECK(query.dim() == 3, "query needs to be 3 dim.");
   TORCH_CHECK(key.dim() == 3, "key needs to be 3 dim.");
   TORCH_CHECK(value.dim() == 3, "value needs to be 3 dim.");
   TORCH_CHECK(in_proj_bias, "Input projection bias needs to be defined.");
   int64_t edim = query.size(2);
+  bool has_masks = (attn_mask && attn_mask->defined()) ||
+      (key_padding_mask && key_padding_mask->defined()) || is_causal;
+  TORCH_CHECK(
+      !has_masks || !training || dropout_p == 0,
+      "Attention masks aren't supported with dropout during training.");
+
+  // Self-attention projects the packed buffer of query viewed as (T, E) with
+  // a single GEMM against all of in_proj_weight, whose query rows absorb the
+  // scaling. The query, key and value column slices of the (T, 3E) result
+  // are read in place by the attention kernel, which only runs on the CPU.
+  bool use_kernel = impl::_ragged_attention_kernel_applies(query, key, value);
+  at::Tensor packed_query = get_packed_mode() == PackedMode::Always
+      ? pack_nested_tensor(query)
+      : query;
+  if (use_kernel && query.is_same(key) && key.is_same(value) &&
+      (!training || dropout_p == 0) && can_apply_to_buffers(packed_query)) {
+    trace_packed("qkv projection");
+    std::vector<int64_t> rows = impl::_row_offsets(packed_query);
+    at::Tensor scale = at::ones({3 * edim}, in_proj_weight.options());
+    scale.narrow(0, 0, edim).fill_(scaling);
+    at::Tensor attn_bias, key_mask;
+    std::tie(attn_bias, key_mask) = impl::_attention_masks(
+        attn_mask, key_padding_mask, rows, rows, query.options());
+    return autograd_map_packed_nested_tensor(
+        [edim, num_heads, rows, scale, attn_bias, key_mask, is_causal](
+            const at::Tensor buffer,
+            const at::Tensor weight,
+            const at::Tensor bias,
+            const at::Tensor out_weight,
+            const at::Tensor out_bias) {
+          at::Tensor qkv = at::addmm(
+              bias * scale,
+              buffer.view({-1, edim}),
+              (weight * scale.unsqueeze(1)).t());
+          at::Tensor attn_output =
+              NestedTensorFunction_ragged_attention_rows::apply(
+                  qkv.narrow(1, 0, edim),
+                  qkv.narrow(1, edim, edim),
+                  qkv.narrow(1, 2 * edim, edim),
+                  attn_bias,
+                  key_mask,
+                  rows,
+                  rows,
+                  num_heads,
+                  1.0,
+                  is_causal);
+          return at::addmm(out_bias, attn_output, out_weight.t()).view({-1});
+        },
+        packed_query,
+        in_proj_weight,
+        *in_proj_bias,
+        out_proj_weight,
+        out_proj_bias);
+  }
 
   at::Tensor q, k, v;
   q = at::addmm(
@@ -50,6 +1056,16 @@ at::Tensor min_mha(
       value,
       at::slice(in_proj_weight, 0, 2 * edim).t());
 
+  // The attention weights are only needed explicitly for dropout.
+  if (!training || dropout_p == 0) {
+    at::Tensor attn_output = use_kernel
+        ? ragged_attention(
+              q, k, v, num_heads, 1.0, attn_mask, key_padding_mask, is_causal)
+        : impl::_ragged_attention_per_constituent(
+              q, k, v, num_heads, 1.0, attn_mask, key_padding_mask, is_causal);
+    return at::addmm(out_proj_bias, attn_output, out_proj_weight.t());
+  }
+
   q = q.reshape({-1, -1, num_heads, head_dim}).transpose(1, 2);
   k = k.reshape({-1, -1, num_heads, head_dim}).transpose(1, 2);
   v = v.reshape({-1, -1, num_heads, head_dim}).transpose(1, 2);
@@ -63,7 +1079,9 @@ at::Tensor min_mha(
 }
 
 static auto registry =
-    torch::RegisterOperators().op("nestedtensor::min_mha", &min_mha);
+    torch::RegisterOperators()
+        .op("nestedtensor::min_mha", &min_mha)
+        .op("nestedtensor::ragged_attention", &ragged_attention);
 
 } // namespace nested_tensor
 } // namespace torch
@@ -0,0 +1,24 @@
+#pragma once
+#include <nestedtensor/csrc/nested_tensor_impl.h>
+
+namespace torch {
+namespace nested_tensor {
+
+// Ragged attention of query, a NestedTensor of shape (N, L_i, E) or a Tensor
+// of shape (N, E), over the kv_lengths[i] rows of keys and values starting
+// at row kv_starts[i] for sequence i. keys and values are read in place, so
+// sequences may be separated by unused rows. If is_causal the L_i queries of
+// sequence i are its last L_i positions, so query l attends to the keys
+// [0, kv_lengths[i] - L_i + l]. Doesn't record anything for autograd.
+at::Tensor cached_ragged_attention(
+    const at::Tensor& query,
+    const at::Tensor& keys,
+    const at::Tensor& values,
+    const std::vector<int64_t>& kv_lengths,
+    const std::vector<int64_t>& kv_starts,
+    int64_t num_heads,
+    double scaling,
+    bool is_causal);
+
+} // namespace nested_tensor
+} // namespace torch
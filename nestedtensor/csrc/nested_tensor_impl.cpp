@@ -6,12 +6,58 @@
 #include <nestedtensor/csrc/utils/nested_node_functions.h>
 #include <torch/csrc/jit/runtime/operator.h>
 #include <torch/library.h>
+#include <atomic>
 
 namespace at {
 
 using namespace torch::nested_tensor;
 using namespace c10;
 
+static std::atomic<int64_t> parallel_grain_size{0};
+
+thread_local int64_t metadata_cache_hits = 0;
+thread_local int64_t metadata_cache_misses = 0;
+
+int64_t get_parallel_grain_size() {
+  return parallel_grain_size.load(std::memory_order_relaxed);
+}
+
+void set_parallel_grain_size(int64_t grain_size) {
+  TORCH_CHECK(grain_size >= 0, "grain_size must be non-negative.");
+  parallel_grain_size.store(grain_size, std::memory_order_relaxed);
+}
+
+static std::atomic<PackedMode> global_packed_mode{PackedMode::Auto};
+static thread_local c10::optional<PackedMode> thread_local_packed_mode;
+static std::atomic<bool> trace_packed_kernels{false};
+
+PackedMode get_packed_mode() {
+  if (thread_local_packed_mode) {
+    return *thread_local_packed_mode;
+  }
+  return global_packed_mode.load(std::memory_order_relaxed);
+}
+
+void set_packed_mode(PackedMode mode) {
+  global_packed_mode.store(mode, std::memory_order_relaxed);
+}
+
+c10::optional<PackedMode> get_thread_local_packed_mode() {
+  return thread_local_packed_mode;
+}
+
+void set_thread_local_packed_mode(c10::optional<PackedMode> mode) {
+  thread_local_packed_mode = mode;
+}
+
+bool get_trace_packed() {
+  return trace_packed_kernels.load(std::memory_order_relaxed);
+}
+
+void set_trace_packed(bool trace) {
+  trace_packed_kernels.store(trace, std::memory_order_relaxed);
+}
+
 int64_t num_memory(c10::List<int64_t> size, c10::List<int64_t> stride) {
   // 0-dim Tensors have torch.Size of .size() 0, but carry 1 memory.
   // Empty 1-dim Tensors (torch.tensor([])) have torch.Size of .size() 1,
@@ -70,13 +116,17 @@ void NestedTensorImpl::shallow_copy_from(
       /*dest_impl=*/this,
       /*version_counter=*/version_counter(),
       /*allow_tensor_metadata_change=*/allow_tensor_metadata_change());
-  nested_impl->_structure = _structure;
-}
-
-std::vector<c10::optional<int64_t>> NestedTensorImpl::opt_sizes() const {
-  return construct_size(
-      map([](at::Tensor tensor) { return c10::List<int64_t>(tensor.sizes()); },
-          get_structure()));
+  _structure = nested_impl->_structure;
+  _first_variable = nested_impl->_first_variable;
+  _nested_size = nested_impl->_nested_size;
+  _nested_stride = nested_impl->_nested_stride;
+  _flat_nested_size = nested_impl->_flat_nested_size;
+  _flat_nested_stride = nested_impl->_flat_nested_stride;
+  _contiguous_offsets = nested_impl->_contiguous_offsets;
+  _opt_sizes = nested_impl->_opt_sizes;
+  _sizes = nested_impl->_sizes;
+  _numel = nested_impl->_numel;
+  _is_contiguous = nested_impl->_is_contiguous;
 }
 
 c10::List<int64_t> _cont_stride(c10::List<int64_t> size) {
@@ -97,6 +147,12 @@ SizeNode infer_nested_size(const TensorNode& _structure) {
       _structure);
 }
 
+SizeNode infer_nested_stride(const TensorNode& _structure) {
+  return map(
+      [](at::Tensor tensor) { return c10::List<int64_t>(tensor.strides()); },
+      _structure);
+}
+
 TensorNode _unbind_tensors(TensorNode structure) {
   std::vector<TensorNode> result_nodes;
   if (structure.is_leaf()) {
@@ -122,13 +178,26 @@ NestedTensorImpl::NestedTensorImpl(TensorNode structure)
       _first_variable(
           get_first_leaf(_structure) ? *get_first_leaf(_structure)
                                      : at::ones({})),
-      _nested_size(map(
-          [](at::Tensor tensor) { return c10::List<int64_t>(tensor.sizes()); },
-          _structure)) {
+      _nested_size(infer_nested_size(_structure)),
+      _nested_stride(infer_nested_stride(_structure)),
+      _flat_nested_size(to_flat(_nested_size)),
+      _flat_nested_stride(to_flat(_nested_stride)) {
   TORCH_CHECK(
       !_structure.is_leaf(),
       "NestedTensorImpl must be given structure of at least height 1.")
-  for (auto opt_int : construct_size(_nested_size)) {
+  metadata_cache_misses++;
+  _contiguous_offsets =
+      torch::nested_tensor::impl::contiguous_offsets(_flat_nested_size);
+  _opt_sizes = construct_size(_nested_size);
+  _numel = _contiguous_offsets.back();
+  // NOTE: The Tensors themselves might not be contiguous even if there is a
+  // buffer. For this to be contiguous not only the individuals Tensors have
+  // to be but also the buffer.
+  _is_contiguous = _structure.buffer().has_value();
+  for (const auto& tensor : flatten(_structure)) {
+    _is_contiguous = _is_contiguous && tensor.is_contiguous();
+  }
+  for (auto opt_int : _opt_sizes) {
     if (opt_int) {
       _sizes.push_back(*opt_int);
     } else {
@@ -149,7 +218,7 @@ inline TensorNode _squeeze_nested_dim(TensorNode structure, int64_t dim) {
 }
 
 int64_t NestedTensorImpl::size(int64_t dim) const {
-  std::vector<c10::optional<int64_t>> size = opt_sizes();
+  const std::vector<c10::optional<int64_t>>& size = opt_sizes();
   if (size[dim]) {
     return *(size[dim]);
   }
@@ -2,14 +2,14 @@
 #include <ATen/ATen.h>
 #include <ATen/MemoryOverlap.h>
 #include <c10/util/Metaprogramming.h>
+#include <nestedtensor/csrc/utils/flat_nested_node.h>
 #include <nestedtensor/csrc/utils/nested_node.h>
 #include <nestedtensor/csrc/utils/nested_node_functions.h>
 #include <torch/csrc/autograd/autograd.h>
 #include <torch/extension.h>
 #include <torch/library.h>
 
-// #define TRACEPACKED 1
-// #define USEPACKED 1
+// #define TRACEOPS 1
 
 namespace torch {
 namespace nested_tensor {
@@ -111,30 +111,19 @@ template <class A, class B>
 inline bool nested_size_matches(A a, B b) {
   TORCH_CHECK(
       is_nested_tensor_impl(a, b), "Can only compare shapes of NestedTensors.");
-  auto nested_size_a = get_nested_tensor_impl(a)->nested_size();
-  auto nested_size_b = get_nested_tensor_impl(b)->nested_size();
+  const FlatSizeNode& nested_size_a =
+      get_nested_tensor_impl(a)->flat_nested_size();
+  const FlatSizeNode& nested_size_b =
+      get_nested_tensor_impl(b)->flat_nested_size();
   if (!shape_matches(nested_size_a, nested_size_b)) {
     return false;
   }
-  std::vector<bool> bools = flatten(map(
-      [](c10::List<int64_t> a, c10::List<int64_t> b) -> bool {
-        if (a.size() != b.size()) {
-          return false;
-        }
-        for (size_t i = 0; i < a.size(); i++) {
-          if (a[i] != b[i]) {
-            return false;
-          }
-        }
-        return true;
-      },
-      nested_size_a,
-      nested_size_b));
-  bool all = true;
-  for (size_t i = 0; i < bools.size(); i++) {
-    all = all && bools[i];
+  for (int64_t i = 0; i < nested_size_a.num_leaves(); i++) {
+    if (!nested_size_a.leaf(i).equals(nested_size_b.leaf(i))) {
+      return false;
+    }
   }
-  return all;
+  return true;
 }
 
 template <class A, class B, class... C>
@@ -154,6 +143,21 @@ static inline void apply_nested_tensor(F&& fn, A... a) {
   apply(std::move(fn), get_nested_tensor_structure(a)...);
 }
 
+// Debug counters for the metadata NestedTensorImpl caches at construction.
+// A miss is counted for every construction, a hit for every read of a cached
+// value. The counters are kept per thread, so that threads reading metadata
+// concurrently don't contend on them.
+extern thread_local int64_t metadata_cache_hits;
+extern thread_local int64_t metadata_cache_misses;
+
+static inline void record_metadata_cache_hit() {
+  metadata_cache_hits++;
+}
+
+// NOTE: The structure of a NestedTensorImpl never changes after construction.
+// All metadata that can be derived from it, such as nested_size and
+// opt_sizes, is therefore computed once by the constructor and returned by
+// const reference.
 struct NestedTensorImpl : public c10::TensorImpl {
   explicit NestedTensorImpl(TensorNode structure);
 
@@ -161,23 +165,12 @@ struct NestedTensorImpl : public c10::TensorImpl {
     return _first_variable.dim() + nested_dim();
   }
   int64_t numel() const override {
-    auto fn = [](at::Tensor leaf, int64_t input) {
-      return input + leaf.numel();
-    };
-    return reduce<decltype(fn), int64_t, at::Tensor>(get_structure(), fn, 0);
+    record_metadata_cache_hit();
+    return _numel;
   }
   bool is_contiguous(at::MemoryFormat memory_format) const override {
-    // NOTE: The Tensors themselves might not be contiguous even if there is a
-    // buffer. For this to be contiguous not only the individuals Tensors have
-    // to be but also the buffer.
-    auto fn = [](at::Tensor leaf, bool input) {
-      return input && leaf.is_contiguous();
-    };
-    return reduce<decltype(fn), bool, at::Tensor>(get_structure(), fn, true) &&
-        get_structure().buffer().has_value();
-  }
-  TensorNode& get_structure() {
-    return _structure;
+    record_metadata_cache_hit();
+    return _is_contiguous;
   }
   const TensorNode& get_structure() const {
     return _structure;
@@ -216,18 +209,40 @@ struct NestedTensorImpl : public c10::TensorImpl {
   //
   // That means, if the list is not empty it is either a list of
   // lists of numbers or a list of empty lists.
-  SizeNode nested_size() const {
-    return map(
-        [](at::Tensor tensor) { return c10::List<int64_t>(tensor.sizes()); },
-        get_structure());
+  //
+  // NOTE: Copies of a SizeNode share their c10::Lists, so the entries of the
+  // returned SizeNodes must not be modified.
+  const SizeNode& nested_size() const {
+    record_metadata_cache_hit();
+    return _nested_size;
+  }
+  const SizeNode& nested_stride() const {
+    record_metadata_cache_hit();
+    return _nested_stride;
+  }
+  // Same as nested_size and nested_stride, but stored in a handful of
+  // contiguous arrays.
+  const FlatSizeNode& flat_nested_size() const {
+    record_metadata_cache_hit();
+    return _flat_nested_size;
+  }
+  const FlatSizeNode& flat_nested_stride() const {
+    record_metadata_cache_hit();
+    return _flat_nested_stride;
   }
-  SizeNode nested_stride() const {
-    return map(
-        [](at::Tensor tensor) { return c10::List<int64_t>(tensor.strides()); },
-        get_structure());
+  // Entry i is the offset at which constituent i starts if the constituents
+  // are laid out contiguously one after the other. The last entry is the
+  // numel of the NestedTensor. This matches the buffer of a contiguous
+  // NestedTensor.
+  const std::vector<int64_t>& contiguous_offsets() const {
+    record_metadata_cache_hit();
+    return _contiguous_offsets;
   }
 
-  std::vector<c10::optional<int64_t>> opt_sizes() const;
+  const std::vector<c10::optional<int64_t>>& opt_sizes() const {
+    record_metadata_cache_hit();
+    return _opt_sizes;
+  }
   IntArrayRef sizes() const override {
     return IntArrayRef(_sizes);
   }
@@ -238,7 +253,14 @@ struct NestedTensorImpl : public c10::TensorImpl {
   TensorNode _structure;
   at::Tensor _first_variable;
   SizeNode _nested_size;
+  SizeNode _nested_stride;
+  FlatSizeNode _flat_nested_size;
+  FlatSizeNode _flat_nested_stride;
+  std::vector<int64_t> _contiguous_offsets;
+  std::vector<c10::optional<int64_t>> _opt_sizes;
   std::vector<int64_t> _sizes;
+  int64_t _numel;
+  bool _is_contiguous;
 };
 
 inline at::NestedTensorImpl* get_nested_tensor_impl(const at::Tensor tensor) {
@@ -294,6 +316,68 @@ static inline at::Tensor map_nested_tensor(F&& fn, A... a) {
       map(std::move(fn), get_nested_tensor_structure(a)...));
 }
 
+// Minimum number of constituents handled by each task when a NestedTensor op
+// runs over its constituents in parallel. 0, the default, disables parallel
+// execution.
+int64_t get_parallel_grain_size();
+void set_parallel_grain_size(int64_t grain_size);
+
+// Selects whether ops use kernels that run on the buffer of packed
+// NestedTensors instead of on each constituent.
+//  - Auto: Use packed kernels if the inputs are packed and contiguous.
+//  - Always: Like Auto, but also pack NestedTensors that aren't contiguous
+//    if that allows the use of a packed kernel.
+//  - Never: Always run on each constituent.
+enum class PackedMode { Auto, Always, Never };
+
+// Returns the thread local packed mode if set and the global one otherwise.
+PackedMode get_packed_mode();
+void set_packed_mode(PackedMode mode);
+c10::optional<PackedMode> get_thread_local_packed_mode();
+void set_thread_local_packed_mode(c10::optional<PackedMode> mode);
+
+// Overrides the packed mode of the current thread within its scope.
+struct PackedModeGuard {
+  PackedModeGuard(PackedMode mode)
+      : _prev_mode(get_thread_local_packed_mode()) {
+    set_thread_local_packed_mode(mode);
+  }
+  ~PackedModeGuard() {
+    set_thread_local_packed_mode(_prev_mode);
+  }
+
+ private:
+  c10::optional<PackedMode> _prev_mode;
+};
+
+// If enabled, the name of each packed kernel is printed when it's called.
+bool get_trace_packed();
+void set_trace_packed(bool trace);
+
+static inline void trace_packed(const char* name) {
+  if (get_trace_packed()) {
+    std::cout << "calling packed " << name << std::endl;
+  }
+}
+
+// Same as map_nested_tensor, but fn may be run on several constituents at
+// once. See parallel_map and set_parallel_grain_size.
+template <class F, class... A>
+static inline at::Tensor parallel_map_nested_tensor(F&& fn, A... a) {
+  return wrap_tensor_node(parallel_map(
+      get_parallel_grain_size(),
+      std::move(fn),
+      get_nested_tensor_structure(a)...));
+}
+
+template <class F, class... A>
+static inline void parallel_apply_nested_tensor(F&& fn, A... a) {
+  parallel_apply(
+      get_parallel_grain_size(),
+      std::move(fn),
+      get_nested_tensor_structure(a)...);
+}
+
 inline bool is_tensor_shape(const at::Tensor tensor) {
   auto nt = get_nested_tensor_impl(tensor);
   for (const auto& size : nt->opt_sizes()) {
@@ -470,10 +554,14 @@ auto tuple_zip(Head&& head, Tail&&... tail) {
 // to get gradients for its weight and bias. If they are regular Tensors
 // they won't be given as inputs and their gradients won't be propagated
 // by this mapper.
-template <typename F, class B, class... Args>
+//
+// NOTE: If Parallel is true step 4 uses parallel_map_nested_tensor and fn may
+// be run on several constituents at once. The backward pass differentiates
+// the constituents of all inputs with a single call to torch::autograd::grad.
+template <bool Parallel, typename F, class B, class... Args>
 struct NestedTensorFunction_mapper
     : public torch::autograd::Function<
-          NestedTensorFunction_mapper<F, B, Args...>> {
+          NestedTensorFunction_mapper<Parallel, F, B, Args...>> {
   static Tensor forward(
       torch::autograd::AutogradContext* ctx,
       F&& fn,
@@ -532,20 +620,22 @@ struct NestedTensorFunction_mapper
     // 4. Output of differentiable function given Tensor from step 3.
     at::Tensor autograd_output = c10::guts::apply(
         [&fn, &expect_diff_function](auto... a) {
-          return map_nested_tensor(
-              [&](Args... t) {
-                AutoGradMode autogradmode(true);
-                at::Tensor result = fn(t...);
-                if (expect_diff_function) {
-                  TORCH_CHECK(
-                      result.requires_grad(),
-                      "fn ",
-                      typeid(F).name(),
-                      " output expected to required gradient.");
-                }
-                return result;
-              },
-              a...);
+          auto autograd_fn = [&](Args... t) {
+            AutoGradMode autogradmode(true);
+            at::Tensor result = fn(t...);
+            if (expect_diff_function) {
+              TORCH_CHECK(
+                  result.requires_grad(),
+                  "fn ",
+                  typeid(F).name(),
+                  " output expected to required gradient.");
+            }
+            return result;
+          };
+          if (Parallel) {
+            return parallel_map_nested_tensor(std::move(autograd_fn), a...);
+          }
+          return map_nested_tensor(std::move(autograd_fn), a...);
         },
         std::move(autograd_input_tuple_));
 
@@ -585,76 +675,105 @@ struct NestedTensorFunction_mapper
     // TORCH_CHECK(
     //     saved_data_size <= 3,
     //     "Only one input and at most two outputs supported for now.");
-    std::vector<TensorNode> input_nodes;
+    // NOTE: The constituents of all inputs are differentiated in a single call
+    // to autograd. Dense inputs are shared by all constituents and are passed
+    // once, which leaves it to autograd to accumulate their gradients.
+    std::vector<at::Tensor> outputs =
+        flatten(get_nested_tensor_structure(saved_data[saved_data_size - 1]));
+    std::vector<at::Tensor> grad_outputs =
+        flatten(get_nested_tensor_structure(grad_output_[0]));
+    std::vector<at::Tensor> inputs;
+    std::array<size_t, saved_data_size> input_offsets;
     for (size_t i = 0; i < saved_data_size - 1; i++) {
+      input_offsets[i] = inputs.size();
       if (requires_grad_vector[i]) {
-        input_nodes.push_back(get_nested_tensor_structure(saved_data[i]));
+        if (is_nested_tensor_impl(saved_data[i])) {
+          for (const at::Tensor& ti :
+               flatten(get_nested_tensor_structure(saved_data[i]))) {
+            inputs.push_back(ti);
+          }
+        } else {
+          inputs.push_back(saved_data[i]);
+        }
       }
     }
+    input_offsets[saved_data_size - 1] = inputs.size();
+    std::vector<at::Tensor> grads(inputs.size());
+    if (outputs.size() > 0 && inputs.size() > 0) {
+      grads = torch::autograd::grad(outputs, inputs, grad_outputs);
+    }
     at::Tensor undef;
     // NOTE: First entry needs to return undef for function value input.
     // NOTE: Second entry corresponds to the requires_grad_vector
     std::array<at::Tensor, saved_data_size + 1> grad_input;
     grad_input.fill(undef);
-    std::vector<TensorNode> wrapped_grad_input = unzip(map(
-        [&grad_input, &saved_data, &requires_grad_vector](
-            at::Tensor r, std::vector<at::Tensor> is, at::Tensor g) {
-          return torch::autograd::grad({r}, is, {g});
-        },
-        get_nested_tensor_structure(saved_data[saved_data_size - 1]),
-        zip(input_nodes),
-        get_nested_tensor_structure(grad_output_[0])));
-    size_t index = 0;
     for (size_t i = 0; i < saved_data_size - 1; i++) {
-      if (requires_grad_vector[i]) {
-        if (is_nested_tensor_impl(saved_data[i])) {
-          grad_input[2 + i] =
-              wrap_tensor_node(std::move(wrapped_grad_input[index]));
-        } else {
-          std::vector<at::Tensor> flat = flatten(wrapped_grad_input[index]);
-          std::vector<at::Tensor> first_flat;
-          std::vector<at::Tensor> second_flat;
-          while (flat.size() > 1) {
-            first_flat.clear();
-            second_flat.clear();
-            size_t flat_size = flat.size() / 2;
-            for (size_t j = 0; j < flat_size; j++) {
-              first_flat.push_back(flat[0]);
-              flat.pop_back();
-              second_flat.push_back(flat[0]);
-              flat.pop_back();
-            }
-            TORCH_CHECK(
-                first_flat.size() == second_flat.size(),
-                "Both first and second list should be of the same size.");
-            first_flat = _foreach_add(first_flat, second_flat);
-            for (size_t j = 0; j < flat.size(); j++) {
-              first_flat.push_back(flat[j]);
-            }
-            flat = first_flat;
-          }
-          if (flat.size() > 0) {
-            at::Tensor tmp_grad = flat[0].contiguous();
-            for (size_t j = 1; j < flat.size(); j++) {
-              tmp_grad.add_(flat[j]);
-            }
-            grad_input[2 + i] = tmp_grad;
-          }
-        }
-        index++;
+      if (!requires_grad_vector[i]) {
+        continue;
+      }
+      if (is_nested_tensor_impl(saved_data[i])) {
+        std::vector<at::Tensor> grads_i(
+            grads.begin() + input_offsets[i],
+            grads.begin() + input_offsets[i + 1]);
+        grad_input[2 + i] = wrap_tensor_node(unflatten(
+            get_nested_tensor_structure(saved_data[i]), std::move(grads_i)));
+      } else {
+        grad_input[2 + i] = grads[input_offsets[i]];
       }
     }
     TORCH_CHECK(
         grad_input.size() == saved_data_size + 1,
         "grad input should match number of inputs.");
-    TORCH_CHECK(
-        index == wrapped_grad_input.size(), "Not all grad inputs distributed.");
     return std::vector<at::Tensor>{grad_input.begin(), grad_input.end()};
   }
 };
 
+// Returns true if autograd needs to record a function of the given inputs.
+template <class... A>
+static inline bool requires_autograd(A... a) {
+  if (!GradMode::is_enabled()) {
+    return false;
+  }
+  std::vector<at::Tensor> inputs{a...};
+  for (const auto& input : inputs) {
+    if (input.defined() && input.requires_grad()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// NOTE: If no gradients are required, e.g. under torch.no_grad(), the
+// autograd mappers call fn directly and skip aliasing the constituents. fn
+// then runs under a NoGradGuard, since it may capture Tensors that require
+// gradients, such as the weight of an embedding. The autograd functions
+// don't record those either, so the result is the same.
 template <class F, class... A>
 static inline at::Tensor autograd_map_nested_tensor(F&& fn, A... a) {
+  if (!requires_autograd(a...)) {
+    at::NoGradGuard no_grad;
+    return map_nested_tensor(std::move(fn), a...);
+  }
+  auto b =
+      c10::guts::tuple_map(std::tuple<A...>(a...), [](at::Tensor t) -> bool {
+        if (t.defined()) {
+          return t.requires_grad();
+        }
+        return false;
+      });
+  return NestedTensorFunction_mapper<false, F, decltype(b), A...>::apply(
+      std::move(fn), b, a...);
+}
+
+// Same as autograd_map_nested_tensor, but the forward pass may run fn on
+// several constituents concurrently. fn must not have side effects, such as
+// writing to captured state, that depend on the order of the constituents.
+template <class F, class... A>
+static inline at::Tensor autograd_map_nested_tensor_parallel(F&& fn, A... a) {
+  if (!requires_autograd(a...)) {
+    at::NoGradGuard no_grad;
+    return parallel_map_nested_tensor(std::move(fn), a...);
+  }
   auto b =
       c10::guts::tuple_map(std::tuple<A...>(a...), [](at::Tensor t) -> bool {
         if (t.defined()) {
@@ -662,10 +781,237 @@ static inline at::Tensor autograd_map_nested_tensor(F&& fn, A... a) {
         }
         return false;
       });
-  return NestedTensorFunction_mapper<F, decltype(b), A...>::apply(
+  return NestedTensorFunction_mapper<true, F, decltype(b), A...>::apply(
       std::move(fn), b, a...);
 }
 
+// Returns true if an elementwise function can be applied to the buffers of
+// the given NestedTensors instead of their constituents. All NestedTensors
+// need to be packed, contiguous and of the same nested size. Regular Tensors
+// need to broadcast trivially against a buffer, i.e. hold a single element
+// and be of dimension at most 1. This never holds if the packed mode is Never.
+template <class... A>
+static inline bool can_apply_to_buffers(A... a) {
+  if (get_packed_mode() == PackedMode::Never) {
+    return false;
+  }
+  at::Tensor first_nested;
+  bool result = true;
+  for (const auto& t : std::vector<at::Tensor>{a...}) {
+    if (!t.defined()) {
+      continue;
+    }
+    if (!is_nested_tensor_impl(t)) {
+      result = result && t.dim() <= 1 && t.numel() == 1;
+      continue;
+    }
+    result = result && is_packed(t) && t.is_contiguous();
+    if (!first_nested.defined()) {
+      first_nested = t;
+    } else {
+      result = result && nested_size_matches(first_nested, t);
+    }
+  }
+  return result && first_nested.defined();
+}
+
+namespace detail {
+template <class F, std::size_t... I>
+at::Tensor apply_to_vector(
+    F& fn,
+    const std::vector<at::Tensor>& args,
+    std::index_sequence<I...>) {
+  return fn(args[I]...);
+}
+} // namespace detail
+
+// Packed counterpart of NestedTensorFunction_mapper for elementwise functions.
+//
+// fn is called once with the buffers of the NestedTensor arguments and the
+// regular Tensor arguments as they are. The result must be a buffer with one
+// entry per element of the first NestedTensor argument, which is then also
+// used for the nested size of the output. All NestedTensor arguments need to
+// be packed and contiguous and of the same nested size.
+//
+// Just as with the mapper, fn is applied to aliases that require gradients
+// under AutoGradMode and the backward pass is a single call to
+// torch::autograd::grad using the buffer of the incoming gradient.
+template <typename F, class... Args>
+struct NestedTensorFunction_packed_mapper
+    : public torch::autograd::Function<
+          NestedTensorFunction_packed_mapper<F, Args...>> {
+  static Tensor forward(
+      torch::autograd::AutogradContext* ctx,
+      F&& fn,
+      Args... a) {
+    std::vector<at::Tensor> inputs{a...};
+    std::vector<at::Tensor> fn_inputs;
+    std::vector<at::Tensor> autograd_inputs;
+    std::vector<bool> requires_grad_vector;
+    std::vector<bool> is_nested_vector;
+    at::Tensor first_nested;
+    for (const auto& input : inputs) {
+      bool is_nested = is_nested_tensor_impl(input);
+      at::Tensor fn_input = is_nested ? get_buffer(input) : input;
+      if (is_nested && !first_nested.defined()) {
+        first_nested = input;
+      }
+      bool requires_grad = input.defined() && input.requires_grad() &&
+          torch::autograd::isDifferentiableType(input.scalar_type());
+      if (requires_grad) {
+        AutoGradMode autogradmode(true);
+        fn_input = fn_input.alias();
+        fn_input.requires_grad_();
+        autograd_inputs.push_back(fn_input);
+      }
+      fn_inputs.push_back(fn_input);
+      requires_grad_vector.push_back(requires_grad);
+      is_nested_vector.push_back(is_nested);
+    }
+    TORCH_CHECK(
+        first_nested.defined(),
+        "packed mapper requires at least one NestedTensor argument.");
+    at::Tensor autograd_output;
+    {
+      AutoGradMode autogradmode(true);
+      autograd_output = detail::apply_to_vector(
+          fn, fn_inputs, std::index_sequence_for<Args...>());
+    }
+    at::Tensor output = wrap_tensor_node(
+        torch::nested_tensor::impl::build_structure(
+            autograd_output.alias().detach(),
+            get_nested_tensor_impl(first_nested)->flat_nested_size()));
+    if (!autograd_output.requires_grad()) {
+      ctx->mark_non_differentiable({output});
+      return output;
+    }
+    autograd_inputs.push_back(autograd_output);
+    ctx->save_for_backward(autograd_inputs);
+    ctx->saved_data["0"] = requires_grad_vector;
+    ctx->saved_data["1"] = is_nested_vector;
+    return output;
+  }
+  static torch::autograd::variable_list backward(
+      torch::autograd::AutogradContext* ctx,
+      torch::autograd::variable_list grad_output_) {
+    TORCH_CHECK(
+        grad_output_.size() == 1,
+        "Only one incoming gradient supported for now.");
+    // NOTE: First entry needs to return undef for function value input.
+    at::Tensor undef;
+    std::vector<at::Tensor> grad_input(sizeof...(Args) + 1, undef);
+    std::vector<at::Tensor> autograd_inputs = ctx->get_saved_variables();
+    at::Tensor autograd_output = autograd_inputs.back();
+    autograd_inputs.pop_back();
+    std::vector<bool> requires_grad_vector =
+        ctx->saved_data["0"].toBoolList().vec();
+    std::vector<bool> is_nested_vector =
+        ctx->saved_data["1"].toBoolList().vec();
+    at::Tensor grad = grad_output_[0];
+    TORCH_CHECK(
+        !grad.requires_grad(), "packed mapper doesn't support double backward.");
+    grad = grad.contiguous();
+    std::vector<at::Tensor> grads = torch::autograd::grad(
+        {autograd_output},
+        autograd_inputs,
+        {get_buffer(grad)},
+        c10::nullopt,
+        false,
+        true);
+    size_t index = 0;
+    for (size_t i = 0; i < sizeof...(Args); i++) {
+      if (!requires_grad_vector[i]) {
+        continue;
+      }
+      at::Tensor g = grads[index];
+      index++;
+      if (!g.defined()) {
+        continue;
+      }
+      if (is_nested_vector[i]) {
+        grad_input[i + 1] =
+            wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+                std::move(g), get_nested_tensor_impl(grad)->flat_nested_size()));
+      } else {
+        grad_input[i + 1] = g;
+      }
+    }
+    TORCH_CHECK(index == grads.size(), "Not all grad inputs distributed.");
+    return grad_input;
+  }
+};
+
+// Applies fn to the buffers of the given NestedTensors without recording
+// anything for autograd.
+template <class F, class... A>
+static inline at::Tensor map_packed_nested_tensor(F&& fn, A... a) {
+  std::vector<at::Tensor> inputs{a...};
+  at::Tensor first_nested;
+  for (auto& input : inputs) {
+    if (is_nested_tensor_impl(input)) {
+      if (!first_nested.defined()) {
+        first_nested = input;
+      }
+      input = get_buffer(input);
+    }
+  }
+  TORCH_CHECK(
+      first_nested.defined(),
+      "packed mapper requires at least one NestedTensor argument.");
+  at::Tensor output =
+      detail::apply_to_vector(fn, inputs, std::index_sequence_for<A...>());
+  return wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+      std::move(output),
+      get_nested_tensor_impl(first_nested)->flat_nested_size()));
+}
+
+template <class F, class... A>
+static inline at::Tensor autograd_map_packed_nested_tensor(F&& fn, A... a) {
+  if (!requires_autograd(a...)) {
+    at::NoGradGuard no_grad;
+    return map_packed_nested_tensor(std::move(fn), a...);
+  }
+  return NestedTensorFunction_packed_mapper<F, A...>::apply(std::move(fn), a...);
+}
+
+// Returns a packed and contiguous copy of tensor if it's a NestedTensor that
+// isn't already.
+static inline at::Tensor pack_nested_tensor(const at::Tensor& tensor) {
+  if (!tensor.defined() || !is_nested_tensor_impl(tensor) ||
+      (is_packed(tensor) && tensor.is_contiguous())) {
+    return tensor;
+  }
+  return tensor.contiguous();
+}
+
+namespace detail {
+template <class F, class... A>
+static inline at::Tensor autograd_map_elementwise_nested_tensor(
+    F&& fn,
+    A... a) {
+  if (can_apply_to_buffers(a...)) {
+    trace_packed("elementwise op");
+    return autograd_map_packed_nested_tensor(std::move(fn), a...);
+  }
+  return autograd_map_nested_tensor(std::move(fn), a...);
+}
+} // namespace detail
+
+// Maps the elementwise function fn over the given NestedTensors. If
+// can_apply_to_buffers holds fn is applied to their buffers once instead of
+// to each constituent. If the packed mode is Always, NestedTensors are packed
+// first.
+template <class F, class... A>
+static inline at::Tensor autograd_map_elementwise_nested_tensor(
+    F&& fn,
+    A... a) {
+  if (get_packed_mode() == PackedMode::Always) {
+    return detail::autograd_map_elementwise_nested_tensor(
+        std::move(fn), pack_nested_tensor(a)...);
+  }
+  return detail::autograd_map_elementwise_nested_tensor(std::move(fn), a...);
+}
+
 static inline Tensor maybe_multiply(const Tensor& t, const Scalar& s) {
   bool is_one = false;
   if (s.isFloatingPoint()) {
@@ -681,7 +1027,7 @@ static inline Tensor maybe_multiply(const Tensor& t, const Scalar& s) {
   }
 }
 
-#ifdef TRACEPACKED
+#ifdef TRACEOPS
 #define nt_impl(M, NAME, FUNC) M.impl_UNBOXED(NAME, trace(TORCH_FN(FUNC)))
 #else
 #define nt_impl(M, NAME, FUNC) M.impl_UNBOXED(NAME, FUNC)
@@ -1,4 +1,7 @@
 
+#include <ATen/AccumulateType.h>
+#include <ATen/Dispatch.h>
+#include <ATen/Parallel.h>
 #include <nestedtensor/csrc/nested_tensor_impl.h>
 #include <nestedtensor/csrc/utils/nested_node_functions.h>
 #include <torch/extension.h>
@@ -8,12 +11,313 @@ using namespace torch::nn;
 namespace F = torch::nn::functional;
 
 namespace at {
-// TODO: Cover all the cases!
+
+namespace impl {
+
+// NOTE: Packed batch_norm
+//
+// Constituent i of a packed and contiguous NestedTensor with constituents of
+// shape (C, *) is a contiguous (C, L_i) block of its buffer. Channel c is then
+// made of one contiguous segment of length L_i per constituent. The kernels
+// below visit all segments of a channel in one sweep over the buffer and are
+// parallelized over channels. This yields the statistics of each channel
+// across all constituents, as for a dense batch, and updates the running
+// statistics once.
+struct ChannelSegments {
+  int64_t channels;
+  int64_t numel_per_channel;
+  std::vector<int64_t> offsets;
+  std::vector<int64_t> lengths;
+};
+
+ChannelSegments channel_segments(const Tensor& input, int64_t channels) {
+  const std::vector<int64_t>& offsets =
+      get_nested_tensor_impl(input)->contiguous_offsets();
+  std::vector<int64_t> lengths;
+  int64_t numel_per_channel = 0;
+  for (size_t i = 0; i + 1 < offsets.size(); i++) {
+    lengths.push_back((offsets[i + 1] - offsets[i]) / channels);
+    numel_per_channel += lengths.back();
+  }
+  return ChannelSegments{
+      channels,
+      numel_per_channel,
+      std::vector<int64_t>(offsets.begin(), offsets.end() - 1),
+      std::move(lengths)};
+}
+
+template <typename F>
+void for_each_channel_segment(const ChannelSegments& s, int64_t c, F fn) {
+  for (size_t i = 0; i < s.lengths.size(); i++) {
+    fn(s.offsets[i] + c * s.lengths[i], s.lengths[i]);
+  }
+}
+
+// Returns the output buffer and the mean and inverse standard deviation that
+// were used to normalize each channel.
+std::tuple<Tensor, Tensor, Tensor> packed_batch_norm(
+    const Tensor& input,
+    const ChannelSegments& s,
+    const Tensor& weight,
+    const Tensor& bias,
+    const Tensor& running_mean,
+    const Tensor& running_var,
+    bool use_input_stats,
+    double momentum,
+    double eps) {
+  TORCH_CHECK(
+      !use_input_stats || s.numel_per_channel > 1,
+      "Expected more than 1 value per channel when training.");
+  Tensor buffer = get_buffer(input);
+  Tensor output = at::empty_like(buffer);
+  Tensor mean = at::empty({s.channels}, buffer.options());
+  Tensor invstd = at::empty({s.channels}, buffer.options());
+  AT_DISPATCH_FLOATING_TYPES(buffer.scalar_type(), "packed_batch_norm", [&] {
+    using acc_t = at::acc_type<scalar_t, false>;
+    const scalar_t* x = buffer.data_ptr<scalar_t>();
+    scalar_t* y = output.data_ptr<scalar_t>();
+    scalar_t* mean_data = mean.data_ptr<scalar_t>();
+    scalar_t* invstd_data = invstd.data_ptr<scalar_t>();
+    const scalar_t* w =
+        weight.defined() ? weight.data_ptr<scalar_t>() : nullptr;
+    const scalar_t* b = bias.defined() ? bias.data_ptr<scalar_t>() : nullptr;
+    scalar_t* rm =
+        running_mean.defined() ? running_mean.data_ptr<scalar_t>() : nullptr;
+    scalar_t* rv =
+        running_var.defined() ? running_var.data_ptr<scalar_t>() : nullptr;
+    const acc_t n = s.numel_per_channel;
+    at::parallel_for(0, s.channels, 1, [&](int64_t begin, int64_t end) {
+      for (int64_t c = begin; c < end; c++) {
+        acc_t mu;
+        acc_t inv;
+        if (use_input_stats) {
+          acc_t sum = 0;
+          for_each_channel_segment(s, c, [&](int64_t offset, int64_t length) {
+            for (int64_t j = offset; j < offset + length; j++) {
+              sum += x[j];
+            }
+          });
+          mu = sum / n;
+          acc_t sum_sq = 0;
+          for_each_channel_segment(s, c, [&](int64_t offset, int64_t length) {
+            for (int64_t j = offset; j < offset + length; j++) {
+              acc_t d = x[j] - mu;
+              sum_sq += d * d;
+            }
+          });
+          inv = 1 / std::sqrt(sum_sq / n + eps);
+          if (rm) {
+            rm[c] = momentum * mu + (1 - momentum) * rm[c];
+          }
+          if (rv) {
+            rv[c] = momentum * sum_sq / (n - 1) + (1 - momentum) * rv[c];
+          }
+        } else {
+          mu = rm[c];
+          inv = 1 / std::sqrt(static_cast<acc_t>(rv[c]) + eps);
+        }
+        mean_data[c] = mu;
+        invstd_data[c] = inv;
+        acc_t scale = w ? w[c] * inv : inv;
+        acc_t shift = (b ? b[c] : 0) - mu * scale;
+        for_each_channel_segment(s, c, [&](int64_t offset, int64_t length) {
+          for (int64_t j = offset; j < offset + length; j++) {
+            y[j] = x[j] * scale + shift;
+          }
+        });
+      }
+    });
+  });
+  return std::make_tuple(output, mean, invstd);
+}
+
+// Analytic backward of packed_batch_norm. Returns the gradients of the input
+// buffer, the weight and the bias.
+std::tuple<Tensor, Tensor, Tensor> packed_batch_norm_backward(
+    const Tensor& grad,
+    const Tensor& input,
+    const ChannelSegments& s,
+    const Tensor& weight,
+    const Tensor& mean,
+    const Tensor& invstd,
+    bool use_input_stats) {
+  Tensor buffer = get_buffer(input);
+  Tensor grad_buffer = get_buffer(grad);
+  Tensor grad_input = at::empty_like(buffer);
+  Tensor grad_weight = at::empty({s.channels}, buffer.options());
+  Tensor grad_bias = at::empty({s.channels}, buffer.options());
+  AT_DISPATCH_FLOATING_TYPES(
+      buffer.scalar_type(), "packed_batch_norm_backward", [&] {
+        using acc_t = at::acc_type<scalar_t, false>;
+        const scalar_t* x = buffer.data_ptr<scalar_t>();
+        const scalar_t* g = grad_buffer.data_ptr<scalar_t>();
+        scalar_t* dx = grad_input.data_ptr<scalar_t>();
+        scalar_t* dw = grad_weight.data_ptr<scalar_t>();
+        scalar_t* db = grad_bias.data_ptr<scalar_t>();
+        const scalar_t* w =
+            weight.defined() ? weight.data_ptr<scalar_t>() : nullptr;
+        const scalar_t* mean_data = mean.data_ptr<scalar_t>();
+        const scalar_t* invstd_data = invstd.data_ptr<scalar_t>();
+        const acc_t n = s.numel_per_channel;
+        at::parallel_for(0, s.channels, 1, [&](int64_t begin, int64_t end) {
+          for (int64_t c = begin; c < end; c++) {
+            const acc_t mu = mean_data[c];
+            const acc_t inv = invstd_data[c];
+            acc_t sum_g = 0;
+            acc_t sum_g_xmu = 0;
+            for_each_channel_segment(
+                s, c, [&](int64_t offset, int64_t length) {
+                  for (int64_t j = offset; j < offset + length; j++) {
+                    sum_g += g[j];
+                    sum_g_xmu += g[j] * (x[j] - mu);
+                  }
+                });
+            dw[c] = sum_g_xmu * inv;
+            db[c] = sum_g;
+            const acc_t scale = w ? w[c] * inv : inv;
+            if (!use_input_stats) {
+              for_each_channel_segment(
+                  s, c, [&](int64_t offset, int64_t length) {
+                    for (int64_t j = offset; j < offset + length; j++) {
+                      dx[j] = g[j] * scale;
+                    }
+                  });
+              continue;
+            }
+            const acc_t grad_mean = sum_g / n;
+            const acc_t proj = sum_g_xmu * inv * inv / n;
+            for_each_channel_segment(
+                s, c, [&](int64_t offset, int64_t length) {
+                  for (int64_t j = offset; j < offset + length; j++) {
+                    dx[j] = (g[j] - grad_mean - (x[j] - mu) * proj) * scale;
+                  }
+                });
+          }
+        });
+      });
+  return std::make_tuple(grad_input, grad_weight, grad_bias);
+}
+
+// The packed batch_norm applies to CPU NestedTensors of constituents with a
+// regular number of channels and float or double parameters of the same type.
+bool use_packed_batch_norm(
+    const Tensor& input,
+    const c10::optional<Tensor>& weight,
+    const c10::optional<Tensor>& bias,
+    const c10::optional<Tensor>& running_mean,
+    const c10::optional<Tensor>& running_var) {
+  if (get_packed_mode() == PackedMode::Never ||
+      get_nested_tensor_impl(input)->nested_dim() != 1 || input.dim() < 2 ||
+      !get_nested_tensor_impl(input)->opt_sizes()[1] ||
+      !input.device().is_cpu() || !at::isFloatingType(input.scalar_type()) ||
+      input.scalar_type() == at::kHalf ||
+      input.scalar_type() == at::kBFloat16) {
+    return false;
+  }
+  int64_t channels = *get_nested_tensor_impl(input)->opt_sizes()[1];
+  for (const auto& t : {weight, bias, running_mean, running_var}) {
+    if (t && (*t).defined() &&
+        ((*t).scalar_type() != input.scalar_type() ||
+         !(*t).device().is_cpu() || !(*t).is_contiguous() ||
+         (*t).numel() != channels)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace impl
+
+struct NestedTensorFunction_packed_batch_norm
+    : torch::autograd::Function<NestedTensorFunction_packed_batch_norm> {
+  static Tensor forward(
+      torch::autograd::AutogradContext* ctx,
+      const Tensor& input,
+      const c10::optional<Tensor>& weight,
+      const c10::optional<Tensor>& bias,
+      const c10::optional<Tensor>& running_mean,
+      const c10::optional<Tensor>& running_var,
+      bool training,
+      double momentum,
+      double eps) {
+    trace_packed("batch_norm");
+    at::Tensor undef;
+    at::Tensor weight_ = weight ? *weight : undef;
+    at::Tensor running_mean_ = running_mean ? *running_mean : undef;
+    at::Tensor running_var_ = running_var ? *running_var : undef;
+    bool use_input_stats = training || !running_mean_.defined();
+    TORCH_CHECK(
+        use_input_stats || running_var_.defined(),
+        "running_var must be defined in evaluation mode");
+    auto s = impl::channel_segments(input, input.size(1));
+    at::Tensor output;
+    at::Tensor mean;
+    at::Tensor invstd;
+    std::tie(output, mean, invstd) = impl::packed_batch_norm(
+        input,
+        s,
+        weight_,
+        bias ? *bias : undef,
+        running_mean_,
+        running_var_,
+        use_input_stats,
+        momentum,
+        eps);
+    ctx->save_for_backward({input, weight_, mean, invstd});
+    ctx->saved_data["0"] = use_input_stats;
+    ctx->saved_data["1"] = bias.has_value() && (*bias).defined();
+    return wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+        std::move(output), get_nested_tensor_impl(input)->flat_nested_size()));
+  }
+  static torch::autograd::variable_list backward(
+      torch::autograd::AutogradContext* ctx,
+      torch::autograd::variable_list grad_output) {
+    TORCH_CHECK(grad_output.size() == 1, "Expected grad_output of size 1.");
+    TORCH_CHECK(
+        !grad_output[0].requires_grad(),
+        "batch_norm doesn't support double backward.");
+    auto saved_data = ctx->get_saved_variables();
+    at::Tensor input = saved_data[0];
+    at::Tensor weight = saved_data[1];
+    bool use_input_stats = ctx->saved_data["0"].toBool();
+    bool has_bias = ctx->saved_data["1"].toBool();
+    at::Tensor grad = pack_nested_tensor(grad_output[0]);
+    at::Tensor grad_input;
+    at::Tensor grad_weight;
+    at::Tensor grad_bias;
+    std::tie(grad_input, grad_weight, grad_bias) =
+        impl::packed_batch_norm_backward(
+            grad,
+            input,
+            impl::channel_segments(input, input.size(1)),
+            weight,
+            saved_data[2],
+            saved_data[3],
+            use_input_stats);
+    at::Tensor undef;
+    return {wrap_tensor_node(torch::nested_tensor::impl::build_structure(
+                std::move(grad_input),
+                get_nested_tensor_impl(input)->flat_nested_size())),
+            weight.defined() ? grad_weight : undef,
+            has_bias ? grad_bias : undef,
+            undef,
+            undef,
+            undef,
+            undef,
+            undef};
+  }
+};
+
+// batch_norm for NestedTensors the packed kernels don't apply to. The
+// constituents of shape (C, *) are viewed as (C, L_i) and concatenated along
+// their second dimension, so that a single call to at::batch_norm computes
+// the statistics of each channel across all constituents and updates the
+// running statistics once, just like the packed batch_norm.
 struct NestedTensorFunction_batch_norm
     : torch::autograd::Function<NestedTensorFunction_batch_norm> {
   static Tensor forward(
       torch::autograd::AutogradContext* ctx,
-      const Tensor& input_,
+      const Tensor& input,
       const c10::optional<Tensor>& weight_,
       const c10::optional<Tensor>& bias_,
       const c10::optional<Tensor>& running_mean,
@@ -22,107 +326,99 @@ struct NestedTensorFunction_batch_norm
       double momentum,
       double eps,
       bool cudnn_enabled) {
-    // TORCH_CHECK(weight_, "asdf0");
-    // TORCH_CHECK(bias_, "asdf1");
-    auto autograd_input = map_nested_tensor(
-        [](at::Tensor ti) {
-          AutoGradMode autogradmode(true);
-          auto alias = ti.alias();
-          alias.requires_grad_();
-          return alias;
-        },
-        input_);
+    const TensorNode& structure = get_nested_tensor_structure(input);
+    std::vector<at::Tensor> inputs = flatten(structure);
+    TORCH_CHECK(
+        inputs.size() > 0, "batch_norm requires a non-empty NestedTensor.");
+    int64_t channels = inputs[0].dim() > 0 ? inputs[0].size(0) : 0;
+    std::vector<at::Tensor> autograd_inputs;
+    std::vector<at::Tensor> outputs;
     c10::optional<at::Tensor> weight;
     c10::optional<at::Tensor> bias;
     {
       AutoGradMode autogradmode(true);
-      if (weight_) {
+      std::vector<at::Tensor> columns;
+      std::vector<int64_t> lengths;
+      for (const auto& ti : inputs) {
+        TORCH_CHECK(
+            ti.dim() > 0 && ti.size(0) == channels,
+            "batch_norm requires a regular number of channels.");
+        at::Tensor alias = ti.alias();
+        alias.requires_grad_();
+        autograd_inputs.push_back(alias);
+        columns.push_back(alias.reshape({channels, -1}));
+        lengths.push_back(columns.back().size(1));
+      }
+      if (weight_ && (*weight_).defined()) {
         weight = (*weight_).alias().detach().requires_grad_();
       }
-      if (bias_) {
+      if (bias_ && (*bias_).defined()) {
         bias = (*bias_).alias().detach().requires_grad_();
       }
+      at::Tensor output = at::batch_norm(
+                              at::cat(columns, 1).unsqueeze(0),
+                              weight,
+                              bias,
+                              running_mean,
+                              running_var,
+                              training,
+                              momentum,
+                              eps,
+                              cudnn_enabled)
+                              .squeeze(0);
+      std::vector<at::Tensor> output_columns =
+          at::split_with_sizes(output, lengths, 1);
+      for (size_t i = 0; i < inputs.size(); i++) {
+        outputs.push_back(output_columns[i].reshape(inputs[i].sizes()));
+      }
     }
-    auto autograd_output = map_nested_tensor(
-        [&](at::Tensor t) {
-          AutoGradMode autogradmode(true);
-          return at::native::batch_norm(
-                     t.unsqueeze(0),
-                     *weight,
-                     *bias,
-                     *running_mean,
-                     *running_var,
-                     training,
-                     momentum,
-                     eps,
-                     cudnn_enabled)
-              .squeeze(0);
-        },
-        autograd_input);
     at::Tensor undef;
-    ctx->save_for_backward({weight ? *weight : undef,
-                            bias ? *bias : undef,
-                            autograd_output,
-                            autograd_input});
+    at::Tensor autograd_output =
+        wrap_tensor_node(unflatten(structure, outputs));
+    ctx->save_for_backward(
+        {weight ? *weight : undef,
+         bias ? *bias : undef,
+         autograd_output,
+         wrap_tensor_node(unflatten(structure, autograd_inputs))});
     return map_nested_tensor(
-        [](at::Tensor t) { return t.detach(); }, autograd_output);
+        [](at::Tensor t) { return t.alias().detach(); }, autograd_output);
   }
   static torch::autograd::variable_list backward(
       torch::autograd::AutogradContext* ctx,
-      // TODO: To prevent double backward (for now) check that grad_output
-      // doesn't require gradients.
       torch::autograd::variable_list grad_output) {
+    TORCH_CHECK(grad_output.size() == 1, "Expected grad_output of size 1.");
+    TORCH_CHECK(
+        !grad_output[0].requires_grad(),
+        "batch_norm doesn't support double backward.");
     auto saved_data = ctx->get_saved_variables();
-
-    c10::optional<at::Tensor> weight;
-    c10::optional<at::Tensor> bias;
-    if (saved_data[0].defined()) {
-      weight = saved_data[0];
-    }
-    if (saved_data[1].defined()) {
-      bias = saved_data[1];
+    at::Tensor weight = saved_data[0];
+    at::Tensor bias = saved_data[1];
+    const TensorNode& input_structure =
+        get_nested_tensor_structure(saved_data[3]);
+    // All constituents share the statistics, so they are differentiated in a
+    // single call to autograd.
+    std::vector<at::Tensor> inputs = flatten(input_structure);
+    size_t num_constituents = inputs.size();
+    if (weight.defined()) {
+      inputs.push_back(weight);
     }
-    auto autograd_output = saved_data[2];
-    auto autograd_input = saved_data[3];
-    c10::optional<at::Tensor> weight_grad;
-    if (weight) {
-      weight_grad = torch::zeros_like(*weight);
+    if (bias.defined()) {
+      inputs.push_back(bias);
     }
-    c10::optional<at::Tensor> bias_grad;
-    if (bias) {
-      bias_grad = torch::zeros_like(*bias);
-    }
-
-    TORCH_CHECK(grad_output.size() == 1, "not supported 0");
-    at::Tensor grad = map_nested_tensor(
-        [&](at::Tensor r, at::Tensor i, at::Tensor g) {
-          // TODO: Might have to retain graph in many to one settings.
-          std::vector<at::Tensor> inputs;
-          inputs.push_back(i);
-          if (weight) {
-            inputs.push_back(*weight);
-          }
-          if (bias) {
-            inputs.push_back(*bias);
-          }
-          auto result = torch::autograd::grad(
-              {r}, inputs, {g}, c10::nullopt, false, true);
-          if (result[1].defined()) {
-            (*weight_grad).add_(result[1]);
-          }
-          if (result[2].defined()) {
-            (*bias_grad).add_(result[2]);
-          }
-          return result[0];
-        },
-        autograd_output,
-        autograd_input,
-        grad_output[0]);
-
+    std::vector<at::Tensor> grads = torch::autograd::grad(
+        flatten(get_nested_tensor_structure(saved_data[2])),
+        inputs,
+        flatten(get_nested_tensor_structure(grad_output[0])),
+        c10::nullopt,
+        false,
+        true);
     at::Tensor undef;
-    return {grad,
-            weight_grad ? *weight_grad : undef,
-            bias_grad ? *bias_grad : undef,
+    at::Tensor grad_weight = weight.defined() ? grads[num_constituents] : undef;
+    at::Tensor grad_bias = bias.defined() ? grads.back() : undef;
+    grads.resize(num_constituents);
+    return {wrap_tensor_node(unflatten(input_structure, std::move(grads))),
+            grad_weight,
+            grad_bias,
             undef,
             undef,
             undef,
@@ -142,6 +438,18 @@ Tensor NestedTensor_batch_norm(
     double momentum,
     double eps,
     bool cudnn_enabled) {
+  if (impl::use_packed_batch_norm(
+          input, weight, bias, running_mean, running_var)) {
+    return NestedTensorFunction_packed_batch_norm::apply(
+        pack_nested_tensor(input),
+        weight,
+        bias,
+        running_mean,
+        running_var,
+        training,
+        momentum,
+        eps);
+  }
   return NestedTensorFunction_batch_norm::apply(
       input,
       weight,
@@ -4,11 +4,68 @@ namespace at {
 
 using namespace torch::nested_tensor;
 
+// Maps the elementwise binary function fn over self and other. If one of them
+// is a regular Tensor that broadcasts against the trailing dimensions of the
+// other (see _buffer_broadcast_shape) fn is applied to the buffer view and the
+// regular Tensor once. The gradient of the regular Tensor is then reduced by
+// autograd as part of that single call. If it broadcasts one entry per
+// constituent (see _is_segment_broadcast) fn is applied to the rows of each
+// constituent in the buffer or, if those aren't regular, to each constituent.
+template <class F>
+Tensor _map_binary(F&& fn, const Tensor& self, const Tensor& other) {
+  bool self_is_nested = is_nested_tensor_impl(self);
+  c10::optional<std::vector<int64_t>> shape = self_is_nested
+      ? _buffer_broadcast_shape(self, other)
+      : _buffer_broadcast_shape(other, self);
+  if (shape) {
+    trace_packed("broadcast binary op");
+    return autograd_map_packed_nested_tensor(
+        [&fn, &shape, self_is_nested](Tensor s, Tensor o) {
+          if (self_is_nested) {
+            return fn(s.view(*shape), o).reshape({-1});
+          }
+          return fn(s, o.view(*shape)).reshape({-1});
+        },
+        self,
+        other);
+  }
+  c10::optional<SegmentBroadcast> segment_broadcast = self_is_nested
+      ? _segment_broadcast(self, other)
+      : _segment_broadcast(other, self);
+  if (segment_broadcast) {
+    trace_packed("segment broadcast binary op");
+    // The segment broadcast needs the buffer, so pack self or other if
+    // necessary.
+    return autograd_map_packed_nested_tensor(
+        [&fn, &segment_broadcast, self_is_nested](Tensor s, Tensor o) {
+          if (self_is_nested) {
+            return _map_segments(fn, s, o, *segment_broadcast, true);
+          }
+          return _map_segments(fn, o, s, *segment_broadcast, false);
+        },
+        self_is_nested ? self.contiguous() : self,
+        self_is_nested ? other : other.contiguous());
+  }
+  if (self_is_nested && _is_segment_broadcast(self, other)) {
+    return autograd_map_nested_tensor(
+        std::move(fn), self, _segments_as_nested_tensor(other));
+  }
+  if (!self_is_nested && _is_segment_broadcast(other, self)) {
+    return autograd_map_nested_tensor(
+        std::move(fn), _segments_as_nested_tensor(self), other);
+  }
+  return autograd_map_elementwise_nested_tensor(std::move(fn), self, other);
+}
+
 template <Tensor& (*func)(Tensor&, const Tensor&)>
 Tensor& NestedTensor_binary_(Tensor& self_, const Tensor& other_) {
   at::Tensor self;
   at::Tensor other;
   std::tie(self, other) = _expand_other_as(self_, other_);
+  if (_apply_binary_to_buffer_(
+          [](Tensor& s, const Tensor& o) { func(s, o); }, self, other)) {
+    return self_;
+  }
   apply_nested_tensor(
       [](Tensor& tensor, const Tensor other) { func(tensor, other); },
       self,
@@ -18,7 +75,7 @@ Tensor& NestedTensor_binary_(Tensor& self_, const Tensor& other_) {
 
 template <Tensor (*func)(const Tensor&, Scalar)>
 Tensor NestedTensor_binary_scalar(const Tensor& self, Scalar other) {
-  return autograd_map_nested_tensor(
+  return autograd_map_elementwise_nested_tensor(
       [&other](Tensor self) { return func(self, other); }, self);
 }
 
@@ -27,7 +84,7 @@ Tensor NestedTensor_binary(const Tensor& self_, const Tensor& other_) {
   at::Tensor self;
   at::Tensor other;
   std::tie(self, other) = _expand_other_as(self_, other_);
-  return autograd_map_nested_tensor(
+  return _map_binary(
       [](Tensor s, Tensor o) { return func(s, o); }, self, other);
 }
 
@@ -39,7 +96,7 @@ Tensor NestedTensor_binary(
   at::Tensor self;
   at::Tensor other;
   std::tie(self, other) = _expand_other_as(self_, other_);
-  return autograd_map_nested_tensor(
+  return _map_binary(
       [&scalar](Tensor self, Tensor other) {
         return func(self, other, scalar);
       },
@@ -61,6 +118,11 @@ Tensor& NestedTensor_binary_out(
   TORCH_CHECK(
       is_nested_tensor_impl(result, self, other),
       "binary_out doesn't support non-NT arguments.")
+  if (can_apply_to_buffers(result, self, other)) {
+    at::Tensor result_buffer = get_buffer(result);
+    func(result_buffer, get_buffer(self), get_buffer(other));
+    return result;
+  }
   apply_nested_tensor(
       [](Tensor& result, Tensor& tensor, Tensor& other) {
         return func(result, tensor, other);
@@ -80,8 +142,8 @@ struct NestedTensorFunction_packed_add
       Scalar alpha) {
     ctx->saved_data["0"] = alpha;
     return wrap_tensor_node(torch::nested_tensor::impl::build_structure(
-        at::add(get_buffer(self), get_buffer(other)),
-        get_nested_tensor_impl(self)->nested_size()));
+        at::add(get_buffer(self), get_buffer(other), alpha),
+        get_nested_tensor_impl(self)->flat_nested_size()));
   }
   static torch::autograd::variable_list backward(
       torch::autograd::AutogradContext* ctx,
@@ -107,13 +169,11 @@ Tensor NestedTensor_add(
   at::Tensor self;
   at::Tensor other;
   std::tie(self, other) = _expand_other_as(self_, other_);
-  if (is_packed(self, other) && nested_size_matches(self, other)) {
-#ifdef TRACEPACKED
-    std::cout << "calling packed add" << std::endl;
-#endif
+  if (is_nested_tensor_impl(self, other) && can_apply_to_buffers(self, other)) {
+    trace_packed("add");
     return NestedTensorFunction_packed_add::apply(self, other, alpha);
   }
-  return autograd_map_nested_tensor(
+  return _map_binary(
       [&alpha](at::Tensor s, at::Tensor o) { return at::add(s, o, alpha); },
       self,
       other);
@@ -123,6 +183,12 @@ Tensor& NestedTensor_add_(Tensor& self, const Tensor& other, Scalar alpha) {
   // at::Tensor self;
   // at::Tensor other;
   // std::tie(self, other) = _expand_other_as(self_, other_);
+  if (_apply_binary_to_buffer_(
+          [&alpha](Tensor& s, const Tensor& o) { at::native::add_(s, o, alpha); },
+          self,
+          other)) {
+    return self;
+  }
   apply_nested_tensor(
       [&](at::Tensor& s, at::Tensor o) { at::native::add_(s, o, alpha); },
       self,
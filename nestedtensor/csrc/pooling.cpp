@@ -1,3 +1,4 @@
+#include <nestedtensor/csrc/bucketing.h>
 #include <nestedtensor/csrc/nested_tensor_impl.h>
 #include <nestedtensor/csrc/utils/nested_node_functions.h>
 #include <torch/extension.h>
@@ -11,7 +12,7 @@ namespace at {
 Tensor NestedTensor_adaptive_avg_pool2d(
     at::Tensor const& input,
     IntArrayRef output_size) {
-  return autograd_map_nested_tensor(
+  return autograd_map_size_buckets(
       [&output_size](at::Tensor input) {
         return at::native::adaptive_avg_pool2d(input, output_size);
       },
@@ -25,16 +26,10 @@ Tensor NestedTensor_max_pool2d(
     IntArrayRef padding,
     IntArrayRef dilation,
     bool ceil_mode) {
-  return autograd_map_nested_tensor(
+  return autograd_map_size_buckets(
       [&](at::Tensor t) {
         return at::max_pool2d(
-                   t.unsqueeze(0),
-                   kernel_size,
-                   stride,
-                   padding,
-                   dilation,
-                   ceil_mode)
-            .squeeze(0);
+            t, kernel_size, stride, padding, dilation, ceil_mode);
       },
       self);
 }
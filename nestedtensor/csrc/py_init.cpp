@@ -1,4 +1,5 @@
 #include <nestedtensor/csrc/creation.h>
+#include <nestedtensor/csrc/kv_cache.h>
 #include <nestedtensor/csrc/nested_tensor_impl.h>
 #include <nestedtensor/csrc/python_functions.h>
 #include <nestedtensor/csrc/utils/nested_node_functions.h>
@@ -215,6 +216,42 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m) {
 
   m.def("nested_tensor_impl", &torch::nested_tensor::nested_tensor_impl);
 
+  m.def("get_parallel_grain_size", &at::get_parallel_grain_size);
+  m.def("set_parallel_grain_size", &at::set_parallel_grain_size);
+
+  py::enum_<at::PackedMode>(m, "PackedMode")
+      .value("Auto", at::PackedMode::Auto)
+      .value("Always", at::PackedMode::Always)
+      .value("Never", at::PackedMode::Never);
+  m.def("get_packed_mode", &at::get_packed_mode);
+  m.def("set_packed_mode", &at::set_packed_mode);
+  m.def("get_thread_local_packed_mode", &at::get_thread_local_packed_mode);
+  m.def("set_thread_local_packed_mode", &at::set_thread_local_packed_mode);
+  m.def("get_trace_packed", &at::get_trace_packed);
+  m.def("set_trace_packed", &at::set_trace_packed);
+
+  py::class_<RaggedKVCache>(m, "RaggedKVCache")
+      .def(py::init<int64_t, int64_t, int64_t, int64_t, Tensor>())
+      .def("append", &RaggedKVCache::append)
+      .def("add_sequences", &RaggedKVCache::add_sequences)
+      .def("remove", &RaggedKVCache::remove)
+      .def("attention", &RaggedKVCache::attention)
+      .def("num_sequences", &RaggedKVCache::num_sequences)
+      .def("lengths", &RaggedKVCache::lengths)
+      .def("starts", &RaggedKVCache::starts)
+      .def("key_buffer", &RaggedKVCache::key_buffer)
+      .def("value_buffer", &RaggedKVCache::value_buffer);
+
+  // Debug counters of the metadata cached by NestedTensorImpl. These only
+  // count the reads and constructions of the calling thread.
+  m.def("_metadata_cache_stats", []() {
+    return std::make_tuple(at::metadata_cache_hits, at::metadata_cache_misses);
+  });
+  m.def("_reset_metadata_cache_stats", []() {
+    at::metadata_cache_hits = 0;
+    at::metadata_cache_misses = 0;
+  });
+
   // Need to overwrite because
   // https://github.com/pytorch/pytorch/blob/09660896c0dd2bec888857300a7be9edb52dd05d/aten/src/ATen/TensorIndexing.h#L480
   // requires sizes() for non Tensor-shape compliant NestedTensors
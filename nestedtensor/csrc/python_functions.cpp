@@ -1,3 +1,4 @@
+#include <nestedtensor/csrc/bucketing.h>
 #include <nestedtensor/csrc/nested_tensor_impl.h>
 #include <nestedtensor/csrc/python_args.h>
 #include <nestedtensor/csrc/python_functions.h>
@@ -77,9 +78,9 @@ at::Tensor interpolate(
   // Either scale factor or size can be passed
   if (scale_factor.has_value()) {
     options = options.scale_factor(scale_factor.value().vec());
-    return autograd_map_nested_tensor(
+    return autograd_map_size_buckets(
         [&options](at::Tensor input_tensor) {
-          return F::interpolate(input_tensor.unsqueeze(0), options).squeeze(0);
+          return F::interpolate(input_tensor, options);
         },
         input);
   }
@@ -98,14 +99,15 @@ at::Tensor interpolate(
     }
 
     if (size.value().size() == 1) {
-      return autograd_map_nested_tensor(
-          [&options, &size](at::Tensor input_tensor) {
-            options = options.size(size.value()[0]);
-            return F::interpolate(input_tensor.unsqueeze(0), options)
-                .squeeze(0);
+      options = options.size(size.value()[0]);
+      return autograd_map_size_buckets(
+          [&options](at::Tensor input_tensor) {
+            return F::interpolate(input_tensor, options);
           },
           input);
     } else {
+      // NOTE: The function below writes to options and size_i and must visit
+      // the constituents in order.
       int size_i = 0;
       return autograd_map_nested_tensor(
           [&options, &size_i, &size](at::Tensor input_tensor) {
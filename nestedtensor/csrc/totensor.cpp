@@ -13,23 +13,9 @@ namespace at {
 using namespace torch::nested_tensor;
 using namespace c10;
 
-at::Tensor _to_tensor(TensorNode node) {
-  // TODO: Recursive stacking is expensive.
-  if (node.is_leaf()) {
-    return node.payload();
-  }
-  if (node.degree() == 0) {
-    return at::empty({0});
-  }
-  std::vector<at::Tensor> flat;
-  for (auto child : node.unbind()) {
-    flat.push_back(_to_tensor(child));
-  }
-  return stack(flat);
-}
-
-at::Tensor to_tensor(NestedTensorImpl* nt_impl) {
-  // TODO: Not necessarily a view because of stack and reshape.
+// Returns the size of the Tensor that holds all constituents of nt_impl,
+// which must all be of the same size.
+std::vector<int64_t> _to_tensor_size(NestedTensorImpl* nt_impl) {
   std::vector<int64_t> new_size;
   for (const auto& si : nt_impl->opt_sizes()) {
     if (!si) {
@@ -40,7 +26,44 @@ at::Tensor to_tensor(NestedTensorImpl* nt_impl) {
     }
     new_size.push_back(*si);
   }
-  return _to_tensor(nt_impl->get_structure());
+  return new_size;
+}
+
+// The constituents of a packed and contiguous NestedTensor of regular size
+// already are in the order of the rows of the result, so its buffer is
+// returned as a view. Otherwise the result is allocated once from the cached
+// sizes and each constituent is copied into its slot, concurrently if a
+// parallel grain size is set.
+at::Tensor _to_tensor(const at::Tensor& tensor) {
+  auto nt_impl = get_nested_tensor_impl(tensor);
+  std::vector<int64_t> new_size = _to_tensor_size(nt_impl);
+  int64_t numel = 1;
+  for (int64_t size : new_size) {
+    numel *= size;
+  }
+  if (is_packed(tensor) && tensor.is_contiguous()) {
+    at::Tensor buffer = get_buffer(tensor);
+    if (buffer.is_contiguous() && buffer.numel() == numel) {
+      return buffer.view(new_size);
+    }
+  }
+  at::Tensor result = at::empty(new_size, tensor.options());
+  if (numel == 0) {
+    return result;
+  }
+  TensorNode result_structure = torch::nested_tensor::impl::build_structure(
+      result.view({-1}), nt_impl->flat_nested_size());
+  parallel_apply(
+      get_parallel_grain_size(),
+      [](at::Tensor out, at::Tensor in) { out.copy_(in); },
+      result_structure,
+      nt_impl->get_structure());
+  return result;
+}
+
+at::Tensor to_tensor(NestedTensorImpl* nt_impl) {
+  TensorNode structure = nt_impl->get_structure();
+  return _to_tensor(wrap_tensor_node(std::move(structure)));
 }
 
 struct NestedTensorFunction_to_tensor
@@ -48,20 +71,8 @@ struct NestedTensorFunction_to_tensor
   static Tensor forward(
       torch::autograd::AutogradContext* ctx,
       const Tensor& input) {
-    // TODO: Not necessarily a view because of stack and reshape.
-    std::vector<int64_t> new_size;
-    auto impl_data = get_nested_tensor_impl(input);
-    for (const auto& si : impl_data->opt_sizes()) {
-      if (!si) {
-        // TODO: This assumes we'll extend to_tensor to also work with int64_t
-        // at this level.
-        throw std::out_of_range(
-            "to_tensor()/to_tensor(0) only works if there is no None in size().");
-      }
-      new_size.push_back(*si);
-    }
     ctx->save_for_backward({input});
-    return _to_tensor(impl_data->get_structure());
+    return _to_tensor(input);
   }
   static torch::autograd::variable_list backward(
       torch::autograd::AutogradContext* ctx,
@@ -70,9 +81,11 @@ struct NestedTensorFunction_to_tensor
     auto saved = ctx->get_saved_variables();
     at::Tensor input = saved[0];
     at::Tensor grad_output = grad_output_[0];
+    // The gradient is returned as a packed NestedTensor whose buffer is
+    // grad_output itself, unless that isn't contiguous.
     return {wrap_tensor_node(torch::nested_tensor::impl::build_structure(
-        std::move(grad_output.clone().reshape({-1})),
-        get_nested_tensor_impl(input)->nested_size()))};
+        grad_output.contiguous().view({-1}),
+        get_nested_tensor_impl(input)->flat_nested_size()))};
   }
 };
 
@@ -0,0 +1,560 @@
+#pragma once
+#include <ATen/Parallel.h>
+#include <ATen/ThreadLocalState.h>
+#include <c10/util/ArrayRef.h>
+#include <c10/util/C++17.h>
+#include <nestedtensor/csrc/utils/nested_node.h>
+#include <memory>
+
+namespace torch {
+namespace nested_tensor {
+
+// NOTE: NestedNode stores its children as a vector of NestedNodes. Every
+// traversal chases pointers and every map allocates one node per constituent.
+// The types in this file describe the same trees using a handful of contiguous
+// arrays instead. The shape of a tree is stored once in a NestedStructure,
+// which is immutable and shared by all FlatNestedNodes derived from it.
+
+// Offset based (CSR-style) description of the shape of a NestedNode.
+//
+// Level 0 holds the root. The children of node j of level l are the nodes
+// [offsets(l)[j], offsets(l)[j + 1]) of level l + 1. The last level holds the
+// leaves in the same order in which flatten returns them. A structure of
+// height 0 describes a single leaf and carries no offsets.
+//
+// NOTE: All leaves must be at the same depth, but internal nodes at any
+// level may have no children, e.g. for nested_tensor([[], [t]]).
+struct NestedStructure {
+  explicit NestedStructure(std::vector<std::vector<int64_t>>&& offsets)
+      : _offsets(std::move(offsets)) {}
+  inline int64_t height() const {
+    return _offsets.size();
+  }
+  inline int64_t degree() const {
+    if (_offsets.size() == 0) {
+      return 0;
+    }
+    return _offsets[0][1];
+  }
+  inline int64_t num_leaves() const {
+    if (_offsets.size() == 0) {
+      return 1;
+    }
+    return _offsets.back().back();
+  }
+  inline const std::vector<int64_t>& offsets(int64_t level) const {
+    return _offsets[level];
+  }
+  inline bool operator==(const NestedStructure& other) const {
+    return _offsets == other._offsets;
+  }
+
+ private:
+  std::vector<std::vector<int64_t>> _offsets;
+};
+
+using NestedStructurePtr = std::shared_ptr<const NestedStructure>;
+
+template <typename T>
+struct FlatNestedNode {
+  FlatNestedNode(NestedStructurePtr structure, std::vector<T>&& leaves)
+      : _structure(std::move(structure)), _leaves(std::move(leaves)) {
+    TORCH_CHECK(
+        _structure->num_leaves() == (int64_t)(_leaves.size()),
+        "Number of leaves doesn't match given structure.");
+  }
+  inline int64_t height() const {
+    return _structure->height();
+  }
+  inline int64_t degree() const {
+    return _structure->degree();
+  }
+  inline int64_t num_leaves() const {
+    return _leaves.size();
+  }
+  inline const T& leaf(int64_t i) const {
+    return _leaves[i];
+  }
+  inline T& leaf(int64_t i) {
+    return _leaves[i];
+  }
+  inline const std::vector<T>& leaves() const {
+    return _leaves;
+  }
+  inline const NestedStructurePtr& structure() const {
+    return _structure;
+  }
+
+ private:
+  NestedStructurePtr _structure;
+  std::vector<T> _leaves;
+};
+
+// Flat representation of nested sizes or strides. The entries of all leaves
+// are stored in a single vector and the entries of leaf i are the slice
+// [leaf_offsets[i], leaf_offsets[i + 1]) of it. This avoids the heap
+// allocation a c10::List<int64_t> requires per constituent.
+struct FlatSizeNode {
+  FlatSizeNode(
+      NestedStructurePtr structure,
+      std::vector<int64_t>&& leaf_offsets,
+      std::vector<int64_t>&& values)
+      : _structure(std::move(structure)),
+        _leaf_offsets(std::move(leaf_offsets)),
+        _values(std::move(values)) {
+    TORCH_CHECK(
+        _structure->num_leaves() + 1 == (int64_t)(_leaf_offsets.size()),
+        "Number of leaves doesn't match given structure.");
+  }
+  inline int64_t height() const {
+    return _structure->height();
+  }
+  inline int64_t degree() const {
+    return _structure->degree();
+  }
+  inline int64_t num_leaves() const {
+    return _leaf_offsets.size() - 1;
+  }
+  inline c10::IntArrayRef leaf(int64_t i) const {
+    return c10::IntArrayRef(
+        _values.data() + _leaf_offsets[i],
+        _leaf_offsets[i + 1] - _leaf_offsets[i]);
+  }
+  inline const NestedStructurePtr& structure() const {
+    return _structure;
+  }
+
+ private:
+  NestedStructurePtr _structure;
+  std::vector<int64_t> _leaf_offsets;
+  std::vector<int64_t> _values;
+};
+
+template <class A>
+struct is_flat_nested_node : std::false_type {};
+
+template <class T>
+struct is_flat_nested_node<FlatNestedNode<T>> : std::true_type {};
+
+template <>
+struct is_flat_nested_node<FlatSizeNode> : std::true_type {};
+
+template <class... A>
+using are_flat_nested_nodes =
+    c10::guts::conjunction<is_flat_nested_node<std::decay_t<A>>...>;
+
+namespace impl {
+
+template <class T>
+inline NestedStructurePtr make_structure(const NestedNode<T>& nested_node) {
+  std::vector<std::vector<int64_t>> offsets;
+  std::vector<const NestedNode<T>*> level;
+  level.push_back(&nested_node);
+  for (int64_t l = 0; l < nested_node.height(); l++) {
+    std::vector<int64_t> level_offsets;
+    level_offsets.reserve(level.size() + 1);
+    level_offsets.push_back(0);
+    std::vector<const NestedNode<T>*> next_level;
+    for (const NestedNode<T>* node : level) {
+      TORCH_CHECK(
+          !node->is_leaf(),
+          "All leaves of a NestedNode need to be at the same depth.");
+      for (const auto& child : node->unbind()) {
+        next_level.push_back(&child);
+      }
+      level_offsets.push_back(next_level.size());
+    }
+    offsets.push_back(std::move(level_offsets));
+    level = std::move(next_level);
+  }
+  for (const NestedNode<T>* node : level) {
+    TORCH_CHECK(
+        node->is_leaf(),
+        "All leaves of a NestedNode need to be at the same depth.");
+  }
+  return std::make_shared<const NestedStructure>(std::move(offsets));
+}
+
+template <class T>
+inline NestedNode<T> _unflatten_level(
+    const NestedStructure& structure,
+    int64_t level,
+    int64_t index,
+    std::vector<T>& leaves) {
+  if (level == structure.height()) {
+    return NestedNode<T>(std::move(leaves[index]));
+  }
+  const std::vector<int64_t>& offsets = structure.offsets(level);
+  std::vector<NestedNode<T>> children;
+  children.reserve(offsets[index + 1] - offsets[index]);
+  for (int64_t i = offsets[index]; i < offsets[index + 1]; i++) {
+    children.emplace_back(_unflatten_level(structure, level + 1, i, leaves));
+  }
+  return NestedNode<T>(std::move(children));
+}
+
+// Inverse of flatten given a NestedStructure.
+template <class T>
+inline NestedNode<T> unflatten(
+    const NestedStructure& structure,
+    std::vector<T>&& leaves) {
+  TORCH_CHECK(
+      structure.num_leaves() == (int64_t)(leaves.size()),
+      "Number of leaves doesn't match given structure.");
+  return _unflatten_level(structure, 0, 0, leaves);
+}
+
+inline bool structure_matches(
+    const NestedStructurePtr& a,
+    const NestedStructurePtr& b) {
+  return a == b || *a == *b;
+}
+
+template <class N>
+inline const NestedStructurePtr& first_structure(const N& nested_node) {
+  return nested_node.structure();
+}
+
+template <class N, class... M>
+inline const NestedStructurePtr& first_structure(
+    const N& nested_node,
+    const M&... other) {
+  // Leaves broadcast, so the result takes the shape of the first tree.
+  if (nested_node.height() > 0) {
+    return nested_node.structure();
+  }
+  return first_structure(other...);
+}
+
+template <class N>
+inline auto flat_leaf(N& nested_node, int64_t i)
+    -> decltype(nested_node.leaf(i)) {
+  return nested_node.leaf(nested_node.height() == 0 ? 0 : i);
+}
+
+template <class... N>
+inline bool is_broadcastable(
+    const NestedStructurePtr& structure,
+    const N&... nested_node) {
+  bool result = true;
+  c10::guts::tuple_map(
+      std::forward_as_tuple(nested_node...),
+      [&result, &structure](const auto& n) {
+        result = result &&
+            (n.height() == 0 || structure_matches(structure, n.structure()));
+        return nullptr;
+      });
+  return result;
+}
+
+template <class... N>
+inline void check_broadcastable(
+    const NestedStructurePtr& structure,
+    const N&... nested_node) {
+  c10::guts::tuple_map(
+      std::forward_as_tuple(nested_node...), [&structure](const auto& n) {
+        TORCH_CHECK(
+            n.height() == 0 || structure_matches(structure, n.structure()),
+            "NestedNodes don't broadcast.");
+        return nullptr;
+      });
+}
+
+inline int64_t numel(c10::IntArrayRef size) {
+  int64_t result = 1;
+  for (int64_t s : size) {
+    result *= s;
+  }
+  return result;
+}
+
+// Entry i is the offset of constituent i within a contiguous buffer. The last
+// entry is the number of elements of the buffer.
+inline std::vector<int64_t> contiguous_offsets(const FlatSizeNode& nested_size) {
+  std::vector<int64_t> result;
+  result.reserve(nested_size.num_leaves() + 1);
+  int64_t offset = 0;
+  result.push_back(offset);
+  for (int64_t i = 0; i < nested_size.num_leaves(); i++) {
+    offset += numel(nested_size.leaf(i));
+    result.push_back(offset);
+  }
+  return result;
+}
+
+template <class F>
+inline FlatSizeNode _flat_sizes(
+    NestedStructurePtr structure,
+    const std::vector<at::Tensor>& leaves,
+    F&& fn) {
+  std::vector<int64_t> leaf_offsets;
+  std::vector<int64_t> values;
+  leaf_offsets.reserve(leaves.size() + 1);
+  leaf_offsets.push_back(0);
+  if (leaves.size() > 0) {
+    values.reserve(leaves.size() * leaves[0].dim());
+  }
+  for (const auto& leaf : leaves) {
+    for (int64_t s : fn(leaf)) {
+      values.push_back(s);
+    }
+    leaf_offsets.push_back(values.size());
+  }
+  return FlatSizeNode(
+      std::move(structure), std::move(leaf_offsets), std::move(values));
+}
+
+} // namespace impl
+
+template <class T>
+inline FlatNestedNode<T> to_flat(const NestedNode<T>& nested_node) {
+  return FlatNestedNode<T>(
+      impl::make_structure(nested_node), flatten(nested_node));
+}
+
+inline FlatSizeNode to_flat(const SizeNode& nested_node) {
+  std::vector<int64_t> leaf_offsets;
+  std::vector<int64_t> values;
+  leaf_offsets.push_back(0);
+  for (const auto& size : flatten(nested_node)) {
+    for (int64_t s : size) {
+      values.push_back(s);
+    }
+    leaf_offsets.push_back(values.size());
+  }
+  return FlatSizeNode(
+      impl::make_structure(nested_node),
+      std::move(leaf_offsets),
+      std::move(values));
+}
+
+inline FlatSizeNode flat_nested_size(const FlatNestedNode<at::Tensor>& node) {
+  return impl::_flat_sizes(
+      node.structure(), node.leaves(), [](const at::Tensor& t) {
+        return t.sizes();
+      });
+}
+
+inline FlatSizeNode flat_nested_stride(const FlatNestedNode<at::Tensor>& node) {
+  return impl::_flat_sizes(
+      node.structure(), node.leaves(), [](const at::Tensor& t) {
+        return t.strides();
+      });
+}
+
+template <class T>
+inline NestedNode<T> from_flat(const FlatNestedNode<T>& nested_node) {
+  std::vector<T> leaves = nested_node.leaves();
+  return impl::unflatten(*nested_node.structure(), std::move(leaves));
+}
+
+inline SizeNode from_flat(const FlatSizeNode& nested_node) {
+  std::vector<c10::List<int64_t>> leaves;
+  leaves.reserve(nested_node.num_leaves());
+  for (int64_t i = 0; i < nested_node.num_leaves(); i++) {
+    leaves.emplace_back(c10::List<int64_t>(nested_node.leaf(i)));
+  }
+  return impl::unflatten(*nested_node.structure(), std::move(leaves));
+}
+
+template <class T>
+inline std::vector<T> flatten(const FlatNestedNode<T>& nested_node) {
+  return nested_node.leaves();
+}
+
+// NOTE: The returned ArrayRefs point into nested_node.
+inline std::vector<c10::IntArrayRef> flatten(const FlatSizeNode& nested_node) {
+  std::vector<c10::IntArrayRef> result;
+  result.reserve(nested_node.num_leaves());
+  for (int64_t i = 0; i < nested_node.num_leaves(); i++) {
+    result.push_back(nested_node.leaf(i));
+  }
+  return result;
+}
+
+template <class... N>
+inline std::enable_if_t<are_flat_nested_nodes<N...>::value, bool>
+shape_matches(const N&... nested_node) {
+  const NestedStructurePtr& structure =
+      std::get<0>(std::forward_as_tuple(nested_node...)).structure();
+  bool result = true;
+  c10::guts::tuple_map(
+      std::forward_as_tuple(nested_node...),
+      [&result, &structure](const auto& n) {
+        result = result && impl::structure_matches(structure, n.structure());
+        return nullptr;
+      });
+  return result;
+}
+
+// NOTE: Just like map for NestedNodes, leaves broadcast against trees.
+template <class F, class... N>
+inline std::enable_if_t<
+    are_flat_nested_nodes<N...>::value,
+    FlatNestedNode<std::decay_t<decltype(std::declval<F>()(
+        impl::flat_leaf(std::declval<const N&>(), 0)...))>>>
+map(F&& fn, const N&... nested_node) {
+  using R = std::decay_t<decltype(fn(impl::flat_leaf(nested_node, 0)...))>;
+  const NestedStructurePtr& structure = impl::first_structure(nested_node...);
+  impl::check_broadcastable(structure, nested_node...);
+  int64_t num_leaves = structure->num_leaves();
+  std::vector<R> result;
+  result.reserve(num_leaves);
+  for (int64_t i = 0; i < num_leaves; i++) {
+    result.emplace_back(fn(impl::flat_leaf(nested_node, i)...));
+  }
+  return FlatNestedNode<R>(structure, std::move(result));
+}
+
+template <class F, class... N>
+inline std::enable_if_t<are_flat_nested_nodes<N...>::value> apply(
+    F&& fn,
+    const N&... nested_node) {
+  const NestedStructurePtr& structure = impl::first_structure(nested_node...);
+  impl::check_broadcastable(structure, nested_node...);
+  int64_t num_leaves = structure->num_leaves();
+  for (int64_t i = 0; i < num_leaves; i++) {
+    fn(impl::flat_leaf(nested_node, i)...);
+  }
+}
+
+template <class F, class A, class N>
+inline std::enable_if_t<are_flat_nested_nodes<N>::value, A>
+reduce(const N& nested_node, F fn, A ident) {
+  A result = ident;
+  for (int64_t i = 0; i < nested_node.num_leaves(); i++) {
+    result = fn(nested_node.leaf(i), result);
+  }
+  return result;
+}
+
+namespace impl {
+
+// Same as build_structure for SizeNodes, but constructs the views directly
+// from offsets into the buffer instead of splitting it.
+inline TensorNode build_structure(
+    at::Tensor&& buffer,
+    const FlatSizeNode& nested_size) {
+  TORCH_CHECK(
+      buffer.dim() == 1, "Given buffer must be vector, i.e. dim 1 Tensor.");
+  if (!buffer.is_contiguous()) {
+    buffer = buffer.contiguous();
+  }
+  std::vector<at::Tensor> leaves;
+  leaves.reserve(nested_size.num_leaves());
+  std::vector<int64_t> stride;
+  int64_t offset = 0;
+  for (int64_t i = 0; i < nested_size.num_leaves(); i++) {
+    c10::IntArrayRef size = nested_size.leaf(i);
+    stride.resize(size.size());
+    int64_t p = 1;
+    for (int64_t j = size.size() - 1; j >= 0; j--) {
+      stride[j] = p;
+      p *= size[j];
+    }
+    leaves.push_back(at::as_strided(
+        buffer, size, stride, buffer.storage_offset() + offset));
+    offset += p;
+  }
+  TORCH_CHECK(
+      offset == buffer.numel(),
+      "Size of buffer doesn't match number of elements given by nested size.");
+  return TensorNode(
+      unflatten(*nested_size.structure(), std::move(leaves)),
+      std::move(buffer));
+}
+
+} // namespace impl
+
+// Same as map, but the leaves are visited concurrently by at::parallel_for in
+// chunks of at least grain_size leaves. Only use this with functions that
+// don't depend on the order in which leaves are visited, e.g. because they
+// accumulate into a shared Tensor. A grain_size of 0 or a call from within a
+// parallel region falls back to map.
+//
+// NOTE: Each chunk runs under the ThreadLocalState of the calling thread, so
+// GradMode, dispatch key exclusions etc. carry over to the worker threads.
+template <class F, class... A>
+inline NestedNode<
+    typename c10::guts::infer_function_traits<F>::type::return_type>
+parallel_map(
+    int64_t grain_size,
+    F&& fn,
+    const NestedNode<A>&... nested_node) {
+  using R = typename c10::guts::infer_function_traits<F>::type::return_type;
+  if (grain_size <= 0 || at::in_parallel_region()) {
+    return map(std::move(fn), nested_node...);
+  }
+  auto flat = std::make_tuple(to_flat(nested_node)...);
+  NestedStructurePtr structure = c10::guts::apply(
+      [](const auto&... f) { return impl::first_structure(f...); }, flat);
+  if (!c10::guts::apply(
+          [&structure](const auto&... f) {
+            return impl::is_broadcastable(structure, f...);
+          },
+          flat)) {
+    // Let map deal with broadcasting of single children.
+    return map(std::move(fn), nested_node...);
+  }
+  std::vector<R> result(structure->num_leaves());
+  at::ThreadLocalState state;
+  at::parallel_for(
+      0, structure->num_leaves(), grain_size, [&](int64_t begin, int64_t end) {
+        at::ThreadLocalStateGuard guard(state);
+        for (int64_t i = begin; i < end; i++) {
+          result[i] = c10::guts::apply(
+              [&fn, i](auto&... f) { return fn(impl::flat_leaf(f, i)...); },
+              flat);
+        }
+      });
+  return impl::unflatten(*structure, std::move(result));
+}
+
+// Same as apply, but the leaves are visited concurrently. See parallel_map.
+template <class F, class... A>
+inline void parallel_apply(
+    int64_t grain_size,
+    F&& fn,
+    NestedNode<A>... nested_node) {
+  if (grain_size <= 0 || at::in_parallel_region()) {
+    apply(std::move(fn), nested_node...);
+    return;
+  }
+  auto flat = std::make_tuple(to_flat(nested_node)...);
+  NestedStructurePtr structure = c10::guts::apply(
+      [](const auto&... f) { return impl::first_structure(f...); }, flat);
+  if (!c10::guts::apply(
+          [&structure](const auto&... f) {
+            return impl::is_broadcastable(structure, f...);
+          },
+          flat)) {
+    apply(std::move(fn), nested_node...);
+    return;
+  }
+  at::ThreadLocalState state;
+  at::parallel_for(
+      0, structure->num_leaves(), grain_size, [&](int64_t begin, int64_t end) {
+        at::ThreadLocalStateGuard guard(state);
+        for (int64_t i = begin; i < end; i++) {
+          c10::guts::apply(
+              [&fn, i](auto&... f) { fn(impl::flat_leaf(f, i)...); }, flat);
+        }
+      });
+}
+
+inline TensorNode pack(TensorNode&& structure) {
+  FlatNestedNode<at::Tensor> flat = to_flat(structure);
+  FlatSizeNode nested_size = flat_nested_size(flat);
+  if (flat.num_leaves() == 0) {
+    return impl::build_structure(at::ones({0}), nested_size);
+  }
+  std::vector<at::Tensor> tensors;
+  tensors.reserve(flat.num_leaves());
+  for (const auto& tensor : flat.leaves()) {
+    tensors.push_back(tensor.reshape({-1}));
+  }
+  return impl::build_structure(at::cat(tensors, 0), nested_size);
+}
+
+} // namespace nested_tensor
+} // namespace torch
@@ -37,10 +37,10 @@ struct NestedNode {
   inline int64_t height() const {
     return _height;
   }
-  inline const std::vector<NestedNode<T>> unbind() const {
+  inline const std::vector<NestedNode<T>>& unbind() const {
     return _children;
   }
-  inline NestedNode<T> children(size_t i) const {
+  inline const NestedNode<T>& children(size_t i) const {
     return _children[i];
   }
   inline const T& payload() const {
@@ -97,10 +97,10 @@ struct NestedNode<at::Tensor> {
   inline int64_t height() const {
     return _height;
   }
-  inline const std::vector<NestedNode<at::Tensor>> unbind() const {
+  inline const std::vector<NestedNode<at::Tensor>>& unbind() const {
     return _children;
   }
-  inline NestedNode<at::Tensor> children(size_t i) const {
+  inline const NestedNode<at::Tensor>& children(size_t i) const {
     return _children[i];
   }
   inline const at::Tensor& payload() const {
@@ -219,20 +219,21 @@ map(F&& fn, const NestedNode<B>&... nested_node) {
 }
 
 template <typename A>
-inline std::vector<A> flatten(NestedNode<A> nested_node) {
+inline void _flatten(const NestedNode<A>& nested_node, std::vector<A>& result) {
   if (nested_node.is_leaf()) {
-    std::vector<A> result;
     result.push_back(nested_node.payload());
-    return result;
-  } else {
-    std::vector<A> result;
-    for (size_t i = 0; i < nested_node.degree(); i++) {
-      for (auto tmp : flatten<A>(nested_node.children(i))) {
-        result.push_back(std::move(tmp));
-      }
-    }
-    return result;
+    return;
   }
+  for (size_t i = 0; i < nested_node.degree(); i++) {
+    _flatten<A>(nested_node.children(i), result);
+  }
+}
+
+template <typename A>
+inline std::vector<A> flatten(const NestedNode<A>& nested_node) {
+  std::vector<A> result;
+  _flatten<A>(nested_node, result);
+  return result;
 }
 
 template <class R, class A>
@@ -241,7 +242,7 @@ inline std::pair<int64_t, NestedNode<R>> _unflatten(
     const std::vector<R>& content,
     int64_t index) {
   if (structure.is_leaf()) {
-    at::Tensor tmp = content[index];
+    R tmp = content[index];
     return std::pair<int64_t, NestedNode<R>>(
         index + 1, NestedNode<R>(std::move(tmp)));
 
@@ -501,18 +502,5 @@ inline TensorNode build_structure(
 }
 } // namespace impl
 
-inline TensorNode pack(TensorNode&& structure) {
-  TensorNode flat_structure =
-      map([](at::Tensor tensor) { return tensor.reshape({-1}); }, structure);
-  auto nested_size =
-      map([](at::Tensor tensor) { return c10::List<int64_t>(tensor.sizes()); },
-          structure);
-  auto tensors = flatten(flat_structure);
-  if (tensors.size() == 0) {
-    return impl::build_structure(at::ones({0}), nested_size);
-  }
-  return impl::build_structure(at::cat(tensors, 0), nested_size);
-}
-
 } // namespace nested_tensor
 } // namespace torch
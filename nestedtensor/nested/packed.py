@@ -0,0 +1,47 @@
+import contextlib
+
+import nestedtensor
+
+_MODES = {
+    "auto": nestedtensor._C.PackedMode.Auto,
+    "always": nestedtensor._C.PackedMode.Always,
+    "never": nestedtensor._C.PackedMode.Never,
+}
+
+
+def _to_mode(mode):
+    if mode not in _MODES:
+        raise ValueError("Packed mode must be one of " +
+                         ", ".join(_MODES.keys()) + " but got " + str(mode))
+    return _MODES[mode]
+
+
+def _to_name(mode):
+    for name, value in _MODES.items():
+        if value == mode:
+            return name
+
+
+# Selects whether ops run on the buffer of packed NestedTensors.
+#  - "auto": Use packed kernels if the inputs are packed and contiguous.
+#  - "always": Like "auto", but also pack NestedTensors that aren't contiguous
+#    if that allows the use of a packed kernel.
+#  - "never": Always run on each constituent.
+def set_packed_mode(mode):
+    nestedtensor._C.set_packed_mode(_to_mode(mode))
+
+
+# Returns the packed mode of the current thread.
+def get_packed_mode():
+    return _to_name(nestedtensor._C.get_packed_mode())
+
+
+# Overrides the packed mode for the current thread within the context.
+@contextlib.contextmanager
+def packed_mode(mode):
+    prev_mode = nestedtensor._C.get_thread_local_packed_mode()
+    nestedtensor._C.set_thread_local_packed_mode(_to_mode(mode))
+    try:
+        yield
+    finally:
+        nestedtensor._C.set_thread_local_packed_mode(prev_mode)
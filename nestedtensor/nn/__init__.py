@@ -1,2 +1,7 @@
 from .mha import MultiheadAttention
 from .parameter import Parameter as NTParameter
+from .fusion import fold_conv_bn_eval
+from .fusion import fuse_conv_bn_eval
+from .fusion import Conv2dReLU
+from .kv_cache import RaggedKVCache
+from . import functional
@@ -0,0 +1,40 @@
+import torch
+import nestedtensor
+
+
+def masked_softmax(input, mask, dim):
+    """
+    Computes the softmax of input + mask along dim, where mask is a
+    NestedTensor of the same nested size as input. For packed NestedTensors
+    the sum isn't materialized and the backward runs on the packed buffers.
+    """
+    return nestedtensor.nested.nested._wrap_result(
+        torch.ops.nestedtensor.masked_softmax(input._impl, mask._impl, dim))
+
+
+def _impl(t):
+    return t._impl if isinstance(t, nestedtensor.NestedTensor) else t
+
+
+def ragged_attention(query, key, value, num_heads, scaling=None,
+                     attn_mask=None, key_padding_mask=None, is_causal=False):
+    """
+    Computes softmax(q k^T * scaling + attn_mask) v for each head of each
+    sequence of the NestedTensors query, key and value of shape (N, L_i, E)
+    without materializing the attention weights. scaling defaults to
+    head_dim ** -0.5.
+
+    attn_mask is either a NestedTensor of shape (N, L_i, S_i) or a Tensor of
+    shape (L, S) whose leading [L_i, S_i] block applies to sequence i. Boolean
+    masks exclude the entries that are True, other masks are added to the
+    scores. key_padding_mask is a boolean NestedTensor of shape (N, S_i) or
+    Tensor of shape (N, S) whose True entries exclude keys. If is_causal is
+    set, query l of each sequence only attends to keys 0 through l. None of
+    the masks is ever expanded to a dense (N, L, S) Tensor.
+    """
+    if scaling is None:
+        scaling = float(query.size(2) // num_heads) ** -0.5
+    return nestedtensor.nested.nested._wrap_result(
+        torch.ops.nestedtensor.ragged_attention(
+            query._impl, key._impl, value._impl, num_heads, scaling,
+            _impl(attn_mask), _impl(key_padding_mask), is_causal))
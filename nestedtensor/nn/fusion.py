@@ -0,0 +1,74 @@
+import torch
+import nestedtensor
+
+
+def fold_conv_bn_eval(conv, bn):
+    """
+    Returns a copy of the Conv2d conv whose weight and bias absorb the scale
+    and shift of the frozen, i.e. evaluation mode, BatchNorm2d bn that follows
+    it. Modules such as FrozenBatchNorm2d, which store weight, bias,
+    running_mean and running_var as buffers, are supported as well. Those are
+    always frozen, so only BatchNorm modules need to be in eval mode. The mode
+    of conv doesn't matter, since a convolution behaves the same in both.
+    """
+    if isinstance(bn, torch.nn.modules.batchnorm._BatchNorm):
+        assert not bn.training, "Fusion only supported in eval mode"
+    eps = getattr(bn, "eps", 1e-5)
+    with torch.no_grad():
+        scale = (bn.running_var + eps).rsqrt()
+        if bn.weight is not None:
+            scale = scale * bn.weight
+        shift = -bn.running_mean * scale
+        if bn.bias is not None:
+            shift = shift + bn.bias
+        fused = torch.nn.Conv2d(conv.in_channels,
+                                conv.out_channels,
+                                conv.kernel_size,
+                                stride=conv.stride,
+                                padding=conv.padding,
+                                dilation=conv.dilation,
+                                groups=conv.groups,
+                                bias=True,
+                                padding_mode=conv.padding_mode)
+        fused = fused.to(device=conv.weight.device, dtype=conv.weight.dtype)
+        fused.weight.copy_(conv.weight * scale.reshape(-1, 1, 1, 1))
+        if conv.bias is not None:
+            shift = shift + conv.bias * scale
+        fused.bias.copy_(shift)
+    fused.eval()
+    return fused
+
+
+class Conv2dReLU(torch.nn.Module):
+    """
+    Applies conv followed by a ReLU. On NestedTensors both run in a single
+    pass, without allocating the output of conv as a separate NestedTensor.
+    """
+
+    def __init__(self, conv):
+        super(Conv2dReLU, self).__init__()
+        assert conv.padding_mode == "zeros", "Only zero padding is supported"
+        self.conv = conv
+
+    def forward(self, x):
+        if not isinstance(x, nestedtensor.NestedTensor):
+            return torch.nn.functional.relu(self.conv(x))
+        return nestedtensor.nested.nested._wrap_result(
+            torch.ops.nestedtensor.conv2d_relu(x._impl,
+                                               self.conv.weight,
+                                               self.conv.bias,
+                                               list(self.conv.stride),
+                                               list(self.conv.padding),
+                                               list(self.conv.dilation),
+                                               self.conv.groups))
+
+
+def fuse_conv_bn_eval(conv, bn, relu=False):
+    """
+    Folds the frozen BatchNorm2d bn into the preceding Conv2d conv. If relu
+    is set, a following ReLU is fused as well.
+    """
+    fused = fold_conv_bn_eval(conv, bn)
+    if relu:
+        return Conv2dReLU(fused)
+    return fused
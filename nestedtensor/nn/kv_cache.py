@@ -0,0 +1,72 @@
+import torch
+import nestedtensor
+from .functional import _impl
+
+
+class RaggedKVCache(object):
+    """
+    Keys and values of a batch of sequences for incremental decoding. Each
+    sequence owns a slot of rows in a shared buffer with some slack, so that
+    appending a row is amortized O(1) and never copies the other sequences.
+    Finished sequences can be removed and new ones added. attention reads the
+    cached rows in place.
+    """
+
+    def __init__(self, num_sequences, key_dim, value_dim=None, capacity=16,
+                 dtype=None, device=None):
+        if value_dim is None:
+            value_dim = key_dim
+        like = torch.empty(0, dtype=dtype, device=device)
+        self._cache = nestedtensor._C.RaggedKVCache(
+            num_sequences, key_dim, value_dim, capacity, like)
+
+    def __len__(self):
+        return self._cache.num_sequences()
+
+    def lengths(self):
+        return self._cache.lengths()
+
+    def append(self, keys, values):
+        """
+        Appends keys and values to each sequence. Both are either NestedTensors
+        of shape (N, L_i, E) or Tensors of shape (N, E) with one row per
+        sequence.
+        """
+        self._cache.append(_impl(keys), _impl(values))
+
+    def add_sequences(self, count):
+        self._cache.add_sequences(count)
+
+    def remove(self, indices):
+        """
+        Removes the sequences at the given indices. The remaining sequences
+        keep their order.
+        """
+        self._cache.remove(list(indices))
+
+    def attention(self, query, num_heads, scaling=None, is_causal=False):
+        """
+        Ragged attention of query, a NestedTensor of shape (N, L_i, E) or a
+        Tensor of shape (N, E), over the cached keys and values of each
+        sequence. scaling defaults to head_dim ** -0.5. If is_causal, the L_i
+        queries of a sequence are taken to be its newest L_i cached positions,
+        e.g. after appending the keys and values of a prompt, and query l
+        attends to the keys [0, length - L_i + l].
+        """
+        if scaling is None:
+            scaling = float(query.size(-1) // num_heads) ** -0.5
+        return nestedtensor.nested.nested._wrap_result(
+            self._cache.attention(_impl(query), num_heads, scaling, is_causal))
+
+    def _rows(self, buffer):
+        return nestedtensor.nested_tensor(
+            [buffer.narrow(0, start, length) for (start, length)
+             in zip(self._cache.starts(), self._cache.lengths())])
+
+    def keys(self):
+        """Returns a copy of the cached keys as a NestedTensor."""
+        return self._rows(self._cache.key_buffer())
+
+    def values(self):
+        """Returns a copy of the cached values as a NestedTensor."""
+        return self._rows(self._cache.value_buffer())
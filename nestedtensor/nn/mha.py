@@ -7,6 +7,7 @@ from torch.nn.modules.module import Module
 import torch
 import torch.nn.functional as F
 import nestedtensor
+from .functional import _impl
 
 # NT case query, key, value have nested_dim 1 and are of shape (bsz, tgt_len, embed_dim)
 
@@ -42,7 +43,8 @@ def multi_head_attention_forward(query,                           # type: Nested
                                  # type: Optional[Tensor]
                                  static_k=None,
                                  # type: Optional[Tensor]
-                                 static_v=None
+                                 static_v=None,
+                                 is_causal=False,                 # type: bool
                                  ):
     assert isinstance(query, nestedtensor.NestedTensor)
     assert isinstance(key, nestedtensor.NestedTensor)
@@ -52,8 +54,6 @@ def multi_head_attention_forward(query,                           # type: Nested
 
     # TODO: Explicitly unsupported flags
     assert not use_separate_proj_weight
-    assert attn_mask is None
-    assert key_padding_mask is None
     assert bias_k is None
     assert bias_v is None
     assert static_k is None
@@ -81,7 +81,10 @@ def multi_head_attention_forward(query,                           # type: Nested
                                           in_proj_bias,
                                           scaling,
                                           out_proj_weight,
-                                          out_proj_bias), None
+                                          out_proj_bias,
+                                          _impl(attn_mask),
+                                          _impl(key_padding_mask),
+                                          is_causal), None
 
 
 class MultiheadAttention(Module):
@@ -157,7 +160,7 @@ class MultiheadAttention(Module):
         super(MultiheadAttention, self).__setstate__(state)
 
     def forward(self, query, key, value, key_padding_mask=None,
-                need_weights=True, attn_mask=None):
+                need_weights=True, attn_mask=None, is_causal=False):
         if not self._qkv_same_embed_dim:
             return multi_head_attention_forward(
                 query, key, value, self.embed_dim, self.num_heads,
@@ -168,7 +171,7 @@ class MultiheadAttention(Module):
                 key_padding_mask=key_padding_mask, need_weights=need_weights,
                 attn_mask=attn_mask, use_separate_proj_weight=True,
                 q_proj_weight=self.q_proj_weight, k_proj_weight=self.k_proj_weight,
-                v_proj_weight=self.v_proj_weight)
+                v_proj_weight=self.v_proj_weight, is_causal=is_causal)
         else:
             return multi_head_attention_forward(
                 query, key, value, self.embed_dim, self.num_heads,
@@ -177,4 +180,4 @@ class MultiheadAttention(Module):
                 self.dropout, self.out_proj.weight, self.out_proj.bias,
                 training=self.training,
                 key_padding_mask=key_padding_mask, need_weights=need_weights,
-                attn_mask=attn_mask)
+                attn_mask=attn_mask, is_causal=is_causal)
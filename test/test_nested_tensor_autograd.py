@@ -45,6 +45,108 @@ class TestNestedTensorAutograd(TestCase):
         # self.assertIsNone(tensor2.grad)
         # self.assertIsNotNone(nt2[0].grad)
 
+    def test_packed_unary_grad(self):
+        tensors = [torch.randn(2, 3), torch.randn(5, 3), torch.randn(1, 3)]
+        nt = nestedtensor.nested_tensor(tensors, requires_grad=True)
+        nt_res = torch.tanh(torch.sigmoid(nt)).clamp(min=0.6)
+        self.assertTrue(nt_res.is_contiguous())
+        nt_res.sum().backward()
+
+        for i, t in enumerate(tensors):
+            t = t.clone().requires_grad_()
+            res = torch.tanh(torch.sigmoid(t)).clamp(min=0.6)
+            res.sum().backward()
+            self.assertEqual(nt_res[i], res)
+            self.assertEqual(nt.grad[i], t.grad)
+
+    def test_packed_binary_grad(self):
+        tensors_a = [torch.randn(2, 3), torch.randn(5, 3), torch.randn(1, 3)]
+        tensors_b = [torch.rand(2, 3) + 0.5, torch.rand(5, 3) + 0.5,
+                     torch.rand(1, 3) + 0.5]
+        a = nestedtensor.nested_tensor(tensors_a, requires_grad=True)
+        b = nestedtensor.nested_tensor(tensors_b, requires_grad=True)
+        nt_res = (a * b - a / b).sub(b, alpha=2)
+        self.assertTrue(nt_res.is_contiguous())
+        nt_res.sum().backward()
+
+        for i in range(len(tensors_a)):
+            t_a = tensors_a[i].clone().requires_grad_()
+            t_b = tensors_b[i].clone().requires_grad_()
+            res = (t_a * t_b - t_a / t_b).sub(t_b, alpha=2)
+            res.sum().backward()
+            self.assertEqual(nt_res[i], res)
+            self.assertEqual(a.grad[i], t_a.grad)
+            self.assertEqual(b.grad[i], t_b.grad)
+
+    def test_packed_dense_broadcast_grad(self):
+        tensors = [torch.randn(2, 3), torch.randn(5, 3), torch.randn(1, 3)]
+        nt = nestedtensor.nested_tensor(tensors, requires_grad=True)
+        bias = torch.randn(3, requires_grad=True)
+        scale = torch.randn(1, 3, requires_grad=True)
+        nt_res = (nt + bias) * scale - bias
+        self.assertTrue(nt_res.is_contiguous())
+        nt_res.sum().backward()
+
+        t_bias = bias.detach().clone().requires_grad_()
+        t_scale = scale.detach().clone().requires_grad_()
+        for i, t in enumerate(tensors):
+            t = t.clone().requires_grad_()
+            res = (t + t_bias) * t_scale - t_bias
+            res.sum().backward()
+            self.assertEqual(nt_res[i], res)
+            self.assertEqual(nt.grad[i], t.grad)
+        self.assertEqual(bias.grad, t_bias.grad)
+        self.assertEqual(scale.grad, t_scale.grad)
+
+    def test_segment_broadcast_grad(self):
+        tensors = [torch.randn(2, 3), torch.randn(5, 3), torch.randn(1, 3)]
+        nt = nestedtensor.nested_tensor(tensors, requires_grad=True)
+        weight = torch.randn(3, 1, 1, requires_grad=True)
+        offset = torch.randn(3, 1, 3, requires_grad=True)
+        nt_res = nt * weight - offset
+        self.assertTrue(nt_res.is_contiguous())
+        nt_res.sum().backward()
+
+        t_weight = weight.detach().clone().requires_grad_()
+        t_offset = offset.detach().clone().requires_grad_()
+        for i, t in enumerate(tensors):
+            t = t.clone().requires_grad_()
+            res = t * t_weight[i] - t_offset[i]
+            res.sum().backward()
+            self.assertEqual(nt_res[i], res)
+            self.assertEqual(nt.grad[i], t.grad)
+        self.assertEqual(weight.grad, t_weight.grad)
+        self.assertEqual(offset.grad, t_offset.grad)
+
+    def test_mapper_grad(self):
+        tensors = [torch.randn(2, 3), torch.randn(5, 3), torch.randn(1, 3)]
+        nt = nestedtensor.nested_tensor(tensors, requires_grad=True)
+        weight = torch.randn(3, 4, requires_grad=True)
+        nt_res = torch.matmul(nt, weight).transpose(1, 2)
+        nt_res.sum().backward()
+
+        t_weight = weight.detach().clone().requires_grad_()
+        for i, t in enumerate(tensors):
+            t = t.clone().requires_grad_()
+            res = torch.matmul(t, t_weight).transpose(0, 1)
+            res.sum().backward()
+            self.assertEqual(nt_res[i], res)
+            self.assertEqual(nt.grad[i], t.grad)
+        self.assertEqual(weight.grad, t_weight.grad)
+
+    def test_no_grad(self):
+        tensors = [torch.randn(2, 3), torch.randn(5, 3), torch.randn(1, 3)]
+        nt = nestedtensor.nested_tensor(tensors, requires_grad=True)
+        with torch.no_grad():
+            for fn in [lambda x: x.transpose(1, 2),
+                       lambda x: torch.cumsum(x, 2),
+                       lambda x: x.cos()]:
+                nt_res = fn(nt)
+                self.assertFalse(nt_res.requires_grad)
+                for i, t in enumerate(tensors):
+                    self.assertEqual(nt_res[i], fn(t.unsqueeze(0))[0])
+        self.assertTrue(nt.transpose(1, 2).requires_grad)
+
     def test_grad_to_tensor_mask(self):
         def some_func(x):
             return torch.sum(x ** 2 + x ** 3)
@@ -133,6 +133,39 @@ class TestAutogradFunctional(TestCase):
         #                                    affine=False, track_running_stats=True).eval())
         # _test(lambda: torch.nn.BatchNorm2d(3))
 
+
+    def test_nn_batch_norm_packed(self):
+        inputs = [torch.randn(3, 5, 6), torch.randn(3, 4, 4), torch.randn(3, 1, 7)]
+        for affine in [True, False]:
+            nt_bn = torch.nn.BatchNorm2d(3, momentum=0.3, affine=affine)
+            t_bn = torch.nn.BatchNorm2d(3, momentum=0.3, affine=affine)
+            t_bn.load_state_dict(nt_bn.state_dict())
+
+            nt = ntnt(inputs)
+            nt_res = nt_bn(nt)
+            (nt_res * nt_res).sum().backward()
+
+            # Statistics over all constituents equal those of a single image
+            # whose pixels are the pixels of all constituents.
+            ts = [t.clone().requires_grad_() for t in inputs]
+            t_res = t_bn(torch.cat([t.reshape(3, -1) for t in ts], 1)[None, :, :, None])
+            (t_res * t_res).sum().backward()
+            t_res = t_res.reshape(3, -1).split([t[0].numel() for t in inputs], 1)
+            for i, t in enumerate(ts):
+                self.assertEqual(nt_res[i], t_res[i].reshape(t.size()))
+                self.assertEqual(nt.grad[i], t.grad)
+            self.assertEqual(nt_bn.running_mean, t_bn.running_mean)
+            self.assertEqual(nt_bn.running_var, t_bn.running_var)
+            if affine:
+                self.assertEqual(nt_bn.weight.grad, t_bn.weight.grad)
+                self.assertEqual(nt_bn.bias.grad, t_bn.bias.grad)
+
+            nt_bn.eval()
+            t_bn.eval()
+            nt_res = nt_bn(ntnt(inputs))
+            for i, t in enumerate(inputs):
+                self.assertEqual(nt_res[i], t_bn(t.unsqueeze(0)).squeeze(0))
+
     def test_nn_relu(self):
         inputs = [
             torch.randn(3, 500, 600, requires_grad=True),
@@ -335,6 +368,130 @@ class TestAutogradFunctional(TestCase):
         self.assertEqual(attn_output.squeeze(1), nt_attn_output[0])
         # XXX: This needs a test that actually checks the parameter gradients
 
+    def test_ragged_attention(self):
+        num_heads = 2
+        q_lens = [3, 70, 1, 40]
+        kv_lens = [5, 90, 2, 33]
+        qs = [torch.randn(l, 4) for l in q_lens]
+        ks = [torch.randn(l, 4) for l in kv_lens]
+        vs = [torch.randn(l, 6) for l in kv_lens]
+        q, k, v = ntnt(qs), ntnt(ks), ntnt(vs)
+        result = nestedtensor.nn.functional.ragged_attention(q, k, v, num_heads)
+        (result * result).sum().backward()
+
+        def _heads(t):
+            return t.reshape(t.size(0), num_heads, -1).transpose(0, 1)
+
+        for i in range(len(q_lens)):
+            q_i, k_i, v_i = [t[i].clone().requires_grad_() for t in (qs, ks, vs)]
+            weights = torch.softmax(torch.matmul(
+                _heads(q_i), _heads(k_i).transpose(1, 2)) * 2 ** -0.5, -1)
+            t_result = torch.matmul(weights, _heads(v_i)).transpose(0, 1).reshape(-1, 6)
+            (t_result * t_result).sum().backward()
+            self.assertEqual(result[i], t_result)
+            self.assertEqual(q.grad[i], q_i.grad)
+            self.assertEqual(k.grad[i], k_i.grad)
+            self.assertEqual(v.grad[i], v_i.grad)
+
+    def test_ragged_attention_masks(self):
+        num_heads = 2
+        q_lens = [3, 70, 1, 40]
+        kv_lens = [5, 90, 2, 40]
+        qs = [torch.randn(l, 4) for l in q_lens]
+        ks = [torch.randn(l, 4) for l in kv_lens]
+        vs = [torch.randn(l, 4) for l in kv_lens]
+        biases = [torch.randn(l, s) for (l, s) in zip(q_lens, kv_lens)]
+        bool_mask = torch.rand(70, 90) < 0.3
+        bool_mask[:, 0] = False
+        key_padding_mask = torch.rand(4, 90) < 0.3
+        key_padding_mask[:, 0] = False
+
+        def _heads(t):
+            return t.reshape(t.size(0), num_heads, -1).transpose(0, 1)
+
+        def _test(kwargs, masks):
+            for mode in ["never", "auto"]:
+                _test_mode(kwargs, masks, mode)
+
+        def _test_mode(kwargs, masks, mode):
+            q, k, v = ntnt(qs), ntnt(ks), ntnt(vs)
+            with nestedtensor.packed_mode(mode):
+                result = nestedtensor.nn.functional.ragged_attention(
+                    q, k, v, num_heads, **kwargs)
+                (result * result).sum().backward()
+            for i in range(len(q_lens)):
+                q_i, k_i, v_i = [t[i].clone().requires_grad_() for t in (qs, ks, vs)]
+                scores = torch.matmul(_heads(q_i), _heads(k_i).transpose(1, 2)) * 2 ** -0.5
+                weights = torch.softmax(scores + masks[i], -1)
+                t_result = torch.matmul(weights, _heads(v_i)).transpose(0, 1).reshape(-1, 4)
+                (t_result * t_result).sum().backward()
+                self.assertEqual(result[i], t_result)
+                self.assertEqual(q.grad[i], q_i.grad)
+                self.assertEqual(k.grad[i], k_i.grad)
+                self.assertEqual(v.grad[i], v_i.grad)
+
+        def _neg_inf(mask):
+            return torch.zeros(mask.size()).masked_fill(mask, float("-inf"))
+
+        causal = [_neg_inf(torch.ones(l, s, dtype=torch.bool).triu(1))
+                  for (l, s) in zip(q_lens, kv_lens)]
+        padding = [_neg_inf(key_padding_mask[i, :s]).expand(l, s)
+                   for i, (l, s) in enumerate(zip(q_lens, kv_lens))]
+        _test(dict(is_causal=True), causal)
+        _test(dict(attn_mask=nestedtensor.nested_tensor(biases)), biases)
+        _test(dict(attn_mask=bool_mask),
+              [_neg_inf(bool_mask[:l, :s]) for (l, s) in zip(q_lens, kv_lens)])
+        _test(dict(key_padding_mask=key_padding_mask, is_causal=True),
+              [c + p for (c, p) in zip(causal, padding)])
+
+        embed_dim = 4
+        mha = torch.nn.MultiheadAttention(embed_dim, num_heads).eval()
+        nt_mha = nestedtensor.nn.MultiheadAttention(embed_dim, num_heads).eval()
+        nt_mha.load_state_dict(mha.state_dict())
+        nt = ntnt(qs)
+        result, _ = nt_mha(nt, nt, nt, need_weights=False, is_causal=True)
+        for i, t in enumerate(qs):
+            t = t.unsqueeze(1)
+            t_result, _ = mha(t, t, t, attn_mask=causal[i][:, :t.size(0)])
+            self.assertEqual(result[i], t_result.squeeze(1))
+
+    def test_mha_self_attention(self):
+        embed_dim = 4
+        num_heads = 2
+        lengths = [3, 40, 1, 7]
+        mha = torch.nn.MultiheadAttention(embed_dim, num_heads).eval()
+        nt_mha = nestedtensor.nn.MultiheadAttention(embed_dim, num_heads).eval()
+        nt_mha.load_state_dict(mha.state_dict())
+        inputs = [torch.randn(l, embed_dim) for l in lengths]
+        for mode in ["never", "auto", "always"]:
+            with nestedtensor.packed_mode(mode):
+                nt_mha.zero_grad()
+                nt = ntnt(inputs)
+                result, _ = nt_mha(nt, nt, nt, need_weights=False)
+                (result * result).sum().backward()
+            mha.zero_grad()
+            for i, t in enumerate(inputs):
+                t = t.clone().unsqueeze(1).requires_grad_()
+                t_result, _ = mha(t, t, t)
+                (t_result * t_result).sum().backward()
+                self.assertEqual(result[i], t_result.squeeze(1))
+                self.assertEqual(nt.grad[i], t.grad.squeeze(1))
+            self.assertEqual(nt_mha.in_proj_weight.grad, mha.in_proj_weight.grad)
+            self.assertEqual(nt_mha.in_proj_bias.grad, mha.in_proj_bias.grad)
+            self.assertEqual(nt_mha.out_proj.weight.grad, mha.out_proj.weight.grad)
+
+        # Types the attention kernel doesn't support are computed for each
+        # constituent.
+        nt_mha = nt_mha.to(torch.bfloat16)
+        with torch.no_grad():
+            nt = ntnt([t.to(torch.bfloat16) for t in inputs])
+            result, _ = nt_mha(nt, nt, nt, need_weights=False)
+            for i, t in enumerate(inputs):
+                t = t.unsqueeze(1)
+                t_result, _ = mha(t, t, t)
+                self.assertTrue(torch.allclose(
+                    result[i].float(), t_result.squeeze(1), atol=5e-2, rtol=5e-2))
+
     def test_mha_detr(self):
         NDIM = 128
         BSZ = 8
@@ -455,6 +612,73 @@ class TestAutogradFunctional(TestCase):
             nt_res = maxPool2d(nt)
             self.assertEqual(ntnt(tensor_res), nt_res)
 
+    def test_nn_conv2d_parallel(self):
+        inputs = [torch.randn(3, 20, 30), torch.randn(3, 18, 18),
+                  torch.randn(3, 9, 25), torch.randn(3, 40, 12)]
+        conv2d = torch.nn.Conv2d(3, 4, kernel_size=(3, 3), bias=True)
+        maxPool2d = torch.nn.MaxPool2d(kernel_size=(3, 3), stride=2)
+
+        def _run():
+            nt = ntnt(inputs)
+            nt_res = maxPool2d(conv2d(nt))
+            nt_res.sum().backward()
+            return nt_res, nt.grad, conv2d.weight.grad
+
+        serial_res, serial_grad, serial_weight_grad = _run()
+        conv2d.zero_grad()
+        self.assertEqual(nestedtensor._C.get_parallel_grain_size(), 0)
+        nestedtensor._C.set_parallel_grain_size(1)
+        try:
+            parallel_res, parallel_grad, parallel_weight_grad = _run()
+        finally:
+            nestedtensor._C.set_parallel_grain_size(0)
+        self.assertEqual(serial_res, parallel_res)
+        self.assertEqual(serial_grad, parallel_grad)
+        self.assertEqual(serial_weight_grad, parallel_weight_grad)
+
+    def test_nn_conv2d_size_buckets(self):
+        sizes = [(20, 30), (20, 30), (18, 18), (20, 30), (18, 18), (9, 25)]
+        inputs = [torch.randn(3, h, w) for (h, w) in sizes]
+        conv2d = torch.nn.Conv2d(3, 4, kernel_size=(3, 3), bias=True)
+        maxPool2d = torch.nn.MaxPool2d(kernel_size=(3, 3), stride=2)
+        avgPool2d = torch.nn.AdaptiveAvgPool2d((4, 4))
+
+        def _run(mode):
+            conv2d.zero_grad()
+            with nestedtensor.packed_mode(mode):
+                nt = ntnt(inputs)
+                nt_res = avgPool2d(maxPool2d(conv2d(nt)))
+                nt_res.sum().backward()
+            return nt_res, nt.grad, conv2d.weight.grad.clone(), conv2d.bias.grad.clone()
+
+        bucket_results = _run("auto")
+        serial_results = _run("never")
+        for bucket_result, serial_result in zip(bucket_results, serial_results):
+            self.assertEqual(bucket_result, serial_result)
+
+    def test_nn_conv2d_packed(self):
+        sizes = [(20, 30), (7, 11), (18, 18), (21, 31), (5, 5), (20, 31)]
+        inputs = [torch.randn(3, h, w) for (h, w) in sizes]
+        for bias in [True, False]:
+            conv2d = torch.nn.Conv2d(3, 4, kernel_size=(3, 2), stride=(2, 1),
+                                     padding=(1, 0), dilation=(1, 2), bias=bias)
+
+            def _run(mode):
+                conv2d.zero_grad()
+                with nestedtensor.packed_mode(mode):
+                    nt = ntnt(inputs)
+                    nt_res = conv2d(nt)
+                    (nt_res * nt_res).sum().backward()
+                grads = [nt.grad, conv2d.weight.grad.clone()]
+                if bias:
+                    grads.append(conv2d.bias.grad.clone())
+                return [nt_res] + grads
+
+            packed_results = _run("auto")
+            serial_results = _run("never")
+            for packed_result, serial_result in zip(packed_results, serial_results):
+                self.assertEqual(packed_result, serial_result)
+
     def test_fzbn2d(self):
         class FrozenBatchNorm2d(torch.nn.Module):
             """
@@ -519,6 +743,29 @@ class TestAutogradFunctional(TestCase):
         self.assertEqual(len((list(b0.named_parameters()))), 0)
         self.assertEqual(len((list(b1.named_parameters()))), 0)
 
+    def test_fuse_conv_bn_eval(self):
+        conv = torch.nn.Conv2d(3, 5, kernel_size=3, padding=1, bias=False)
+        bn = torch.nn.BatchNorm2d(5)
+        bn.running_mean.uniform_()
+        bn.running_var.uniform_(0.5, 1.5)
+        frozen_bn = NTFrozenBatchNorm2d(5)
+        frozen_bn.load_state_dict(bn.state_dict())
+        conv.eval()
+        bn.eval()
+        for norm in [bn, frozen_bn]:
+            for sizes in [[(7, 8), (5, 5), (9, 4)], [(6, 6), (6, 6), (4, 9)]]:
+                inputs = [torch.randn(3, h, w) for (h, w) in sizes]
+                fused = nestedtensor.nn.fuse_conv_bn_eval(conv, norm, relu=True)
+                nt = ntnt(inputs)
+                nt_res = fused(nt)
+                nt_res.sum().backward()
+                for i, t in enumerate(inputs):
+                    t = t.clone().requires_grad_()
+                    t_res = torch.relu(norm(conv(t.unsqueeze(0)))).squeeze(0)
+                    t_res.sum().backward()
+                    self.assertEqual(nt_res[i], t_res)
+                    self.assertEqual(nt.grad[i], t.grad)
+
     def test_layer_norm(self):
         layer_norm = torch.nn.LayerNorm((0,))
         t0 = torch.randn(3)
@@ -192,6 +192,19 @@ class TestNestedTensor(TestCase):
             nt2 = constructor([a])
             self.assertEqual(a.element_size(), nt2.element_size())
 
+    def test_metadata_cache(self):
+        a = nestedtensor.nested_tensor([torch.randn(1, 2), torch.randn(3, 2)])
+        nestedtensor._C._reset_metadata_cache_stats()
+        self.assertEqual(a.nested_size()[1], torch.Size([3, 2]))
+        self.assertEqual(a.nested_stride()[1], (2, 1))
+        self.assertEqual(a.size(2), 2)
+        hits, misses = nestedtensor._C._metadata_cache_stats()
+        self.assertGreaterEqual(hits, 3)
+        self.assertEqual(misses, 0)
+        nestedtensor.nested_tensor([torch.randn(1, 2)])
+        hits, misses = nestedtensor._C._metadata_cache_stats()
+        self.assertGreater(misses, 0)
+
     def test_nested_size(self):
         for constructor in _iter_constructors():
             a = constructor([])
@@ -491,6 +491,57 @@ class TestFunctional(TestCase):
         nt = nestedtensor.nested_tensor(ts)
         self._test_softmax(ts, nt)
 
+    def test_ragged_kv_cache(self):
+        num_heads = 2
+        lengths = [3, 1, 4]
+        cache = nestedtensor.nn.RaggedKVCache(3, 4, 6, capacity=2)
+        keys = [torch.randn(l, 4) for l in lengths]
+        values = [torch.randn(l, 6) for l in lengths]
+        cache.append(nestedtensor.nested_tensor(keys),
+                     nestedtensor.nested_tensor(values))
+        for step in range(10):
+            k, v = torch.randn(len(keys), 4), torch.randn(len(values), 6)
+            cache.append(k, v)
+            keys = [torch.cat([t, k[i:i + 1]]) for i, t in enumerate(keys)]
+            values = [torch.cat([t, v[i:i + 1]]) for i, t in enumerate(values)]
+            if step in [2, 5]:
+                cache.remove([1])
+                del keys[1], values[1]
+                cache.add_sequences(1)
+                keys.append(torch.randn(0, 4))
+                values.append(torch.randn(0, 6))
+        self.assertEqual(cache.lengths(), [len(t) for t in keys])
+        self.assertEqual(cache.keys(), nestedtensor.nested_tensor(keys))
+        self.assertEqual(cache.values(), nestedtensor.nested_tensor(values))
+
+        def _heads(t):
+            return t.reshape(t.size(0), num_heads, -1).transpose(0, 1)
+
+        def _attention(q, k, v):
+            weights = torch.softmax(torch.matmul(
+                _heads(q), _heads(k).transpose(1, 2)) * 2 ** -0.5, -1)
+            return torch.matmul(weights, _heads(v)).transpose(0, 1).reshape(-1, 6)
+
+        query = torch.randn(len(keys), 4)
+        result = cache.attention(query, num_heads)
+        for i in range(len(keys)):
+            self.assertEqual(result[i], _attention(query[i:i + 1], keys[i], values[i])[0])
+        queries = [torch.randn(l, 4) for l in [2, 1, 3]]
+        result = cache.attention(nestedtensor.nested_tensor(queries), num_heads)
+        for i in range(len(keys)):
+            self.assertEqual(result[i], _attention(queries[i], keys[i], values[i]))
+
+        # Causal attention of the newest positions of each sequence, such as
+        # the prompt right after it was appended.
+        result = cache.attention(
+            nestedtensor.nested_tensor(queries), num_heads, is_causal=True)
+        for i, q in enumerate(queries):
+            for l in range(len(q)):
+                end = len(keys[i]) - len(q) + l + 1
+                self.assertEqual(
+                    result[i][l],
+                    _attention(q[l:l + 1], keys[i][:end], values[i][:end])[0])
+
 
 if __name__ == "__main__":
     unittest.main()
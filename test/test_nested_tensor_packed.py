@@ -0,0 +1,190 @@
+import copy
+import threading
+import torch
+import nestedtensor
+import unittest
+
+from utils import TestCase
+
+
+def _run_with_grads(fn, tensors, dense):
+    nt = nestedtensor.nested_tensor(tensors, requires_grad=True)
+    dense = [d.detach().clone().requires_grad_() for d in dense]
+    result = fn(nt, *dense)
+    result.sum().backward()
+    return result, nt.grad, [d.grad for d in dense]
+
+
+class TestPackedMode(TestCase):
+
+    def test_set_packed_mode(self):
+        self.assertEqual(nestedtensor.get_packed_mode(), "auto")
+        nestedtensor.set_packed_mode("never")
+        self.assertEqual(nestedtensor.get_packed_mode(), "never")
+        with nestedtensor.packed_mode("always"):
+            self.assertEqual(nestedtensor.get_packed_mode(), "always")
+            with nestedtensor.packed_mode("auto"):
+                self.assertEqual(nestedtensor.get_packed_mode(), "auto")
+            self.assertEqual(nestedtensor.get_packed_mode(), "always")
+        self.assertEqual(nestedtensor.get_packed_mode(), "never")
+        nestedtensor.set_packed_mode("auto")
+        self.assertRaises(ValueError, lambda: nestedtensor.set_packed_mode("sometimes"))
+
+    def test_packed_mode_thread_local(self):
+        modes = []
+
+        def get_mode():
+            modes.append(nestedtensor.get_packed_mode())
+
+        with nestedtensor.packed_mode("never"):
+            thread = threading.Thread(target=get_mode)
+            thread.start()
+            thread.join()
+        self.assertEqual(modes, ["auto"])
+
+    def _test_modes(self, fn, tensors, dense):
+        results = []
+        for mode in ["never", "auto", "always"]:
+            with nestedtensor.packed_mode(mode):
+                results.append(_run_with_grads(fn, tensors, dense))
+        for result, grad, dense_grads in results[1:]:
+            self.assertEqual(result, results[0][0])
+            self.assertEqual(grad, results[0][1])
+            for dense_grad, expected in zip(dense_grads, results[0][2]):
+                self.assertEqual(dense_grad, expected)
+
+    def test_matmul(self):
+        tensors = [torch.randn(2, 3), torch.randn(5, 3), torch.randn(1, 3)]
+        weight = torch.randn(3, 4)
+        self._test_modes(lambda nt, w: torch.matmul(nt, w), tensors, [weight])
+        self._test_modes(
+            lambda nt, w: torch.matmul(nt.transpose(1, 2).transpose(1, 2), w),
+            tensors, [weight])
+
+    def test_grouped_matmul(self):
+        lengths = [3, 3, 3, 5, 3, 5, 1, 5, 5]
+        a = [torch.randn(2, i, 4) for i in lengths]
+        b = [torch.randn(2, 4, i) for i in lengths]
+        result = torch.matmul(nestedtensor.nested_tensor(a),
+                              nestedtensor.nested_tensor(b))
+        for i in range(len(lengths)):
+            self.assertEqual(result[i], torch.matmul(a[i], b[i]))
+
+    def test_addmm(self):
+        tensors = [torch.randn(2, 3), torch.randn(5, 3), torch.randn(1, 3)]
+        weight = torch.randn(3, 4)
+        bias = torch.randn(4)
+        self._test_modes(
+            lambda nt, b, w: torch.addmm(b, nt, w, beta=0.5, alpha=2.0),
+            tensors, [bias, weight])
+
+    def test_layer_norm(self):
+        tensors = [torch.randn(2, 4), torch.randn(5, 4), torch.randn(1, 4)]
+        self._test_modes(
+            lambda nt, w, b: torch.nn.functional.layer_norm(nt, (4,), w, b),
+            tensors, [torch.randn(4), torch.randn(4)])
+        self._test_modes(
+            lambda nt: torch.nn.functional.layer_norm(nt, (4,)), tensors, [])
+
+    def test_batch_norm(self):
+        tensors = [torch.randn(3, 2, 4), torch.randn(3, 5, 1), torch.randn(3, 1, 3)]
+        batch_norm = torch.nn.BatchNorm2d(3).train()
+        modules = []
+
+        def fn(nt):
+            modules.append(copy.deepcopy(batch_norm))
+            return modules[-1](nt)
+
+        self._test_modes(fn, tensors, [])
+        for module in modules[1:]:
+            self.assertEqual(module.running_mean, modules[0].running_mean)
+            self.assertEqual(module.running_var, modules[0].running_var)
+            self.assertEqual(module.weight.grad, modules[0].weight.grad)
+            self.assertEqual(module.bias.grad, modules[0].bias.grad)
+
+    def test_softmax(self):
+        tensors = [torch.randn(2, 3, 3), torch.randn(2, 5, 5), torch.randn(2, 1, 1)]
+        for dim in [1, 2, 3, -1]:
+            self._test_modes(
+                lambda nt: torch.nn.functional.softmax(nt, dim), tensors, [])
+            self._test_modes(
+                lambda nt: torch.nn.functional.log_softmax(nt, dim), tensors, [])
+        nt = nestedtensor.nested_tensor(tensors)
+        result = torch.nn.functional.log_softmax(nt, 2)
+        for i, t in enumerate(tensors):
+            self.assertEqual(result[i], torch.nn.functional.log_softmax(t, 1))
+        # Contiguous rows longer than a vector chunk, with a ragged tail.
+        tensors = [torch.randn(3, 1001), torch.randn(700, 3), torch.randn(1, 7)]
+        for dim in [1, 2]:
+            self._test_modes(
+                lambda nt: torch.nn.functional.softmax(nt, dim), tensors, [])
+            self._test_modes(
+                lambda nt: torch.nn.functional.log_softmax(nt, dim), tensors, [])
+
+    def test_masked_softmax(self):
+        tensors = [torch.randn(2, 3, 3), torch.randn(2, 5, 5), torch.randn(2, 1, 1)]
+        masks = [torch.zeros_like(t).masked_fill(torch.rand_like(t) < 0.3, float("-inf"))
+                 for t in tensors]
+        for mask in masks:
+            mask[:, :, 0] = 0
+        for mode in ["never", "auto", "always"]:
+            with nestedtensor.packed_mode(mode):
+                nt = nestedtensor.nested_tensor(tensors, requires_grad=True)
+                result = nestedtensor.nn.functional.masked_softmax(
+                    nt, nestedtensor.nested_tensor(masks), -1)
+                (result * result).sum().backward()
+            for i, t in enumerate(tensors):
+                t = t.clone().requires_grad_()
+                t_result = torch.softmax(t + masks[i], -1)
+                (t_result * t_result).sum().backward()
+                self.assertEqual(result[i], t_result)
+                self.assertEqual(nt.grad[i], t.grad)
+
+    def test_elementwise(self):
+        tensors = [torch.randn(2, 3), torch.randn(5, 3), torch.randn(1, 3)]
+        self._test_modes(lambda nt: (nt.transpose(1, 2) * 2).cos(), tensors, [])
+        self._test_modes(lambda nt, d: nt * d, tensors, [torch.randn(3, 1, 3)])
+        self._test_modes(lambda nt: nt.sum(2), tensors, [])
+
+    def test_segment_broadcast(self):
+        tensors = [torch.randn(2, 3), torch.randn(5, 3), torch.randn(1, 3)]
+        ragged = [torch.randn(2, 3), torch.randn(2, 4)]
+        empty = [torch.randn(2, 0), torch.randn(3, 0)]
+        cases = [(tensors, torch.randn(3, 1, 3)),
+                 (tensors, torch.randn(3, 1, 1)),
+                 (ragged, torch.randn(2, 2, 1)),
+                 (empty, torch.randn(2, 1, 1))]
+        for tensors, dense in cases:
+            self._test_modes(lambda nt, d: nt * d, tensors, [dense])
+            self._test_modes(lambda nt, d: d - nt, tensors, [dense])
+            for mode in ["never", "auto", "always"]:
+                with nestedtensor.packed_mode(mode):
+                    nt = nestedtensor.nested_tensor(tensors)
+                    result = nt * dense
+                    nt.mul_(dense)
+                for i, t in enumerate(tensors):
+                    self.assertEqual(result[i], t * dense[i])
+                    self.assertEqual(nt[i], t * dense[i])
+
+    def test_to_tensor(self):
+        tensors = [torch.randn(2, 3), torch.randn(2, 3), torch.randn(2, 3)]
+        nt = nestedtensor.nested_tensor(tensors, requires_grad=True)
+        result = nt.to_tensor()
+        self.assertEqual(result, torch.stack(tensors))
+        (result * result).sum().backward()
+        self.assertEqual(nt.grad, nestedtensor.nested_tensor([2 * t for t in tensors]))
+        nt = nestedtensor.nested_tensor(tensors)
+        self.assertEqual(nt.to_tensor().data_ptr(), nt[0].data_ptr())
+
+        nt = nestedtensor.nested_tensor([[t, t.cos()] for t in tensors]).transpose(2, 3)
+        expected = torch.stack([torch.stack([t, t.cos()]) for t in tensors]).transpose(2, 3)
+        self.assertEqual(nt.to_tensor(), expected)
+        nestedtensor._C.set_parallel_grain_size(1)
+        try:
+            self.assertEqual(nt.to_tensor(), expected)
+        finally:
+            nestedtensor._C.set_parallel_grain_size(0)
+
+
+if __name__ == "__main__":
+    unittest.main()
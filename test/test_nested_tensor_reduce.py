@@ -58,11 +58,80 @@ class TestReduce(TestCase):
         self._test_reduce_dim(torch.sum)
 
     def test_mean(self):
-        self._test_allreduce(lambda x: x.mean())
+        self._test_allreduce(lambda x: x.mean(), True)
         self._test_reduce_dim(torch.mean)
 
     def test_prod(self):
         self._test_allreduce(lambda x: x.prod())
+        self._test_reduce_dim(torch.prod)
+
+    def test_reduce_dim_grad(self):
+        for fn in [torch.sum, torch.mean]:
+            for dims in [(1,), (2,), (1, 2)]:
+                for keepdim in [True, False]:
+                    ts = [torch.randn(2, 5, requires_grad=True),
+                          torch.randn(4, 3, requires_grad=True)]
+                    nt = ntnt(ts)
+                    result = fn(nt, dims, keepdim)
+                    result.sum().backward()
+                    for t in ts:
+                        fn(t, [d - 1 for d in dims], keepdim).sum().backward()
+                    self.assertEqual(nt.grad[0], ts[0].grad)
+                    self.assertEqual(nt.grad[1], ts[1].grad)
+
+    def test_max_min_dim(self):
+        for fn in [torch.max, torch.min]:
+            self._test_reduce_dim(lambda x, dim: fn(x, dim)[0])
+            self._test_reduce_dim(lambda x, dim: fn(x, dim)[1])
+        self._test_reduce_dim(torch.argmax)
+
+    def test_segmented_reduce(self):
+        ts = [torch.randn(2, 5, 3), torch.randn(4, 1, 3), torch.randn(0, 2, 3)]
+        nt = nestedtensor.nested_tensor(ts)
+        for dims in [(1,), (2,), (3,), (1, 2), (2, 3), (1, 2, 3)]:
+            for keepdim in [True, False]:
+                self.assertEqual(
+                    nestedtensor.nested_tensor(
+                        [torch.sum(t, [d - 1 for d in dims], keepdim) for t in ts]),
+                    torch.sum(nt, dims, keepdim))
+        ts = ts[:2]
+        nt = nestedtensor.nested_tensor(ts)
+        for dim in [1, 2, 3]:
+            for keepdim in [True, False]:
+                self.assertEqual(
+                    nestedtensor.nested_tensor(
+                        [torch.mean(t, dim - 1, keepdim) for t in ts]),
+                    torch.mean(nt, dim, keepdim))
+                values, indices = torch.max(nt, dim, keepdim)
+                self.assertEqual(
+                    nestedtensor.nested_tensor(
+                        [torch.max(t, dim - 1, keepdim)[0] for t in ts]),
+                    values)
+                self.assertEqual(
+                    nestedtensor.nested_tensor(
+                        [torch.max(t, dim - 1, keepdim)[1] for t in ts]),
+                    indices)
+        t = torch.tensor([1.0, float('nan'), 2.0])
+        nt = nestedtensor.nested_tensor([t])
+        self.assertTrue(torch.isnan(torch.max(nt, 1)[0][0]))
+        self.assertEqual(torch.max(nt, 1)[1][0], torch.max(t, 0)[1])
+
+    def test_segmented_reduce_rows(self):
+        # Rows longer than a vector chunk and a constituent whose rows are
+        # split across threads.
+        ts = [torch.randn(3, 1000), torch.randn(2000, 7), torch.randn(1, 300)]
+        nt = nestedtensor.nested_tensor(ts)
+        for dim in [1, 2]:
+            for fn in [torch.sum, torch.mean]:
+                self.assertEqual(
+                    nestedtensor.nested_tensor([fn(t, dim - 1) for t in ts]),
+                    fn(nt, dim))
+        ts = [torch.rand(2, 600) + 0.5, torch.rand(500, 3) + 0.5]
+        nt = nestedtensor.nested_tensor(ts)
+        for dim in [1, 2]:
+            self.assertEqual(
+                nestedtensor.nested_tensor([torch.prod(t, dim - 1) for t in ts]),
+                torch.prod(nt, dim))
 
 
 if __name__ == "__main__":